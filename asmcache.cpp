@@ -0,0 +1,217 @@
+﻿#include "asmcache.h"
+#include <iomanip>
+#include <cstdio>
+
+const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+const uint64_t FNV_PRIME = 0x100000001b3ull;
+const uint32_t CACHE_MAGIC = 0x43415652;   // "RVAC"
+const uint32_t MAX_CACHED_BYTES = 64 * 1024 * 1024;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t assembly_key(const string& source, const AssemblerOptions& options)
+{
+    uint64_t hash = FNV_OFFSET;
+    uint32_t header[3] = { ASSEMBLER_VERSION, options.compress ? 1u : 0u, options.optimize ? 1u : 0u };
+    hash = fnv1a(hash, header, sizeof(header));
+    return fnv1a(hash, source.data(), source.size());
+}
+
+AssemblyCache::AssemblyCache(size_t capacity, const string& directory)
+    : capacity(capacity), directory(directory), hitCount(0), missCount(0) {}
+
+shared_ptr<const AssembledProgram> AssemblyCache::assemble(const string& source, const AssemblerOptions& options)
+{
+    uint64_t key = assembly_key(source, options);
+    auto it = entries.find(key);
+    if (it != entries.end())
+    {
+        hitCount++;
+        return it->second;
+    }
+
+    auto program = make_shared<AssembledProgram>();
+    if (!directory.empty() && load(key, source.size(), *program))
+    {
+        hitCount++;
+        remember(key, program);
+        return program;
+    }
+
+    missCount++;
+    *program = ::assemble(source, options);
+    if (!directory.empty())
+        store(key, source.size(), *program);
+    remember(key, program);
+    return program;
+}
+
+void AssemblyCache::remember(uint64_t key, shared_ptr<const AssembledProgram> program)
+{
+    if (capacity == 0)
+        return;
+    while (entries.size() >= capacity)
+    {
+        entries.erase(order.front());
+        order.pop_front();
+    }
+    entries[key] = program;
+    order.push_back(key);
+}
+
+string AssemblyCache::path_for(uint64_t key) const
+{
+    ostringstream name;
+    name << directory << "/" << hex << setw(16) << setfill('0') << key << ".bin";
+    return name.str();
+}
+
+// ───────────── On-disk format ─────────────
+// Little-endian 32-bit fields: magic, version, source size (64-bit), entry,
+// then counted lists of chunks (address, size, bytes), defined symbols (name
+// length, name, address, line, local) and instructions (address, code, size,
+// source line), and last the peephole report (removed, rewritten, retargeted,
+// cycles).
+
+static void put32(ostream& out, uint32_t v)
+{
+    uint8_t b[4] = { uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24) };
+    out.write(reinterpret_cast<const char*>(b), 4);
+}
+
+static bool get32(istream& in, uint32_t& v)
+{
+    uint8_t b[4];
+    if (!in.read(reinterpret_cast<char*>(b), 4))
+        return false;
+    v = b[0] | (b[1] << 8) | (b[2] << 16) | (uint32_t(b[3]) << 24);
+    return true;
+}
+
+void AssemblyCache::store(uint64_t key, uint64_t sourceSize, const AssembledProgram& program) const
+{
+    // Written under a temporary name and renamed, so a reader never sees a
+    // partial entry.
+    string path = path_for(key);
+    string tmp = path + ".tmp";
+    {
+        ofstream out(tmp, ios::binary);
+        if (!out)
+            return;
+        put32(out, CACHE_MAGIC);
+        put32(out, ASSEMBLER_VERSION);
+        put32(out, uint32_t(sourceSize));
+        put32(out, uint32_t(sourceSize >> 32));
+        put32(out, program.image.entry);
+
+        put32(out, uint32_t(program.image.chunks.size()));
+        for (const ImageChunk& chunk : program.image.chunks)
+        {
+            put32(out, chunk.address);
+            put32(out, uint32_t(chunk.bytes.size()));
+            out.write(reinterpret_cast<const char*>(chunk.bytes.data()), chunk.bytes.size());
+        }
+        const SymbolTable& symbols = program.symbols;
+        uint32_t defined = 0;
+        for (uint32_t id = 0; id < symbols.size(); id++)
+            defined += symbols.defined(id);
+        put32(out, defined);
+        for (uint32_t id = 0; id < symbols.size(); id++)
+        {
+            if (!symbols.defined(id))
+                continue;
+            string_view name = symbols.name(id);
+            put32(out, uint32_t(name.size()));
+            out.write(name.data(), name.size());
+            put32(out, symbols.address(id));
+            put32(out, uint32_t(symbols.line(id)));
+            put32(out, symbols.local(id) ? 1 : 0);
+        }
+        put32(out, uint32_t(program.instructions.size()));
+        for (const EncodedInstruction& inst : program.instructions)
+        {
+            put32(out, inst.address);
+            put32(out, inst.code);
+            put32(out, inst.size);
+            put32(out, inst.line);
+        }
+        const PeepholeReport& report = program.peephole;
+        put32(out, report.removed);
+        put32(out, report.rewritten);
+        put32(out, report.retargeted);
+        put32(out, uint32_t(report.cycles));
+        put32(out, uint32_t(report.cycles >> 32));
+        if (!out)
+            return;
+    }
+    rename(tmp.c_str(), path.c_str());
+}
+
+bool AssemblyCache::load(uint64_t key, uint64_t sourceSize, AssembledProgram& program) const
+{
+    ifstream in(path_for(key), ios::binary);
+    if (!in)
+        return false;
+    uint32_t magic, version, sizeLo, sizeHi, count;
+    if (!get32(in, magic) || !get32(in, version) || !get32(in, sizeLo) || !get32(in, sizeHi))
+        return false;
+    // The source size guards against the (unlikely) hash collision.
+    if (magic != CACHE_MAGIC || version != ASSEMBLER_VERSION || (uint64_t(sizeHi) << 32 | sizeLo) != sourceSize)
+        return false;
+    if (!get32(in, program.image.entry))
+        return false;
+
+    if (!get32(in, count))
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ImageChunk chunk;
+        uint32_t size;
+        if (!get32(in, chunk.address) || !get32(in, size) || size > MAX_CACHED_BYTES)
+            return false;
+        chunk.bytes.resize(size);
+        if (!in.read(reinterpret_cast<char*>(chunk.bytes.data()), size))
+            return false;
+        program.image.chunks.push_back(move(chunk));
+    }
+    if (!get32(in, count))
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t length, address, line, local;
+        if (!get32(in, length) || length > MAX_CACHED_BYTES)
+            return false;
+        string name(length, '\0');
+        if (!in.read(&name[0], length) || !get32(in, address) || !get32(in, line) || !get32(in, local))
+            return false;
+        uint32_t id = program.symbols.intern(name, local != 0);
+        if (program.symbols.defined(id))
+            return false;
+        program.symbols.define(id, address, int(line));
+    }
+    if (!get32(in, count))
+        return false;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        EncodedInstruction inst;
+        if (!get32(in, inst.address) || !get32(in, inst.code) || !get32(in, inst.size) || !get32(in, inst.line))
+            return false;
+        program.instructions.push_back(inst);
+    }
+    PeepholeReport& report = program.peephole;
+    uint32_t cyclesLo, cyclesHi;
+    if (!get32(in, report.removed) || !get32(in, report.rewritten) || !get32(in, report.retargeted) ||
+        !get32(in, cyclesLo) || !get32(in, cyclesHi))
+        return false;
+    report.cycles = uint64_t(cyclesHi) << 32 | cyclesLo;
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef ASMCACHE_H
+#define ASMCACHE_H
+#include "assembler.h"
+#include <deque>
+#include <memory>
+
+// Content-addressed cache of assembled programs. The key is a 64-bit FNV-1a
+// hash of the assembler version, the options and the source text, so an
+// identical request returns the stored image and symbol table without
+// running either pass.
+
+uint64_t assembly_key(const string& source, const AssemblerOptions& options);
+
+class AssemblyCache
+{
+public:
+    // Keeps up to capacity programs in memory. With a directory, entries are
+    // also written there as <key>.bin and survive the process.
+    explicit AssemblyCache(size_t capacity = 64, const string& directory = "");
+
+    shared_ptr<const AssembledProgram> assemble(const string& source, const AssemblerOptions& options = AssemblerOptions());
+
+    uint64_t hits() const { return hitCount; }
+    uint64_t misses() const { return missCount; }
+
+private:
+    size_t capacity;
+    string directory;
+    unordered_map<uint64_t, shared_ptr<const AssembledProgram>> entries;
+    deque<uint64_t> order;              // oldest first, for eviction
+    uint64_t hitCount;
+    uint64_t missCount;
+
+    string path_for(uint64_t key) const;
+    bool load(uint64_t key, uint64_t sourceSize, AssembledProgram& program) const;
+    void store(uint64_t key, uint64_t sourceSize, const AssembledProgram& program) const;
+    void remember(uint64_t key, shared_ptr<const AssembledProgram> program);
+};
+
+#endif
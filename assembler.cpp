@@ -0,0 +1,759 @@
+﻿#include "assembler.h"
+#include <iomanip>
+#include <algorithm>
+#include <cstdio>
+
+// === Utility Functions ===
+string trim(const string& s) {
+    size_t start = s.find_first_not_of(" \t\n\r");
+    size_t end = s.find_last_not_of(" \t\n\r");
+    return (start == string::npos) ? "" : s.substr(start, end - start + 1);
+}
+static string remove_commas(const string& s) {
+    string result;
+    for (char c : s) if (c != ',') result += c;
+    return result;
+}
+static vector<string> split(const string& s, char delimiter) {
+    vector<string> tokens;
+    string token;
+    istringstream ss(s);
+    while (getline(ss, token, delimiter)) {
+        tokens.push_back(trim(token));
+    }
+    return tokens;
+}
+static pair<string, string> parseMemoryOperand(const string& operand) {
+    size_t open = operand.find('(');
+    size_t close = operand.find(')');
+    if (open == string::npos || close == string::npos || close <= open)
+        throw runtime_error("Invalid memory operand: " + operand);
+    string imm = operand.substr(0, open);
+    string reg = operand.substr(open + 1, close - open - 1);
+    return { trim(imm), trim(reg) };
+}
+// Splits an instruction line into mnemonic and operands, rewriting a memory
+// operand "imm(reg)" into the two trailing tokens "reg imm".
+vector<string> tokenize(const string& line) {
+    vector<string> tokens;
+    istringstream ss(remove_commas(line));
+    string token;
+    while (ss >> token)
+        tokens.push_back(token);
+    if (tokens.size() == 3 && tokens[2][0] != '%' && tokens[2].find('(') != string::npos) {
+        pair<string, string> temp = parseMemoryOperand(tokens[2]);
+        tokens.pop_back();
+        tokens.push_back(temp.second);
+        tokens.push_back(temp.first);
+    }
+    return tokens;
+}
+
+// Expands assembler pseudo-instructions whose expansion does not depend on
+// where a label is; everything else is returned unchanged.
+vector<vector<string>> expandPseudo(const vector<string>& tokens) {
+    const string& inst = tokens[0];
+    size_t n = tokens.size();
+    if (inst == "li" && n == 3) {
+        int32_t imm = int32_t(stoll(tokens[2], nullptr, 0));
+        if (imm >= -2048 && imm < 2048)
+            return { { "addi",tokens[1],"x0",to_string(imm) } };
+        // The upper part is rounded so that the sign-extended addi supplies
+        // the rest; an all-zero lower part needs no addi at all.
+        uint32_t upper = (uint32_t(imm) + 0x800) >> 12;
+        int32_t lower = int32_t(uint32_t(imm) - (upper << 12));
+        if (lower == 0)
+            return { { "lui",tokens[1],to_string(upper & 0xFFFFF) } };
+        return { { "lui",tokens[1],to_string(upper & 0xFFFFF) }, { "addi",tokens[1],tokens[1],to_string(lower) } };
+    }
+    if (inst == "j" && n == 2) return { { "jal","x0",tokens[1] } };
+    if (inst == "jal" && n == 2) return { { "jal","ra",tokens[1] } };
+    if (inst == "jr" && n == 2) return { { "jalr","x0",tokens[1],"0" } };
+    if (inst == "jalr" && n == 2) return { { "jalr","ra",tokens[1],"0" } };
+    if (inst == "ret" && n == 1) return { { "jalr","x0","ra","0" } };
+
+    if (inst == "beqz" && n == 3) return { { "beq",tokens[1],"x0",tokens[2] } };
+    if (inst == "bnez" && n == 3) return { { "bne",tokens[1],"x0",tokens[2] } };
+    if (inst == "blez" && n == 3) return { { "bge","x0",tokens[1],tokens[2] } };
+    if (inst == "bgez" && n == 3) return { { "bge",tokens[1],"x0",tokens[2] } };
+    if (inst == "bltz" && n == 3) return { { "blt",tokens[1],"x0",tokens[2] } };
+    if (inst == "bgtz" && n == 3) return { { "blt","x0",tokens[1],tokens[2] } };
+    if (inst == "bgt" && n == 4) return { { "blt",tokens[2],tokens[1],tokens[3] } };
+    if (inst == "ble" && n == 4) return { { "bge",tokens[2],tokens[1],tokens[3] } };
+    if (inst == "bgtu" && n == 4) return { { "bltu",tokens[2],tokens[1],tokens[3] } };
+    if (inst == "bleu" && n == 4) return { { "bgeu",tokens[2],tokens[1],tokens[3] } };
+
+    if (inst == "seqz" && n == 3) return { { "sltiu",tokens[1],tokens[2],"1" } };
+    if (inst == "snez" && n == 3) return { { "sltu",tokens[1],"x0",tokens[2] } };
+    if (inst == "sltz" && n == 3) return { { "slt",tokens[1],tokens[2],"x0" } };
+    if (inst == "sgtz" && n == 3) return { { "slt",tokens[1],"x0",tokens[2] } };
+    return { tokens };
+}
+
+// la, call and tail have a short form that only reaches nearby labels (an
+// absolute address that fits addi, a jal) and a long auipc pair that reaches
+// anything. Both forms are made of uncompressed instructions, so a line is
+// 4 or 8 bytes whatever its registers.
+static bool isRelaxable(const vector<string>& tokens) {
+    const string& inst = tokens[0];
+    return (inst == "la" && tokens.size() == 3) || (inst == "tail" && tokens.size() == 2) ||
+        (inst == "call" && (tokens.size() == 2 || tokens.size() == 3));
+}
+
+static vector<vector<string>> expandRelaxable(const vector<string>& tokens, bool far) {
+    const string& symbol = tokens.back();
+    if (tokens[0] == "la") {
+        if (!far)
+            return { { "addi",tokens[1],"x0","%lo(" + symbol + ")" } };
+        return { { "auipc",tokens[1],"%pcrel_hi(" + symbol + ")" }, { "addi",tokens[1],tokens[1],"%pcrel_lo(" + symbol + ")" } };
+    }
+    string link = (tokens[0] == "tail") ? "x0" : (tokens.size() == 3) ? tokens[1] : "ra";
+    string scratch = (tokens[0] == "tail") ? "t1" : link;
+    if (!far)
+        return { { "jal",link,symbol } };
+    return { { "auipc",scratch,"%pcrel_hi(" + symbol + ")" }, { "jalr",link,scratch,"%pcrel_lo(" + symbol + ")" } };
+}
+
+static uint32_t relaxedSize(bool far) {
+    return far ? 8 : 4;
+}
+
+// Whether the short form placed at address reaches target.
+static bool nearFits(const vector<string>& tokens, uint32_t address, uint32_t target) {
+    if (tokens[0] == "la")
+        return int32_t(target) >= -2048 && int32_t(target) < 2048;
+    int32_t offset = int32_t(target - address);
+    return offset >= -(1 << 20) && offset <= (1 << 20) - 2;
+}
+
+const unordered_map<string, uint32_t> regMap = {
+    {"x0", 0}, {"x1", 1}, {"x2", 2}, {"x3", 3}, {"x4", 4}, {"x5", 5},
+    {"x6", 6}, {"x7", 7}, {"x8", 8}, {"x9", 9}, {"x10", 10}, {"x11", 11},
+    {"x12", 12}, {"x13", 13}, {"x14", 14}, {"x15", 15}, {"x16", 16}, {"x17", 17},
+    {"x18", 18}, {"x19", 19}, {"x20", 20}, {"x21", 21}, {"x22", 22}, {"x23", 23},
+    {"x24", 24}, {"x25", 25}, {"x26", 26}, {"x27", 27}, {"x28", 28}, {"x29", 29},
+    {"x30", 30}, {"x31", 31},
+    {"zero", 0}, {"ra", 1}, {"sp", 2}, {"gp", 3}, {"tp", 4}, {"t0", 5},
+    {"t1", 6}, {"t2", 7}, {"s0", 8}, {"fp", 8}, {"s1", 9}, {"a0", 10},
+    {"a1", 11}, {"a2", 12}, {"a3", 13}, {"a4", 14}, {"a5", 15}, {"a6", 16},
+    {"a7", 17}, {"s2", 18}, {"s3", 19}, {"s4", 20}, {"s5", 21}, {"s6", 22},
+    {"s7", 23}, {"s8", 24}, {"s9", 25}, {"s10", 26}, {"s11", 27}, {"t3", 28},
+    {"t4", 29}, {"t5", 30}, {"t6", 31}
+};
+
+// Parses a directive once; its effect on the location counter is applied on
+// every update because .org and .align depend on the address.
+static void parseDirective(SourceLine& line) {
+    vector<string> tokens = split(line.statement, ' ');
+    const string& directive = tokens[0];
+    if (directive == ".org") line.directive = DirectiveKind::Org;
+    else if (directive == ".word") line.directive = DirectiveKind::Word;
+    else if (directive == ".half") line.directive = DirectiveKind::Half;
+    else if (directive == ".byte") line.directive = DirectiveKind::Byte;
+    else if (directive == ".align") line.directive = DirectiveKind::Align;
+    else {
+        line.directive = DirectiveKind::Other;
+        return;
+    }
+    if (tokens.size() != 2)
+        throw runtime_error(directive + (tokens.size() < 2 ? ": missing operand" : ": too many operands"));
+    line.value = stoul(tokens[1], nullptr, 0);
+    if (line.directive == DirectiveKind::Align && line.value > 31)
+        throw runtime_error(".align: " + tokens[1] + " is out of range (0-31)");
+}
+
+// With compression, code can end on a halfword boundary. Data placed after
+// it is padded to its natural alignment: 4 for .word, 2 for .half.
+static uint32_t dataAlignment(DirectiveKind directive, const AssemblerOptions& options) {
+    if (!options.compress)
+        return 1;
+    return (directive == DirectiveKind::Word) ? 4 : (directive == DirectiveKind::Half) ? 2 : 1;
+}
+
+static uint32_t alignUp(uint32_t address, uint32_t alignment) {
+    return (address + alignment - 1) & ~(alignment - 1);
+}
+
+// Applies a directive to the location counter. In the second pass (image
+// non-null) data directives also emit their bytes.
+static void applyDirective(const SourceLine& line, uint32_t& address, ProgramImage* image) {
+    switch (line.directive) {
+    case DirectiveKind::Org:
+        address = line.value;
+        break;
+    case DirectiveKind::Word:
+    case DirectiveKind::Half:
+    case DirectiveKind::Byte: {
+        uint32_t size = (line.directive == DirectiveKind::Word) ? 4 : (line.directive == DirectiveKind::Half) ? 2 : 1;
+        if (image)
+            image->write_le(address, line.value, size);
+        address += size;
+        break;
+    }
+    case DirectiveKind::Align: {
+        uint32_t alignTo = 1u << line.value;
+        address = (address + alignTo - 1) & ~(alignTo - 1);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool isPcRelative(const string& inst) {
+    return inst == "beq" || inst == "bne" || inst == "blt" || inst == "bge" ||
+        inst == "bltu" || inst == "bgeu" || inst == "jal";
+}
+
+// The label an instruction needs to be encoded: a branch or jump target, or
+// the symbol of a relocation operand. Other identifiers (CSR names, rounding
+// modes) are not labels.
+static bool labelOperand(const vector<string>& tokens, string& name, uint32_t& operand) {
+    if (isPcRelative(tokens[0]) && tokens.size() > 1) {
+        name = tokens.back();
+        operand = uint32_t(tokens.size() - 1);
+        return true;
+    }
+    string kind;
+    for (operand = 1; operand < tokens.size(); operand++)
+        if (parseRelocation(tokens[operand], kind, name))
+            return true;
+    return false;
+}
+
+static bool labelOperand(const vector<string>& tokens, string& name) {
+    uint32_t operand;
+    return labelOperand(tokens, name, operand);
+}
+
+// "1", "42": a GNU-style local label that may be defined any number of times.
+static bool isLocalLabel(const string& name, uint32_t& number) {
+    if (name.empty() || name.size() > 9 || !all_of(name.begin(), name.end(), [](char c) { return isdigit(static_cast<unsigned char>(c)); }))
+        return false;
+    number = stoul(name);
+    return true;
+}
+
+// "1f" / "1b": the next / previous definition of local label 1.
+static bool isLocalRef(const string& op, uint32_t& number, char& direction) {
+    if (op.size() < 2 || (op.back() != 'f' && op.back() != 'b'))
+        return false;
+    direction = op.back();
+    return isLocalLabel(op.substr(0, op.size() - 1), number);
+}
+
+static runtime_error lineError(size_t line, const exception& e) {
+    return runtime_error("line " + to_string(line) + ": " + e.what());
+}
+
+// Everything about a line that does not depend on where it ends up: label,
+// directive or expanded instructions with their sizes, and the operands
+// that may name a label (interned, so later lookups are by id).
+SourceLine IncrementalAssembler::parseLine(const string& text) {
+    SourceLine line;
+    line.text = text;
+    string working = trim(text);
+    if (working.empty() || working[0] == '#')
+        return line;
+
+    if (working.find(':') != string::npos) {
+        line.label = trim(working.substr(0, working.find(':')));
+        if (line.label.empty())
+            throw runtime_error("empty label");
+        if (isLocalLabel(line.label, line.localNumber))
+            line.localLabel = true;
+        else
+            line.labelId = program.symbols.intern(line.label);
+        working = trim(working.substr(working.find(':') + 1));
+        if (working.empty())
+            return line;
+    }
+    line.statement = working;
+    if (working[0] == '.') {
+        parseDirective(line);
+        return line;
+    }
+
+    vector<string> tokens = tokenize(working);
+    if (isRelaxable(tokens)) {
+        line.pseudo = tokens;
+        setExpansion(line, expandRelaxable(tokens, false));
+    }
+    else
+        setExpansion(line, expandPseudo(tokens));
+    return line;
+}
+
+// Installs a line's instructions with their sizes and label operands. A
+// relaxed pseudo gets a new expansion whenever its form changes.
+void IncrementalAssembler::setExpansion(SourceLine& line, vector<vector<string>> expanded) {
+    line.expanded = move(expanded);
+    line.sizes.clear();
+    line.refs.clear();
+    line.codes.clear();
+    for (uint32_t i = 0; i < line.expanded.size(); i++) {
+        const vector<string>& tokens = line.expanded[i];
+        uint16_t half;
+        line.sizes.push_back((options.compress && compressInstruction(tokens, regMap, half)) ? 2 : 4);
+        // Only the label operand is interned: CSR names, vtype fields and
+        // FP registers are not symbols.
+        string name;
+        SourceLine::LabelRef ref = { i, 0, SymbolTable::NO_SYMBOL, 0, 0 };
+        if (!labelOperand(tokens, name, ref.operand))
+            continue;
+        if (!isLocalRef(name, ref.localNumber, ref.direction)) {
+            if (!isalpha(static_cast<unsigned char>(name[0])) && name[0] != '_' && name[0] != '.')
+                continue;       // a numeric branch offset
+            ref.id = program.symbols.intern(name);
+        }
+        line.refs.push_back(ref);
+    }
+}
+
+// Id of the ordinal-th definition of local label number. The synthetic name
+// is built only the first time the pair is seen.
+uint32_t IncrementalAssembler::localId(uint32_t number, uint32_t ordinal) {
+    uint64_t key = (uint64_t(number) << 32) | ordinal;
+    auto it = localIds.find(key);
+    if (it != localIds.end())
+        return it->second;
+    uint32_t id = program.symbols.intern(to_string(number) + "@" + to_string(ordinal), true);
+    localIds.emplace(key, id);
+    return id;
+}
+
+// What a label operand resolves to from this instruction: an offset for
+// PC-relative instructions, otherwise the address itself. An instruction
+// whose resolved operands are unchanged encodes to the same bits.
+static uint64_t resolveRef(const SourceLine& line, const SourceLine::LabelRef& ref, uint32_t address, const SymbolTable& symbols) {
+    if (ref.id == SymbolTable::NO_SYMBOL || !symbols.defined(ref.id))
+        return ~0ull;
+    uint32_t target = symbols.address(ref.id);
+    const vector<string>& tokens = line.expanded[ref.instruction];
+    bool relative = isPcRelative(tokens[0]) || tokens[ref.operand].compare(0, 6, "%pcrel") == 0;
+    return relative ? uint32_t(target - address) : target;
+}
+
+// Assigns addresses and defines labels. Local references are bound here
+// because which definition "1f" means depends on the line's position.
+void IncrementalAssembler::layout() {
+    program.symbols.reset_definitions();
+    unordered_map<uint32_t, uint32_t> localCount;
+    uint32_t address = program.image.entry;
+    for (size_t i = 0; i < lines.size(); i++) {
+        SourceLine& line = lines[i];
+        // A label names the data it stands above, so the padding before a
+        // .word comes ahead of the labels on the lines leading up to it.
+        if (!line.label.empty() || line.directive != DirectiveKind::None) {
+            size_t data = i;
+            while (data + 1 < lines.size() && lines[data].directive == DirectiveKind::None
+                && lines[data].expanded.empty() && lines[data].pseudo.empty())
+                data++;
+            address = alignUp(address, dataAlignment(lines[data].directive, options));
+        }
+        try {
+            if (line.localLabel)
+                program.symbols.define(localId(line.localNumber, localCount[line.localNumber]++), address, int(i + 1));
+            else if (!line.label.empty())
+                program.symbols.define(line.labelId, address, int(i + 1));
+        }
+        catch (const exception& e) {
+            throw lineError(i + 1, e);
+        }
+        for (SourceLine::LabelRef& ref : line.refs) {
+            if (ref.direction == 0)
+                continue;
+            auto count = localCount.find(ref.localNumber);
+            uint32_t defined = (count != localCount.end()) ? count->second : 0;
+            if (ref.direction == 'f')
+                ref.id = localId(ref.localNumber, defined);
+            else
+                ref.id = defined ? localId(ref.localNumber, defined - 1) : SymbolTable::NO_SYMBOL;
+        }
+        line.address = address;
+        if (line.directive != DirectiveKind::None)
+            applyDirective(line, address, nullptr);
+        if (!line.pseudo.empty())
+            address += relaxedSize(line.wantFar);
+        else
+            for (uint32_t size : line.sizes)
+                address += size;
+    }
+}
+
+IncrementalAssembler::IncrementalAssembler(const AssemblerOptions& options) : options(options), encodedLast(0) {}
+
+const AssembledProgram& IncrementalAssembler::update(const string& source) {
+    vector<string> text;
+    {
+        istringstream input(source);
+        string line;
+        while (getline(input, line))
+            text.push_back(line);
+    }
+
+    if (options.optimize)
+        lines.clear();
+    try {
+        // Lines shared with the previous source at the start and the end keep
+        // everything parsed and encoded for them.
+        size_t common = min(lines.size(), text.size());
+        size_t prefix = 0;
+        while (prefix < common && lines[prefix].text == text[prefix])
+            prefix++;
+        size_t suffix = 0;
+        while (suffix < common - prefix && lines[lines.size() - 1 - suffix].text == text[text.size() - 1 - suffix])
+            suffix++;
+
+        vector<SourceLine> next;
+        next.reserve(text.size());
+        for (size_t i = 0; i < prefix; i++)
+            next.push_back(move(lines[i]));
+        for (size_t i = prefix; i < text.size() - suffix; i++) {
+            try {
+                next.push_back(parseLine(text[i]));
+            }
+            catch (const exception& e) {
+                throw lineError(i + 1, e);
+            }
+        }
+        for (size_t i = lines.size() - suffix; i < lines.size(); i++)
+            next.push_back(move(lines[i]));
+        lines = move(next);
+        program.peephole = PeepholeReport();
+        if (options.optimize)
+            peephole();
+
+        // ─────[ Pass 1: Label Parsing, Directives and Relaxation ]─────
+        // Every relaxable pseudo starts short and is widened when its label
+        // is out of reach; widening only moves later code further away, so
+        // the layout grows monotonically and reaches a fixed point.
+        program.image = ProgramImage();
+        program.instructions.clear();
+        vector<size_t> relaxable;
+        for (size_t i = 0; i < lines.size(); i++) {
+            if (!lines[i].pseudo.empty()) {
+                lines[i].wantFar = false;
+                relaxable.push_back(i);
+            }
+        }
+        for (bool changed = true; changed; ) {
+            layout();
+            changed = false;
+            for (size_t i : relaxable) {
+                SourceLine& line = lines[i];
+                uint32_t id = line.refs.empty() ? SymbolTable::NO_SYMBOL : line.refs.front().id;
+                if (line.wantFar || id == SymbolTable::NO_SYMBOL || !program.symbols.defined(id))
+                    continue;
+                if (!nearFits(line.pseudo, line.address, program.symbols.address(id))) {
+                    line.wantFar = true;
+                    changed = true;
+                }
+            }
+        }
+        bool reexpanded = false;
+        for (size_t i : relaxable) {
+            SourceLine& line = lines[i];
+            if (line.far != line.wantFar) {
+                line.far = line.wantFar;
+                setExpansion(line, expandRelaxable(line.pseudo, line.far));
+                reexpanded = true;
+            }
+        }
+        if (reexpanded)
+            layout();       // same addresses; binds the new expansions' "1f"/"1b"
+        if (!retargets.empty())
+            checkRetargets();
+
+        // ─────[ Pass 2: Instruction Encoding ]─────
+        // A line is re-encoded when it is new or one of its label operands
+        // resolves differently; otherwise its bits are only relocated.
+        encodedLast = 0;
+        for (size_t n = 0; n < lines.size(); n++) {
+            SourceLine& line = lines[n];
+            if (line.directive != DirectiveKind::None) {
+                uint32_t address = line.address;
+                applyDirective(line, address, &program.image);
+                continue;
+            }
+            if (line.expanded.empty())
+                continue;
+
+            vector<uint32_t> addresses;
+            uint32_t address = line.address;
+            for (uint32_t size : line.sizes) {
+                addresses.push_back(address);
+                address += size;
+            }
+            bool stale = line.codes.empty();
+            for (size_t r = 0; r < line.refs.size() && !stale; r++)
+                stale = resolveRef(line, line.refs[r], addresses[line.refs[r].instruction], program.symbols) != line.refValues[r];
+
+            if (stale) {
+                try {
+                    line.codes.clear();
+                    for (size_t i = 0; i < line.expanded.size(); i++) {
+                        uint16_t half;
+                        if (line.sizes[i] == 2 && compressInstruction(line.expanded[i], regMap, half)) {
+                            line.codes.push_back(half);
+                            continue;
+                        }
+                        // Label operands go to the encoder by id, which also
+                        // covers "1f"/"1b" without renaming the token.
+                        uint32_t label = SymbolTable::NO_SYMBOL;
+                        for (const SourceLine::LabelRef& ref : line.refs)
+                            if (ref.instruction == i && ref.id != SymbolTable::NO_SYMBOL && program.symbols.defined(ref.id))
+                                label = ref.id;
+                        line.codes.push_back(encodeInstruction(line.expanded[i], addresses[i], program.symbols, regMap, label));
+                    }
+                }
+                catch (const exception& e) {
+                    throw lineError(n + 1, e);
+                }
+                line.refValues.clear();
+                for (const SourceLine::LabelRef& ref : line.refs)
+                    line.refValues.push_back(resolveRef(line, ref, addresses[ref.instruction], program.symbols));
+                encodedLast++;
+            }
+            for (size_t i = 0; i < line.codes.size(); i++) {
+                program.image.write_le(addresses[i], line.codes[i], line.sizes[i]);
+                program.instructions.push_back({ addresses[i], line.codes[i], line.sizes[i], uint32_t(n + 1) });
+            }
+        }
+    }
+    catch (...) {
+        // Records may have been moved from; start from scratch next time.
+        lines.clear();
+        localIds.clear();
+        program = AssembledProgram();
+        throw;
+    }
+    return program;
+}
+
+AssembledProgram IncrementalAssembler::release() {
+    lines.clear();
+    localIds.clear();
+    AssembledProgram result = move(program);
+    program = AssembledProgram();
+    return result;
+}
+
+AssembledProgram assemble(const string& source, const AssemblerOptions& options) {
+    IncrementalAssembler assembler(options);
+    assembler.update(source);
+    return assembler.release();
+}
+
+void write_hex(ostream& out, const AssembledProgram& program) {
+    for (const EncodedInstruction& inst : program.instructions)
+        out << hex << setw(inst.size * 2) << setfill('0') << inst.code << endl;
+}
+
+// ───────────── Streaming ─────────────
+
+StreamingAssembler::StreamingAssembler(ostream& out, const AssemblerOptions& options, size_t blockLines)
+    : out(out), options(options), blockLines(max<size_t>(blockLines, 1)), address(ProgramImage().entry) {
+    base = out.tellp();
+    seekable = base != streampos(-1);
+}
+
+static string hexLine(uint32_t code, uint32_t size) {
+    char text[16];
+    snprintf(text, sizeof(text), "%0*x\n", int(size * 2), code);
+    return text;
+}
+
+void StreamingAssembler::feed(const string& text) {
+    lineNumber++;
+    try {
+        string working = trim(text);
+        if (working.empty() || working[0] == '#')
+            return;
+
+        if (working.find(':') != string::npos) {
+            string label = trim(working.substr(0, working.find(':')));
+            if (label.empty())
+                throw runtime_error("empty label");
+            // A numeric label is rebound on each definition: "1b" sees the
+            // latest one, and branches waiting on "1f" are resolved by it.
+            uint32_t number;
+            uint32_t id;
+            if (isLocalLabel(label, number)) {
+                id = symbols.intern(label, true);
+                symbols.rebind(id, address, int(lineNumber));
+            }
+            else {
+                id = symbols.intern(label);
+                symbols.define(id, address, int(lineNumber));
+            }
+            heldLabels.push_back(id);
+            working = trim(working.substr(working.find(':') + 1));
+            if (working.empty())
+                return;         // resolved by the next statement, which may pad
+        }
+        if (working[0] == '.') {
+            // Data directives only move the location counter; like write_hex,
+            // the output lists instructions.
+            SourceLine line;
+            line.statement = working;
+            parseDirective(line);
+            releaseLabels(alignUp(address, dataAlignment(line.directive, options)));
+            applyDirective(line, address, nullptr);
+            return;
+        }
+        releaseLabels(address);
+
+        // A la/call/tail to a label already seen takes the short form when
+        // it reaches; a forward one cannot be measured yet and is long.
+        vector<string> statement = tokenize(working);
+        vector<vector<string>> expanded;
+        if (isRelaxable(statement)) {
+            bool forward;
+            uint32_t id = labelId(statement.back(), forward);
+            expanded = expandRelaxable(statement, forward || !nearFits(statement, address, symbols.address(id)));
+        }
+        else
+            expanded = expandPseudo(statement);
+
+        for (const vector<string>& tokens : expanded) {
+            uint16_t half;
+            if (options.compress && compressInstruction(tokens, regMap, half)) {
+                emit(half, 2, nullptr, SymbolTable::NO_SYMBOL);
+                address += 2;
+                continue;
+            }
+            uint32_t label = SymbolTable::NO_SYMBOL;
+            string name;
+            if (labelOperand(tokens, name)) {
+                bool forward;
+                label = labelId(name, forward);
+                if (forward) {
+                    emit(0, 4, &tokens, label);
+                    address += 4;
+                    continue;
+                }
+            }
+            emit(encodeInstruction(tokens, address, symbols, regMap, label), 4, nullptr, SymbolTable::NO_SYMBOL);
+            address += 4;
+        }
+    }
+    catch (const exception& e) {
+        throw lineError(lineNumber, e);
+    }
+}
+
+// Id of a label operand; forward when it is not defined yet ("1f" always
+// is: it means the next definition of 1).
+uint32_t StreamingAssembler::labelId(const string& name, bool& forward) {
+    uint32_t number;
+    char direction;
+    if (isLocalRef(name, number, direction)) {
+        uint32_t id = symbols.intern(to_string(number), true);
+        if (direction == 'b' && !symbols.defined(id))
+            throw runtime_error("undefined label '" + name + "'");
+        forward = direction == 'f';
+        return id;
+    }
+    uint32_t id = symbols.intern(name);
+    forward = !symbols.defined(id);
+    return id;
+}
+
+// Appends one hex line. An instruction needing a label not yet seen (wait
+// non-null) gets a placeholder and is remembered under the label's id.
+void StreamingAssembler::emit(uint32_t code, uint32_t size, const vector<string>* wait, uint32_t label) {
+    if (blocks.empty() || blocks.back().count >= blockLines)
+        blocks.push_back({ string(), offset });
+    Block& block = blocks.back();
+    string line = hexLine(code, size);
+    if (wait) {
+        waiting[label].push_back({ *wait, address, offset, firstBlock + blocks.size() - 1, lineNumber });
+        block.unresolved++;
+        pendingCount++;
+        peakPending = max(peakPending, pendingCount);
+    }
+    block.text += line;
+    block.count++;
+    offset += line.size();
+    instructionCount++;
+    if (block.count >= blockLines)
+        flush(false);
+}
+
+// Moves the labels defined since the last statement to address, where
+// that statement starts after any padding, and resolves what waits on them.
+void StreamingAssembler::releaseLabels(uint32_t start) {
+    if (start != address)
+        for (uint32_t id : heldLabels)
+            symbols.rebind(id, start, symbols.line(id));
+    address = start;
+    vector<uint32_t> labels = move(heldLabels);
+    heldLabels.clear();
+    for (uint32_t id : labels)
+        resolve(id);
+}
+
+void StreamingAssembler::resolve(uint32_t label) {
+    auto it = waiting.find(label);
+    if (it == waiting.end())
+        return;
+    vector<Pending> list = move(it->second);
+    waiting.erase(it);
+    pendingCount -= list.size();
+    for (const Pending& pending : list) {
+        uint32_t code;
+        try {
+            code = encodeInstruction(pending.tokens, pending.address, symbols, regMap, label);
+        }
+        catch (const exception& e) {
+            throw lineError(pending.line, e);
+        }
+        patch(pending, code);
+    }
+    flush(false);
+}
+
+void StreamingAssembler::patch(const Pending& pending, uint32_t code) {
+    string line = hexLine(code, 4);
+    if (pending.offset >= written) {
+        Block& block = blocks[pending.block - firstBlock];
+        block.text.replace(pending.offset - block.start, line.size(), line);
+        block.unresolved--;
+        return;
+    }
+    out.seekp(base + streamoff(pending.offset));
+    out.write(line.data(), line.size());
+    out.seekp(base + streamoff(written));
+}
+
+// Writes finished blocks in order; all also writes the one being filled.
+void StreamingAssembler::flush(bool all) {
+    while (!blocks.empty()) {
+        Block& block = blocks.front();
+        if (!all && block.count < blockLines)
+            break;
+        if (block.unresolved != 0 && !seekable)
+            break;
+        out.write(block.text.data(), block.text.size());
+        written += block.text.size();
+        blocks.pop_front();
+        firstBlock++;
+    }
+}
+
+void StreamingAssembler::finish() {
+    releaseLabels(address);
+    if (pendingCount != 0) {
+        const Pending* first = nullptr;
+        for (const auto& entry : waiting)
+            for (const Pending& pending : entry.second)
+                if (!first || pending.line < first->line)
+                    first = &pending;
+        string name;
+        labelOperand(first->tokens, name);
+        throw lineError(first->line, runtime_error("undefined label '" + name + "'"));
+    }
+    flush(true);
+    out.flush();
+}
@@ -0,0 +1,202 @@
+#pragma once
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+#include "encoder.h"
+#include "image.h"
+#include <deque>
+
+// In-process two-pass assembler. Source text goes in, a ProgramImage and
+// the symbol table come out; nothing touches the disk or the console.
+
+// Bumped whenever the same source could assemble to different bits or a
+// different peephole report, so cached images from an older assembler are
+// never reused.
+const uint32_t ASSEMBLER_VERSION = 7;
+
+struct AssemblerOptions
+{
+    bool compress = true;       // emit 16-bit RV32C forms where operands fit
+    bool optimize = false;      // run the peephole pass (not in streaming mode)
+};
+
+struct EncodedInstruction
+{
+    uint32_t address;
+    uint32_t code;
+    uint32_t size;              // 2 for RV32C, otherwise 4
+    uint32_t line;              // source line it came from, from 1
+};
+
+// What the peephole pass changed. Cycles are the multi-cycle model's cost
+// of each removed instruction, counted once per site, not per execution.
+struct PeepholeReport
+{
+    uint32_t removed = 0;       // no-op moves, repeated loads, branches to the next instruction
+    uint32_t rewritten = 0;     // a reload of the same address turned into mv
+    uint32_t retargeted = 0;    // jumps and branches sent past a chain of jumps
+    uint64_t cycles = 0;
+};
+
+struct AssembledProgram
+{
+    ProgramImage image;
+    SymbolTable symbols;
+    vector<EncodedInstruction> instructions;
+    PeepholeReport peephole;
+};
+
+enum class DirectiveKind { None, Org, Word, Half, Byte, Align, Other };
+
+// One line of source and everything derived from it. The parse depends only
+// on the text, so it is kept for as long as the line is unchanged.
+struct SourceLine
+{
+    struct LabelRef
+    {
+        uint32_t instruction;           // index into expanded
+        uint32_t operand;               // index into that instruction's tokens
+        uint32_t id;                    // symbol; for "1f"/"1b" rebound every update
+        uint32_t localNumber;
+        char direction;                 // 'f' or 'b' for local references, else 0
+    };
+
+    string text;
+    string label;                       // defined on this line, or empty
+    uint32_t labelId = SymbolTable::NO_SYMBOL;
+    bool localLabel = false;            // a numeric label such as "1:"
+    uint32_t localNumber = 0;
+    string statement;                   // text after the label
+    DirectiveKind directive = DirectiveKind::None;
+    uint32_t value = 0;                 // directive operand
+    vector<vector<string>> expanded;    // instructions after pseudo expansion
+    vector<uint32_t> sizes;
+    vector<LabelRef> refs;              // operands that may name a label
+    vector<string> pseudo;              // la/call/tail before expansion, else empty
+    bool far = false;                   // pseudo is expanded in its long form
+    bool wantFar = false;               // the form relaxation settled on
+
+    uint32_t address = 0;
+    vector<uint32_t> codes;             // encoded bits, empty until encoded
+    vector<uint64_t> refValues;         // what refs resolved to when encoded
+};
+
+// Reassembles a changing source. Lines that match the previous source at
+// its start and end are neither re-parsed nor re-encoded; of those, only
+// instructions whose label operands now resolve differently (a branch whose
+// target moved relative to it) are encoded again. With options.optimize the
+// peephole pass looks across lines, so every update starts from scratch.
+class IncrementalAssembler
+{
+public:
+    explicit IncrementalAssembler(const AssemblerOptions& options = AssemblerOptions());
+
+    // Throws runtime_error, prefixed with the line number, on malformed input
+    // and on undefined or duplicate labels; the next update then starts from
+    // scratch.
+    const AssembledProgram& update(const string& source);
+    const AssembledProgram& result() const { return program; }
+    // Number of lines encoded by the last update.
+    size_t encoded_last() const { return encodedLast; }
+    // Moves the program out and forgets all state.
+    AssembledProgram release();
+
+private:
+    AssemblerOptions options;
+    vector<SourceLine> lines;
+    AssembledProgram program;           // its symbol table persists across updates
+    unordered_map<uint64_t, uint32_t> localIds;
+    size_t encodedLast;
+    struct Retarget
+    {
+        size_t line;
+        string label;                   // before the peephole pass
+        uint32_t hops;
+    };
+    vector<Retarget> retargets;
+
+    SourceLine parseLine(const string& text);
+    void setExpansion(SourceLine& line, vector<vector<string>> expanded);
+    void layout();
+    void peephole();
+    void checkRetargets();
+    uint32_t localId(uint32_t number, uint32_t ordinal);
+};
+
+// Assembles a source of unbounded length line by line, writing the same hex
+// lines as write_hex in blocks of blockLines instructions. Only label
+// addresses and the instructions still waiting for a forward label are
+// kept; when the label appears they are encoded and patched into the output.
+// If the output can seek (a file) finished blocks are written at once and
+// patched in place; on a pipe a block is held until its labels resolve.
+// Without lookahead, a la/call/tail to a forward label takes the long form.
+class StreamingAssembler
+{
+public:
+    explicit StreamingAssembler(ostream& out, const AssemblerOptions& options = AssemblerOptions(), size_t blockLines = 4096);
+
+    // Both throw runtime_error prefixed with the line number; finish() does
+    // so for a label that was never defined.
+    void feed(const string& text);
+    void finish();
+
+    size_t instructions() const { return instructionCount; }
+    size_t pending() const { return pendingCount; }
+    size_t peak_pending() const { return peakPending; }
+
+private:
+    struct Block
+    {
+        string text;
+        uint64_t start;                 // output offset of text[0]
+        uint32_t count = 0;             // instructions in the block
+        uint32_t unresolved = 0;
+    };
+    struct Pending
+    {
+        vector<string> tokens;
+        uint32_t address;
+        uint64_t offset;                // output offset of its hex line
+        uint64_t block;                 // sequence number of its block
+        size_t line;
+    };
+
+    ostream& out;
+    AssemblerOptions options;
+    size_t blockLines;
+    bool seekable;
+    streampos base;
+    SymbolTable symbols;
+    unordered_map<uint32_t, vector<Pending>> waiting;  // by label id
+    deque<Block> blocks;
+    uint64_t firstBlock = 0;            // sequence number of blocks.front()
+    uint64_t written = 0;               // bytes already handed to out
+    uint64_t offset = 0;                // bytes produced so far
+    uint32_t address;
+    size_t lineNumber = 0;
+    size_t instructionCount = 0;
+    size_t pendingCount = 0;
+    size_t peakPending = 0;
+    vector<uint32_t> heldLabels;        // defined since the last statement
+
+    uint32_t labelId(const string& name, bool& forward);
+    void emit(uint32_t code, uint32_t size, const vector<string>* wait, uint32_t label);
+    void releaseLabels(uint32_t start);
+    void resolve(uint32_t label);
+    void patch(const Pending& pending, uint32_t code);
+    void flush(bool all);
+};
+
+// Throws runtime_error as IncrementalAssembler::update does.
+AssembledProgram assemble(const string& source, const AssemblerOptions& options = AssemblerOptions());
+
+// Writes one hex line per instruction, the format of output.txt.
+void write_hex(ostream& out, const AssembledProgram& program);
+
+string trim(const string& s);
+vector<string> tokenize(const string& line);
+vector<vector<string>> expandPseudo(const vector<string>& tokens);
+bool isPcRelative(const string& inst);
+
+extern const unordered_map<string, uint32_t> regMap;
+
+#endif
@@ -0,0 +1,83 @@
+#pragma once
+#ifndef BITOPS_H
+#define BITOPS_H
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Host intrinsics behind the Zbb/Zbs instructions. Each helper is defined for
+// every input, including zero, as the RISC-V instructions are.
+
+inline uint32_t host_clz(uint32_t x)
+{
+    if (x == 0)
+        return 32;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse(&index, x);
+    return 31 - index;
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+inline uint32_t host_ctz(uint32_t x)
+{
+    if (x == 0)
+        return 32;
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, x);
+    return index;
+#else
+    return __builtin_ctz(x);
+#endif
+}
+
+inline uint32_t host_popcount(uint32_t x)
+{
+#ifdef _MSC_VER
+    return __popcnt(x);
+#else
+    return __builtin_popcount(x);
+#endif
+}
+
+inline uint32_t host_rotl(uint32_t x, uint32_t n)
+{
+#ifdef _MSC_VER
+    return _rotl(x, n & 31);
+#else
+    n &= 31;
+    return (x << n) | (x >> ((32 - n) & 31));
+#endif
+}
+
+inline uint32_t host_rotr(uint32_t x, uint32_t n)
+{
+#ifdef _MSC_VER
+    return _rotr(x, n & 31);
+#else
+    n &= 31;
+    return (x >> n) | (x << ((32 - n) & 31));
+#endif
+}
+
+inline uint32_t host_bswap(uint32_t x)
+{
+#ifdef _MSC_VER
+    return _byteswap_ulong(x);
+#else
+    return __builtin_bswap32(x);
+#endif
+}
+
+// orc.b: each byte becomes 0xFF if any of its bits is set, otherwise 0x00.
+inline uint32_t host_orc_b(uint32_t x)
+{
+    uint32_t t = ((x & 0x7F7F7F7Fu) + 0x7F7F7F7Fu) | x;
+    return ((t >> 7) & 0x01010101u) * 0xFF;
+}
+
+#endif
@@ -0,0 +1,118 @@
+﻿#include "simulator.h"
+
+// CSR addresses
+const uint32_t CSR_FFLAGS = 0x001;
+const uint32_t CSR_FRM = 0x002;
+const uint32_t CSR_FCSR = 0x003;
+const uint32_t CSR_MSTATUS = 0x300;
+const uint32_t CSR_MISA = 0x301;
+const uint32_t CSR_MIE = 0x304;
+const uint32_t CSR_MTVEC = 0x305;
+const uint32_t CSR_MSCRATCH = 0x340;
+const uint32_t CSR_MEPC = 0x341;
+const uint32_t CSR_MCAUSE = 0x342;
+const uint32_t CSR_MTVAL = 0x343;
+const uint32_t CSR_MIP = 0x344;
+const uint32_t CSR_TIME = 0xC01;
+const uint32_t CSR_TIMEH = 0xC81;
+const uint32_t CSR_MHARTID = 0xF14;
+
+const uint32_t MSTATUS_MPP = 3u << 11;      // only M-mode exists
+// RV32 with I, M, F, C and V.
+const uint32_t MISA_VALUE = (1u << 30) | (1u << 8) | (1u << 12) | (1u << 5) | (1u << 2) | (1u << 21);
+
+bool Simulator::csr_read(uint32_t csr, uint32_t& value)
+{
+    switch (csr)
+    {
+    case CSR_FFLAGS: value = fflags; return true;
+    case CSR_FRM:    value = frm; return true;
+    case CSR_FCSR:   value = (frm << 5) | fflags; return true;
+    case CSR_MSTATUS:  value = mstatus | MSTATUS_MPP; return true;
+    case CSR_MISA:     value = MISA_VALUE; return true;
+    case CSR_MIE:      value = mie; return true;
+    case CSR_MTVEC:    value = mtvec; return true;
+    case CSR_MSCRATCH: value = mscratch; return true;
+    case CSR_MEPC:     value = mepc; return true;
+    case CSR_MCAUSE:   value = mcause; return true;
+    case CSR_MTVAL:    value = mtval; return true;
+    case CSR_MIP:      value = pending_interrupts(); return true;
+    case CSR_TIME:     value = uint32_t(mtime); return true;
+    case CSR_TIMEH:    value = uint32_t(mtime >> 32); return true;
+    case CSR_MHARTID:  value = 0; return true;
+    default:         return false;
+    }
+}
+
+bool Simulator::csr_write(uint32_t csr, uint32_t value)
+{
+    switch (csr)
+    {
+    case CSR_FFLAGS: fflags = value & 0x1F; return true;
+    case CSR_FRM:    frm = value & 0x7; return true;
+    case CSR_FCSR:   fflags = value & 0x1F; frm = (value >> 5) & 0x7; return true;
+    // Enabling an interrupt that is already pending takes it before the next
+    // instruction.
+    case CSR_MSTATUS:  mstatus = value & (MSTATUS_MIE | MSTATUS_MPIE); poll_interrupts(); return true;
+    case CSR_MIE:      mie = value & (MIP_MSIP | MIP_MTIP | MIP_MEIP); poll_interrupts(); return true;
+    case CSR_MTVEC:    mtvec = value & ~0x2u; return true;     // direct or vectored
+    case CSR_MSCRATCH: mscratch = value; return true;
+    case CSR_MEPC:     mepc = value & ~1u; return true;
+    case CSR_MCAUSE:   mcause = value; return true;
+    case CSR_MTVAL:    mtval = value; return true;
+    // misa, mip, time and mhartid ignore writes: mip's bits follow the CLINT
+    // and the external line.
+    case CSR_MISA:
+    case CSR_MIP:
+    case CSR_TIME:
+    case CSR_TIMEH:
+    case CSR_MHARTID:  return true;
+    default:         return false;
+    }
+}
+
+// csrrw / csrrs / csrrc and their immediate forms. Returns true if the CSR
+// does not exist (the simulator halts).
+template <class Observe>
+bool Simulator::CSR_type(uint32_t instr)
+{
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t csr = instr >> 20;
+    uint32_t old;
+    if (funct3 == 0x4 || !csr_read(csr, old))
+        return true;
+
+    // Cycle 4: A ← x[rs1] (or the 5-bit immediate), B ← CSR
+    clk++;
+    A.write((funct3 & 0x4) ? rs1 : regfile[rs1].read());
+    B.write(old);
+    print_state();
+
+    // Cycle 5: ALUOut ← new CSR value
+    clk++;
+    uint32_t value;
+    switch (funct3 & 0x3)
+    {
+    case 0x1: value = A.read(); break;                 // csrrw
+    case 0x2: value = B.read() | A.read(); break;      // csrrs
+    default:  value = B.read() & ~A.read(); break;     // csrrc
+    }
+    ALUOut.write(value);
+    print_state();
+
+    // Cycle 6: x[rd] ← old CSR; the CSR is only written by csrrw or when
+    // rs1/uimm is non-zero
+    clk++;
+    if ((funct3 & 0x3) == 0x1 || rs1 != 0)
+        csr_write(csr, ALUOut.read());
+    if (rd != 0)
+        write_back<Observe>(rd, B.read());
+    print_state();
+    reset_clk();
+    return false;
+}
+
+template bool Simulator::CSR_type<Observed>(uint32_t);
+template bool Simulator::CSR_type<Unobserved>(uint32_t);
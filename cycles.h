@@ -0,0 +1,57 @@
+#pragma once
+#ifndef CYCLES_H
+#define CYCLES_H
+#include <cstdint>
+
+// Clock cycles the multi-cycle model spends on an instruction: three to
+// fetch and decode it (MAR ← PC, MDR ← Mem[MAR], IR ← MDR) and then the
+// cycles of its handler. Must match the clk++ of the handlers, which
+// Simulator::check_cycles() verifies. instr is a 32-bit encoding; an RVC
+// parcel costs what its expansion does. Encodings the simulator does not
+// execute are charged the fetch; one that a handler rejects part-way is
+// corrected by the simulator to the cycles actually spent.
+const uint32_t FETCH_CYCLES = 3;
+// Entering a trap handler: mepc, mcause and mstatus are saved and PC loaded
+// from mtvec in one cycle of its own.
+const uint32_t TRAP_ENTRY_CYCLES = 1;
+
+inline uint32_t instruction_cycles(uint32_t instr)
+{
+    switch (instr & 0x7F)
+    {
+    case 0x03:                  // loads: address in two cycles, memory in two, write-back
+    case 0x23:                  // stores: address in two, MAR, MDR, memory
+        return FETCH_CYCLES + 5;
+    case 0x07:                  // flw, vle32/vlse32
+        return FETCH_CYCLES + 5;
+    case 0x27:                  // fsw; vector stores have no write-back cycle
+        return FETCH_CYCLES + ((((instr >> 12) & 0x7) == 0x2) ? 5 : 4);
+    case 0x63:                  // branches: compare, then PC
+    case 0x6F:                  // jal: link, then PC
+        return FETCH_CYCLES + 2;
+    case 0x33:                  // R-type: operands, ALU, write-back
+    case 0x13:
+    case 0x67:                  // jalr
+    case 0x37:
+    case 0x17:
+    case 0x53:                  // OP-FP
+    case 0x43:
+    case 0x47:
+    case 0x4B:
+    case 0x4F:                  // fused multiply-add
+    case 0x57:                  // OP-V and vsetvli
+        return FETCH_CYCLES + 3;
+    case 0x73:
+        if (instr == 0x00000073)            // ecall, serviced by the host
+            return FETCH_CYCLES + 1;
+        if (instr == 0x30200073)            // mret
+            return FETCH_CYCLES + 1;
+        if (((instr >> 12) & 0x7) != 0)     // CSR access
+            return FETCH_CYCLES + 3;
+        return FETCH_CYCLES;                // ebreak, wfi
+    default:
+        return FETCH_CYCLES;
+    }
+}
+
+#endif
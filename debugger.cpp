@@ -0,0 +1,177 @@
+﻿#include "simulator.h"
+
+void Simulator::set_symbols(const unordered_map<string, uint32_t>& table)
+{
+    symbols = table;
+}
+
+void Simulator::add_breakpoint(uint32_t addr)
+{
+    uint32_t bit = addr >> 1;
+    if (bit >= MEM_SIZE * 2)
+        throw runtime_error("Breakpoint address out of memory range");
+    break_map[bit >> 6] |= (uint64_t(1) << (bit & 63));
+}
+
+void Simulator::remove_breakpoint(uint32_t addr)
+{
+    uint32_t bit = addr >> 1;
+    if (bit < MEM_SIZE * 2)
+        break_map[bit >> 6] &= ~(uint64_t(1) << (bit & 63));
+}
+
+void Simulator::add_watchpoint(const Watchpoint& wp)
+{
+    if (wp.end < wp.start || wp.start / 4 >= MEM_SIZE)
+        throw runtime_error("Invalid watchpoint range");
+    watchpoints.push_back(wp);
+    rebuild_watch_map();
+}
+
+void Simulator::remove_watchpoint(uint32_t start, uint32_t end, bool onRead, bool onWrite)
+{
+    for (auto it = watchpoints.begin(); it != watchpoints.end(); ++it)
+    {
+        if (it->start == start && it->end == end && it->on_read == onRead && it->on_write == onWrite)
+        {
+            watchpoints.erase(it);
+            break;
+        }
+    }
+    rebuild_watch_map();
+}
+
+void Simulator::clear_watchpoints()
+{
+    watchpoints.clear();
+    rebuild_watch_map();
+}
+
+void Simulator::rebuild_watch_map()
+{
+    fill(watch_map.begin(), watch_map.end(), 0);
+    for (const Watchpoint& wp : watchpoints)
+    {
+        uint32_t last = min(wp.end / 4, MEM_SIZE - 1);
+        for (uint32_t w = wp.start / 4; w <= last; w++)
+            watch_map[w >> 6] |= (uint64_t(1) << (w & 63));
+    }
+}
+
+// Slow path taken only when the accessed word has its watch bit set: find the
+// watchpoint that overlaps the accessed bytes and test its value condition.
+void Simulator::check_watch(uint32_t addr, uint32_t size, bool isWrite, uint32_t value)
+{
+    for (const Watchpoint& wp : watchpoints)
+    {
+        if (addr + size - 1 < wp.start || addr > wp.end)
+            continue;
+        if (isWrite ? !wp.on_write : !wp.on_read)
+            continue;
+        if (wp.has_value && wp.value != value)
+            continue;
+
+        stringstream ss;
+        ss << (isWrite ? "Write" : "Read") << " watchpoint at 0x" << hex << addr
+            << " (value 0x" << value << ")";
+        watch_reason = ss.str();
+        watch_addr = addr;
+        watch_was_write = isWrite;
+        watch_hit = true;
+        return;
+    }
+}
+
+// A location is either a label from the symbol table or a numeric address.
+uint32_t Simulator::resolve_location(const string& loc) const
+{
+    auto it = symbols.find(loc);
+    if (it != symbols.end())
+        return it->second;
+    return stoul(loc, nullptr, 0);
+}
+
+// Interactive view shown when execution stops. Returns false if the user
+// chose to quit.
+bool Simulator::debug_prompt(const string& reason)
+{
+    headless = false;
+    cout << "\033[1;91m" << reason << "\033[0m\n";
+    display_state();
+
+    string line;
+    while (true)
+    {
+        cout << "\033[1;91m(c)ontinue (s)tep (b/d loc) (w loc [len] [r|w|rw] [=val]) (W)clear (q)uit: \033[0m";
+        if (!getline(cin, line))
+            return false;
+
+        istringstream ss(line);
+        string cmd, loc;
+        ss >> cmd >> loc;
+        if (cmd.empty())
+            continue;
+
+        try
+        {
+            if (cmd == "c")
+            {
+                headless = true;
+                stepping = false;
+                return true;
+            }
+            else if (cmd == "s")
+            {
+                headless = false;
+                stepping = true;
+                return true;
+            }
+            else if (cmd == "q")
+            {
+                return false;
+            }
+            else if (cmd == "b")
+            {
+                add_breakpoint(resolve_location(loc));
+            }
+            else if (cmd == "d")
+            {
+                remove_breakpoint(resolve_location(loc));
+            }
+            else if (cmd == "w")
+            {
+                Watchpoint wp = { 0, 0, false, true, false, 0 };
+                wp.start = resolve_location(loc);
+                uint32_t len = 4;
+                string arg;
+                while (ss >> arg)
+                {
+                    if (arg == "r")       { wp.on_read = true;  wp.on_write = false; }
+                    else if (arg == "w")  { wp.on_read = false; wp.on_write = true; }
+                    else if (arg == "rw") { wp.on_read = true;  wp.on_write = true; }
+                    else if (arg[0] == '=')
+                    {
+                        wp.has_value = true;
+                        wp.value = stoul(arg.substr(1), nullptr, 0);
+                    }
+                    else
+                        len = stoul(arg, nullptr, 0);
+                }
+                wp.end = wp.start + (len ? len : 1) - 1;
+                add_watchpoint(wp);
+            }
+            else if (cmd == "W")
+            {
+                clear_watchpoints();
+            }
+            else
+            {
+                cout << "Unknown command: " << cmd << "\n";
+            }
+        }
+        catch (const exception& e)
+        {
+            cout << "Error: " << e.what() << "\n";
+        }
+    }
+}
@@ -0,0 +1,469 @@
+﻿#include "disasm.h"
+#include "simulator.h"
+#include <iomanip>
+#include <map>
+#include <set>
+
+// ───────────── Operands ─────────────
+static string x(uint32_t r) { return reg_names[r & 0x1F]; }
+static string f(uint32_t r) { return "f" + to_string(r & 0x1F); }
+static string v(uint32_t r) { return "v" + to_string(r & 0x1F); }
+
+static string hex_string(uint32_t value)
+{
+    ostringstream s;
+    s << "0x" << hex << value;
+    return s.str();
+}
+
+static int32_t i_imm(uint32_t instr) { return int32_t(instr) >> 20; }
+static int32_t s_imm(uint32_t instr) { return (int32_t(instr & 0xFE000000) >> 20) | int32_t((instr >> 7) & 0x1F); }
+
+static int32_t b_imm(uint32_t instr)
+{
+    return (int32_t(instr & 0x80000000) >> 19) | int32_t((instr & 0x80) << 4)
+        | int32_t((instr >> 20) & 0x7E0) | int32_t((instr >> 7) & 0x1E);
+}
+
+static int32_t j_imm(uint32_t instr)
+{
+    return (int32_t(instr & 0x80000000) >> 11) | int32_t(instr & 0xFF000)
+        | int32_t((instr >> 9) & 0x800) | int32_t((instr >> 20) & 0x7FE);
+}
+
+static string csr(uint32_t number)
+{
+    string name = csrName(number);
+    return name.empty() ? hex_string(number) : name;
+}
+
+// Trailing rounding-mode operand; omitted for dyn, which the assembler assumes.
+static string rounding(uint32_t instr)
+{
+    static const char* const names[8] = { "rne", "rtz", "rdn", "rup", "rmm", "5", "6", "dyn" };
+    uint32_t rm = (instr >> 12) & 0x7;
+    return rm == 0x7 ? string() : string(", ") + names[rm];
+}
+
+static string join(const string& name, const vector<string>& operands)
+{
+    string text = name;
+    for (size_t i = 0; i < operands.size(); i++)
+        text += (i == 0 ? " " : ", ") + operands[i];
+    return text;
+}
+
+// ───────────── Decoders ─────────────
+// Each returns the text, or empty for an encoding the simulator does not
+// execute. The tables mirror the dispatch of Simulator::step and its
+// extension handlers.
+
+static const unordered_map<uint32_t, const char*> opNames = {      // funct7 << 3 | funct3
+    {0x000, "add"}, {0x100, "sub"}, {0x001, "sll"}, {0x002, "slt"}, {0x003, "sltu"},
+    {0x004, "xor"}, {0x005, "srl"}, {0x105, "sra"}, {0x006, "or"}, {0x007, "and"},
+    {0x008, "mul"}, {0x009, "mulh"}, {0x00A, "mulhsu"}, {0x00B, "mulhu"},
+    {0x00C, "div"}, {0x00D, "divu"}, {0x00E, "rem"}, {0x00F, "remu"},
+    {0x082, "sh1add"}, {0x084, "sh2add"}, {0x086, "sh3add"},
+    {0x107, "andn"}, {0x106, "orn"}, {0x104, "xnor"},
+    {0x02C, "min"}, {0x02D, "minu"}, {0x02E, "max"}, {0x02F, "maxu"},
+    {0x181, "rol"}, {0x185, "ror"}, {0x121, "bclr"}, {0x125, "bext"}, {0x1A1, "binv"}, {0x0A1, "bset"}
+};
+
+static string decode_op(uint32_t instr)
+{
+    uint32_t rd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, rs2 = (instr >> 20) & 0x1F;
+    uint32_t key = ((instr >> 25) << 3) | ((instr >> 12) & 0x7);
+    if (key == 0x024 && rs2 == 0)
+        return join("zext.h", { x(rd), x(rs1) });
+    auto it = opNames.find(key);
+    if (it == opNames.end())
+        return string();
+    return join(it->second, { x(rd), x(rs1), x(rs2) });
+}
+
+static string decode_op_imm(uint32_t instr)
+{
+    static const char* const names[8] = { "addi", nullptr, "slti", "sltiu", "xori", nullptr, "ori", "andi" };
+    uint32_t rd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, funct3 = (instr >> 12) & 0x7;
+    uint32_t funct7 = instr >> 25, shamt = (instr >> 20) & 0x1F;
+    if (names[funct3])
+        return join(names[funct3], { x(rd), x(rs1), to_string(i_imm(instr)) });
+
+    const char* name = nullptr;
+    if (funct3 == 0x1)
+    {
+        switch (funct7)
+        {
+        case 0x00: name = "slli"; break;
+        case 0x24: name = "bclri"; break;
+        case 0x34: name = "binvi"; break;
+        case 0x14: name = "bseti"; break;
+        case 0x30:
+        {
+            static const char* const unary[8] = { "clz", "ctz", "cpop", nullptr, "sext.b", "sext.h", nullptr, nullptr };
+            const char* op = shamt < 8 ? unary[shamt] : nullptr;
+            return op ? join(op, { x(rd), x(rs1) }) : string();
+        }
+        }
+    }
+    else
+    {
+        uint32_t imm12 = instr >> 20;
+        if (imm12 == 0x287)
+            return join("orc.b", { x(rd), x(rs1) });
+        if (imm12 == 0x698)
+            return join("rev8", { x(rd), x(rs1) });
+        switch (funct7)
+        {
+        case 0x00: name = "srli"; break;
+        case 0x20: name = "srai"; break;
+        case 0x30: name = "rori"; break;
+        case 0x24: name = "bexti"; break;
+        }
+    }
+    return name ? join(name, { x(rd), x(rs1), to_string(shamt) }) : string();
+}
+
+static string decode_op_fp(uint32_t instr)
+{
+    uint32_t rd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, rs2 = (instr >> 20) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    switch (instr >> 25)
+    {
+    case 0x00: return join("fadd.s", { f(rd), f(rs1), f(rs2) }) + rounding(instr);
+    case 0x04: return join("fsub.s", { f(rd), f(rs1), f(rs2) }) + rounding(instr);
+    case 0x08: return join("fmul.s", { f(rd), f(rs1), f(rs2) }) + rounding(instr);
+    case 0x0C: return join("fdiv.s", { f(rd), f(rs1), f(rs2) }) + rounding(instr);
+    case 0x2C: return rs2 == 0 ? join("fsqrt.s", { f(rd), f(rs1) }) + rounding(instr) : string();
+    case 0x10:
+    {
+        static const char* const names[3] = { "fsgnj.s", "fsgnjn.s", "fsgnjx.s" };
+        return funct3 < 3 ? join(names[funct3], { f(rd), f(rs1), f(rs2) }) : string();
+    }
+    case 0x14:
+        return funct3 < 2 ? join(funct3 ? "fmax.s" : "fmin.s", { f(rd), f(rs1), f(rs2) }) : string();
+    case 0x50:
+    {
+        static const char* const names[3] = { "fle.s", "flt.s", "feq.s" };
+        return funct3 < 3 ? join(names[funct3], { x(rd), f(rs1), f(rs2) }) : string();
+    }
+    case 0x60:
+        return rs2 < 2 ? join(rs2 ? "fcvt.wu.s" : "fcvt.w.s", { x(rd), f(rs1) }) + rounding(instr) : string();
+    case 0x68:
+        return rs2 < 2 ? join(rs2 ? "fcvt.s.wu" : "fcvt.s.w", { f(rd), x(rs1) }) + rounding(instr) : string();
+    case 0x70:
+        if (rs2 != 0 || funct3 > 1)
+            return string();
+        return join(funct3 ? "fclass.s" : "fmv.x.w", { x(rd), f(rs1) });
+    case 0x78:
+        return (rs2 == 0 && funct3 == 0) ? join("fmv.w.x", { f(rd), x(rs1) }) : string();
+    }
+    return string();
+}
+
+// vtype as the assembler spells it: "e32, m1, ta, ma".
+static string vtype(uint32_t zimm)
+{
+    static const char* const lmul[8] = { "m1", "m2", "m4", "m8", nullptr, "mf8", "mf4", "mf2" };
+    uint32_t sew = (zimm >> 3) & 0x7;
+    if (sew > 3 || !lmul[zimm & 0x7])
+        return string();
+    return "e" + to_string(8u << sew) + ", " + lmul[zimm & 0x7]
+        + ((zimm & 0x40) ? ", ta" : ", tu") + ((zimm & 0x80) ? ", ma" : ", mu");
+}
+
+static const unordered_map<uint32_t, const char*> vectorIntNames = {
+    {0x00, "vadd"}, {0x02, "vsub"}, {0x03, "vrsub"}, {0x04, "vminu"}, {0x05, "vmin"},
+    {0x06, "vmaxu"}, {0x07, "vmax"}, {0x09, "vand"}, {0x0A, "vor"}, {0x0B, "vxor"},
+    {0x18, "vmseq"}, {0x19, "vmsne"}, {0x1A, "vmsltu"}, {0x1B, "vmslt"}, {0x1C, "vmsleu"},
+    {0x1D, "vmsle"}, {0x1E, "vmsgtu"}, {0x1F, "vmsgt"},
+    {0x25, "vsll"}, {0x28, "vsrl"}, {0x29, "vsra"}
+};
+
+static string decode_op_v(uint32_t instr)
+{
+    static const char* const reductions[8] = { "vredsum", "vredand", "vredor", "vredxor",
+        "vredminu", "vredmin", "vredmaxu", "vredmax" };
+    uint32_t vd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, vs2 = (instr >> 20) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7, funct6 = instr >> 26;
+    string mask = (instr & (1u << 25)) ? string() : ", v0.t";
+
+    if (funct3 == 0x7)
+    {
+        if ((instr >> 31) == 0)
+        {
+            string type = vtype((instr >> 20) & 0x7FF);
+            return type.empty() ? type : join("vsetvli", { x(vd), x(rs1), type });
+        }
+        if ((instr >> 30) == 0x3)
+        {
+            string type = vtype((instr >> 20) & 0x3FF);
+            return type.empty() ? type : join("vsetivli", { x(vd), to_string(rs1), type });
+        }
+        return string();
+    }
+    if (funct6 == 0x10 && funct3 == 0x2)
+        return join("vmv.x.s", { x(vd), v(vs2) });
+    if (funct6 == 0x10 && funct3 == 0x6)
+        return join("vmv.s.x", { v(vd), x(rs1) });
+    if (funct6 == 0x17 && funct3 == 0x0)
+        return join("vmv.v.v", { v(vd), v(rs1) });
+    if (funct6 == 0x17 && funct3 == 0x4)
+        return join("vmv.v.x", { v(vd), x(rs1) });
+    if (funct6 == 0x17 && funct3 == 0x3)
+        return join("vmv.v.i", { v(vd), to_string(int32_t(rs1 << 27) >> 27) });
+    if (funct3 == 0x2 && funct6 < 8)
+        return join(string(reductions[funct6]) + ".vs", { v(vd), v(vs2), v(rs1) }) + mask;
+    if (funct6 == 0x25 && (funct3 == 0x2 || funct3 == 0x6))
+        return join(funct3 == 0x2 ? "vmul.vv" : "vmul.vx", { v(vd), v(vs2), funct3 == 0x2 ? v(rs1) : x(rs1) }) + mask;
+
+    auto it = vectorIntNames.find(funct6);
+    if (it == vectorIntNames.end())
+        return string();
+    string base = it->second;
+    if (funct3 == 0x0)
+        return join(base + ".vv", { v(vd), v(vs2), v(rs1) }) + mask;
+    if (funct3 == 0x4)
+        return join(base + ".vx", { v(vd), v(vs2), x(rs1) }) + mask;
+    if (funct3 == 0x3)
+    {
+        // Shift amounts are unsigned; every other immediate is sign-extended.
+        bool shift = (funct6 == 0x25 || funct6 == 0x28 || funct6 == 0x29);
+        int32_t imm = shift ? int32_t(rs1) : int32_t(rs1 << 27) >> 27;
+        return join(base + ".vi", { v(vd), v(vs2), to_string(imm) }) + mask;
+    }
+    return string();
+}
+
+// flw/fsw, or with width 110 the 32-bit vector loads and stores.
+static string decode_fp_memory(uint32_t instr, bool store)
+{
+    uint32_t rd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, rs2 = (instr >> 20) & 0x1F;
+    uint32_t width = (instr >> 12) & 0x7;
+    if (width == 0x2)
+    {
+        if (store)
+            return join("fsw", { f(rs2), to_string(s_imm(instr)) + "(" + x(rs1) + ")" });
+        return join("flw", { f(rd), to_string(i_imm(instr)) + "(" + x(rs1) + ")" });
+    }
+    if (width != 0x6)
+        return string();
+    string mask = (instr & (1u << 25)) ? string() : ", v0.t";
+    string base = "(" + x(rs1) + ")";
+    switch ((instr >> 26) & 0x3)
+    {
+    case 0x0: return join(store ? "vse32.v" : "vle32.v", { v(rd), base }) + mask;
+    case 0x2: return join(store ? "vsse32.v" : "vlse32.v", { v(rd), base, x(rs2) }) + mask;
+    }
+    return string();
+}
+
+static string decode_system(uint32_t instr)
+{
+    switch (instr)
+    {
+    case 0x00000073: return "ecall";
+    case 0x00100073: return "ebreak";
+    case 0x30200073: return "mret";
+    case 0x10500073: return "wfi";
+    }
+    static const char* const names[8] = { nullptr, "csrrw", "csrrs", "csrrc", nullptr, "csrrwi", "csrrsi", "csrrci" };
+    uint32_t rd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, funct3 = (instr >> 12) & 0x7;
+    if (!names[funct3])
+        return string();
+    return join(names[funct3], { x(rd), csr(instr >> 20), (funct3 & 0x4) ? to_string(rs1) : x(rs1) });
+}
+
+static string decode(uint32_t instr, uint32_t pc)
+{
+    static const char* const loads[8] = { "lb", "lh", "lw", nullptr, "lbu", "lhu", nullptr, nullptr };
+    static const char* const stores[8] = { "sb", "sh", "sw", nullptr, nullptr, nullptr, nullptr, nullptr };
+    static const char* const branches[8] = { "beq", "bne", nullptr, nullptr, "blt", "bge", "bltu", "bgeu" };
+    uint32_t rd = (instr >> 7) & 0x1F, rs1 = (instr >> 15) & 0x1F, rs2 = (instr >> 20) & 0x1F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+
+    switch (instr & 0x7F)
+    {
+    case 0x33: return decode_op(instr);
+    case 0x13: return decode_op_imm(instr);
+    case 0x03:
+        return loads[funct3] ? join(loads[funct3], { x(rd), to_string(i_imm(instr)) + "(" + x(rs1) + ")" }) : string();
+    case 0x23:
+        return stores[funct3] ? join(stores[funct3], { x(rs2), to_string(s_imm(instr)) + "(" + x(rs1) + ")" }) : string();
+    case 0x67:
+        return funct3 == 0 ? join("jalr", { x(rd), x(rs1), to_string(i_imm(instr)) }) : string();
+    case 0x37: return join("lui", { x(rd), hex_string(instr >> 12) });
+    case 0x17: return join("auipc", { x(rd), hex_string(instr >> 12) });
+    case 0x63:
+        return branches[funct3] ? join(branches[funct3], { x(rs1), x(rs2), hex_string(pc + b_imm(instr)) }) : string();
+    case 0x6F: return join("jal", { x(rd), hex_string(pc + j_imm(instr)) });
+    case 0x57: return decode_op_v(instr);
+    case 0x07: return decode_fp_memory(instr, false);
+    case 0x27: return decode_fp_memory(instr, true);
+    case 0x53: return decode_op_fp(instr);
+    case 0x43:
+    case 0x47:
+    case 0x4B:
+    case 0x4F:
+    {
+        static const char* const names[4] = { "fmadd.s", "fmsub.s", "fnmsub.s", "fnmadd.s" };
+        if (((instr >> 25) & 0x3) != 0)
+            return string();
+        return join(names[((instr & 0x7F) - 0x43) >> 2], { f(rd), f(rs1), f(rs2), f(instr >> 27) }) + rounding(instr);
+    }
+    case 0x73: return decode_system(instr);
+    }
+    return string();
+}
+
+string disassemble(uint32_t code, uint32_t size, uint32_t pc)
+{
+    uint32_t instr = (size == 2) ? expand_compressed(uint16_t(code)) : code;
+    string text = instr ? decode(instr, pc) : string();
+    if (text.empty())
+        return (size == 2 ? ".half " : ".word ") + hex_string(code);
+    return text;
+}
+
+bool branch_target(uint32_t instr, uint32_t pc, uint32_t& target)
+{
+    if ((instr & 0x7F) == 0x63)
+        target = pc + b_imm(instr);
+    else if ((instr & 0x7F) == 0x6F)
+        target = pc + j_imm(instr);
+    else
+        return false;
+    return true;
+}
+
+// ───────────── Listing ─────────────
+
+// Instructions after which execution does not simply fall through.
+static bool ends_block(uint32_t instr)
+{
+    switch (instr & 0x7F)
+    {
+    case 0x63:
+    case 0x6F:
+    case 0x67:
+        return true;
+    case 0x73:
+        return instr == 0x00000073 || instr == 0x00100073 || instr == 0x30200073;
+    }
+    return false;
+}
+
+// Where an auipc at pc and the instruction after it together point: a jalr,
+// addi, load or store using the register the auipc wrote.
+static bool pair_target(uint32_t auipc, uint32_t pc, uint32_t next, uint32_t& target)
+{
+    if ((auipc & 0x7F) != 0x17)
+        return false;
+    uint32_t rd = (auipc >> 7) & 0x1F, rs1 = (next >> 15) & 0x1F;
+    uint32_t opcode = next & 0x7F;
+    if (rd == 0 || rs1 != rd)
+        return false;
+    int32_t low;
+    if (opcode == 0x67 || opcode == 0x03 || opcode == 0x07 || (opcode == 0x13 && ((next >> 12) & 0x7) == 0))
+        low = i_imm(next);
+    else if (opcode == 0x23 || opcode == 0x27)
+        low = s_imm(next);
+    else
+        return false;
+    target = pc + (auipc & 0xFFFFF000) + low;
+    return true;
+}
+
+void write_listing(ostream& out, const AssembledProgram& program, const string& source)
+{
+    const vector<EncodedInstruction>& instructions = program.instructions;
+    const SymbolTable& symbols = program.symbols;
+
+    // Names for annotating targets: a global label wins over a local one.
+    map<uint32_t, string> names;
+    set<uint32_t> labelled;
+    for (uint32_t id = 0; id < symbols.size(); id++)
+    {
+        if (!symbols.defined(id))
+            continue;
+        labelled.insert(symbols.address(id));
+        if (!symbols.local(id))
+            names.emplace(symbols.address(id), string(symbols.name(id)));
+    }
+    auto describe = [&](uint32_t target)
+    {
+        auto it = names.find(target);
+        return it == names.end() ? string() : " <" + it->second + ">";
+    };
+
+    // Expanded encodings, and where each basic block begins.
+    vector<uint32_t> expanded(instructions.size());
+    set<uint32_t> leaders = labelled;
+    for (size_t i = 0; i < instructions.size(); i++)
+    {
+        const EncodedInstruction& inst = instructions[i];
+        expanded[i] = (inst.size == 2) ? expand_compressed(uint16_t(inst.code)) : inst.code;
+        uint32_t target;
+        if (branch_target(expanded[i], inst.address, target))
+            leaders.insert(target);
+        if (i == 0 || ends_block(expanded[i - 1])
+            || instructions[i - 1].address + instructions[i - 1].size != inst.address)
+            leaders.insert(inst.address);
+    }
+
+    out << left << setw(12) << "; address" << setw(9) << "encoding" << right << setw(4) << "clk"
+        << "  " << left << setw(43) << "instruction" << right << "; line  source\n";
+    const string blank(27, ' ');
+    istringstream input(source);
+    string text;
+    size_t next = 0;
+    uint32_t blockStart = 0, blockCount = 0;
+    uint64_t blockCycles = 0, totalCycles = 0;
+    for (uint32_t number = 1; getline(input, text); number++)
+    {
+        if (!text.empty() && text.back() == '\r')
+            text.pop_back();
+        bool first = true;
+        for (; next < instructions.size() && instructions[next].line == number; next++)
+        {
+            const EncodedInstruction& inst = instructions[next];
+            uint32_t cycles = instruction_cycles(expanded[next]);
+            string asmText = disassemble(inst.code, inst.size, inst.address);
+            uint32_t target;
+            if (branch_target(expanded[next], inst.address, target))
+                asmText += describe(target);
+            else if (next > 0 && pair_target(expanded[next - 1], instructions[next - 1].address, expanded[next], target))
+                asmText += "  # " + hex_string(target) + describe(target);
+
+            if (blockCount == 0)
+                blockStart = inst.address;
+            blockCount++;
+            blockCycles += cycles;
+            totalCycles += cycles;
+
+            ostringstream encoding;
+            encoding << hex << setfill('0') << setw(inst.size == 2 ? 4 : 8) << inst.code;
+            out << "0x" << hex << setfill('0') << setw(8) << inst.address << dec << setfill(' ')
+                << "  " << left << setw(9) << encoding.str() << right << setw(4) << cycles << "  ";
+            if (first)
+                out << left << setw(43) << asmText << right << "; " << setw(4) << number << "  " << text << '\n';
+            else
+                out << asmText << '\n';
+            first = false;
+
+            bool last = next + 1 == instructions.size() || leaders.count(instructions[next + 1].address);
+            if (last)
+            {
+                out << blank << "; block 0x" << hex << blockStart << "-0x" << inst.address << dec
+                    << ": " << blockCount << (blockCount == 1 ? " instruction, " : " instructions, ")
+                    << blockCycles << " clk\n";
+                blockCount = 0;
+                blockCycles = 0;
+            }
+        }
+        if (first)
+            out << blank << setw(43) << "" << "; " << setw(4) << number << "  " << text << '\n';
+    }
+    out << "; " << instructions.size() << " instructions, " << totalCycles
+        << " clk if each runs once\n";
+}
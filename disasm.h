@@ -0,0 +1,24 @@
+#pragma once
+#ifndef DISASM_H
+#define DISASM_H
+#include "assembler.h"
+#include "cycles.h"
+
+// Assembly text of one instruction with ABI register names, as the
+// assembler spells it: "addi a0, a0, 1", "lw a2, 8(sp)". code is a 16-bit
+// RVC parcel when size is 2; it is shown as the instruction it expands to.
+// Branch and jump targets are printed as absolute addresses ("0x1010")
+// resolved against pc. Encodings the simulator does not execute come out
+// as ".word" or ".half".
+string disassemble(uint32_t code, uint32_t size, uint32_t pc);
+
+// Where a branch or jal at pc goes. False for any other instruction.
+bool branch_target(uint32_t instr, uint32_t pc, uint32_t& target);
+
+// An annotated listing of an assembled program: every source line in order,
+// and under it each instruction it produced with address, encoding, cycle
+// cost, disassembly and, for branches, jumps and auipc pairs, the label
+// they reach. Each basic block ends with its instruction and cycle totals.
+void write_listing(ostream& out, const AssembledProgram& program, const string& source);
+
+#endif
@@ -1,48 +1,535 @@
 ﻿#include "encoder.h"
 
-void SymbolTable::addLabel(const string& label, uint32_t address) {
-    table[label] = address;
+// ───────────── Operand helpers ─────────────
+static uint32_t intReg(const unordered_map<string, uint32_t>& regMap, const string& name) {
+    auto it = regMap.find(name);
+    if (it == regMap.end())
+        throw runtime_error("unknown register '" + name + "'");
+    return it->second;
 }
 
-bool SymbolTable::hasLabel(const string& label)const {
-    return table.find(label) != table.end();
+// Checks the operand count (tokens after the mnemonic) before any operand is read.
+static void expectOperands(const vector<string>& tokens, size_t least, size_t most) {
+    size_t count = tokens.size() - 1;
+    if (count >= least && count <= most)
+        return;
+    string expected = to_string(least) + (most != least ? "-" + to_string(most) : "");
+    throw runtime_error(tokens[0] + " expects " + expected + " operand(s), got " + to_string(count));
 }
 
-uint32_t SymbolTable::getAddress(const string& label)const{
-    auto it = table.find(label);
-    return (it != table.end()) ? it->second : 0;
+static void expectOperands(const vector<string>& tokens, size_t count) {
+    expectOperands(tokens, count, count);
 }
 
-uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const SymbolTable& sym, unordered_map<string, uint32_t> regMap) {
+static uint32_t number(const string& token) {
+    try {
+        return stoul(token, nullptr, 0);
+    }
+    catch (const exception&) {
+        throw runtime_error("invalid immediate '" + token + "'");
+    }
+}
+
+// ───────────── Vector (RVV) helpers ─────────────
+static uint32_t vectorReg(const string& name) {
+    if (name.size() < 2 || name[0] != 'v')
+        throw runtime_error("Expected vector register: " + name);
+    uint32_t reg = stoul(name.substr(1));
+    if (reg > 31)
+        throw runtime_error("Invalid vector register: " + name);
+    return reg;
+}
+
+// Drops empty tokens and the parentheses around a vector base register, and
+// strips a trailing "v0.t" into the masked flag.
+static vector<string> vectorOperands(const vector<string>& tokens, bool& masked) {
+    vector<string> ops;
+    for (const string& t : tokens) {
+        string op;
+        for (char c : t)
+            if (c != '(' && c != ')')
+                op += c;
+        if (!op.empty())
+            ops.push_back(op);
+    }
+    masked = (!ops.empty() && ops.back() == "v0.t");
+    if (masked)
+        ops.pop_back();
+    return ops;
+}
+
+static const unordered_map<string, uint32_t> vectorIntOps = {
+    {"vadd", 0x00}, {"vsub", 0x02}, {"vrsub", 0x03}, {"vminu", 0x04}, {"vmin", 0x05},
+    {"vmaxu", 0x06}, {"vmax", 0x07}, {"vand", 0x09}, {"vor", 0x0A}, {"vxor", 0x0B},
+    {"vmseq", 0x18}, {"vmsne", 0x19}, {"vmsltu", 0x1A}, {"vmslt", 0x1B}, {"vmsleu", 0x1C},
+    {"vmsle", 0x1D}, {"vmsgtu", 0x1E}, {"vmsgt", 0x1F},
+    {"vsll", 0x25}, {"vsrl", 0x28}, {"vsra", 0x29}
+};
+
+static const unordered_map<string, uint32_t> vectorReductions = {
+    {"vredsum", 0x00}, {"vredand", 0x01}, {"vredor", 0x02}, {"vredxor", 0x03},
+    {"vredminu", 0x04}, {"vredmin", 0x05}, {"vredmaxu", 0x06}, {"vredmax", 0x07}
+};
+
+static uint32_t encodeOPV(uint32_t funct6, bool masked, uint32_t vs2, uint32_t rs1, uint32_t funct3, uint32_t vd) {
+    return (funct6 << 26) | ((masked ? 0u : 1u) << 25) | (vs2 << 20) | ((rs1 & 0x1F) << 15)
+        | (funct3 << 12) | (vd << 7) | 0b1010111;
+}
+
+// vtype immediate from "e32, m1[, ta|tu][, ma|mu]"
+static uint32_t parseVtype(const vector<string>& ops, size_t first) {
+    uint32_t vsew = 0xFFFFFFFF, vlmul = 0, vta = 0, vma = 0;
+    for (size_t i = first; i < ops.size(); i++) {
+        const string& o = ops[i];
+        if (o == "e8") vsew = 0;
+        else if (o == "e16") vsew = 1;
+        else if (o == "e32") vsew = 2;
+        else if (o == "e64") vsew = 3;
+        else if (o == "m1") vlmul = 0;
+        else if (o == "m2") vlmul = 1;
+        else if (o == "m4") vlmul = 2;
+        else if (o == "m8") vlmul = 3;
+        else if (o == "mf8") vlmul = 5;
+        else if (o == "mf4") vlmul = 6;
+        else if (o == "mf2") vlmul = 7;
+        else if (o == "ta") vta = 1;
+        else if (o == "tu") vta = 0;
+        else if (o == "ma") vma = 1;
+        else if (o == "mu") vma = 0;
+        else throw runtime_error("Invalid vtype field: " + o);
+    }
+    if (vsew == 0xFFFFFFFF)
+        throw runtime_error("vsetvli requires an element width");
+    return (vma << 7) | (vta << 6) | (vsew << 3) | vlmul;
+}
+
+static bool encodeVector(const vector<string>& tokens, const unordered_map<string, uint32_t>& regMap, uint32_t& code) {
+    const string& inst = tokens[0];
+    if (inst.empty() || inst[0] != 'v')
+        return false;
+    bool masked;
+    vector<string> ops = vectorOperands(tokens, masked);
+
+    if (inst == "vsetvli") {
+        expectOperands(ops, 3, 6);
+        code = ((parseVtype(ops, 3) & 0x7FF) << 20) | (intReg(regMap, ops[2]) << 15) | (0b111 << 12)
+            | (intReg(regMap, ops[1]) << 7) | 0b1010111;
+        return true;
+    }
+    if (inst == "vsetivli") {
+        expectOperands(ops, 3, 6);
+        uint32_t uimm = number(ops[2]);
+        code = (0b11u << 30) | ((parseVtype(ops, 3) & 0x3FF) << 20) | ((uimm & 0x1F) << 15) | (0b111 << 12)
+            | (intReg(regMap, ops[1]) << 7) | 0b1010111;
+        return true;
+    }
+
+    // Unit-stride and strided 32-bit loads/stores
+    if (inst == "vle32.v" || inst == "vse32.v" || inst == "vlse32.v" || inst == "vsse32.v") {
+        bool strided = (inst == "vlse32.v" || inst == "vsse32.v");
+        bool store = (inst == "vse32.v" || inst == "vsse32.v");
+        expectOperands(ops, strided ? 3 : 2);
+        uint32_t rs2 = strided ? intReg(regMap, ops[3]) : 0;
+        code = ((strided ? 0b10u : 0b00u) << 26) | ((masked ? 0u : 1u) << 25) | (rs2 << 20)
+            | (intReg(regMap, ops[2]) << 15) | (0b110 << 12) | (vectorReg(ops[1]) << 7)
+            | (store ? 0b0100111 : 0b0000111);
+        return true;
+    }
+
+    size_t dot = inst.find('.');
+    if (dot == string::npos)
+        return false;
+    string base = inst.substr(0, dot);
+    string form = inst.substr(dot + 1);
+
+    if (base == "vmv")
+        expectOperands(ops, 2);
+    if (inst == "vmv.x.s") {
+        code = encodeOPV(0x10, false, vectorReg(ops[2]), 0, 0b010, intReg(regMap, ops[1]));
+        return true;
+    }
+    if (inst == "vmv.s.x") {
+        code = encodeOPV(0x10, false, 0, intReg(regMap, ops[2]), 0b110, vectorReg(ops[1]));
+        return true;
+    }
+    if (base == "vmv" && form == "v.v") {
+        code = encodeOPV(0x17, false, 0, vectorReg(ops[2]), 0b000, vectorReg(ops[1]));
+        return true;
+    }
+    if (base == "vmv" && form == "v.x") {
+        code = encodeOPV(0x17, false, 0, intReg(regMap, ops[2]), 0b100, vectorReg(ops[1]));
+        return true;
+    }
+    if (base == "vmv" && form == "v.i") {
+        code = encodeOPV(0x17, false, 0, number(ops[2]), 0b011, vectorReg(ops[1]));
+        return true;
+    }
+
+    auto red = vectorReductions.find(base);
+    if (red != vectorReductions.end() && form == "vs") {
+        expectOperands(ops, 3);
+        code = encodeOPV(red->second, masked, vectorReg(ops[2]), vectorReg(ops[3]), 0b010, vectorReg(ops[1]));
+        return true;
+    }
+    if (base == "vmul" && (form == "vv" || form == "vx")) {
+        expectOperands(ops, 3);
+        uint32_t src = (form == "vv") ? vectorReg(ops[3]) : intReg(regMap, ops[3]);
+        code = encodeOPV(0x25, masked, vectorReg(ops[2]), src, form == "vv" ? 0b010 : 0b110, vectorReg(ops[1]));
+        return true;
+    }
+
+    auto op = vectorIntOps.find(base);
+    if (op == vectorIntOps.end())
+        return false;
+    expectOperands(ops, 3);
+    uint32_t vd = vectorReg(ops[1]);
+    uint32_t vs2 = vectorReg(ops[2]);
+    if (form == "vv")
+        code = encodeOPV(op->second, masked, vs2, vectorReg(ops[3]), 0b000, vd);
+    else if (form == "vx")
+        code = encodeOPV(op->second, masked, vs2, intReg(regMap, ops[3]), 0b100, vd);
+    else if (form == "vi")
+        code = encodeOPV(op->second, masked, vs2, number(ops[3]), 0b011, vd);
+    else
+        return false;
+    return true;
+}
+
+// ───────────── Floating-point (F) helpers ─────────────
+static const unordered_map<string, uint32_t> fpRegMap = [] {
+    unordered_map<string, uint32_t> m;
+    for (uint32_t i = 0; i < 32; i++)
+        m["f" + to_string(i)] = i;
+    for (uint32_t i = 0; i < 8; i++) m["ft" + to_string(i)] = i;
+    m["fs0"] = 8; m["fs1"] = 9;
+    for (uint32_t i = 0; i < 8; i++) m["fa" + to_string(i)] = 10 + i;
+    for (uint32_t i = 2; i < 12; i++) m["fs" + to_string(i)] = 16 + i;
+    for (uint32_t i = 8; i < 12; i++) m["ft" + to_string(i)] = 20 + i;
+    return m;
+}();
+
+static uint32_t fpReg(const string& name) {
+    auto it = fpRegMap.find(name);
+    if (it == fpRegMap.end())
+        throw runtime_error("Expected floating-point register: " + name);
+    return it->second;
+}
+
+// Optional trailing rounding-mode operand; dyn (use frm) when omitted.
+static uint32_t roundingMode(const vector<string>& tokens, size_t index) {
+    if (tokens.size() <= index) return 0b111;
+    const string& rm = tokens[index];
+    if (rm == "rne") return 0b000;
+    if (rm == "rtz") return 0b001;
+    if (rm == "rdn") return 0b010;
+    if (rm == "rup") return 0b011;
+    if (rm == "rmm") return 0b100;
+    if (rm == "dyn") return 0b111;
+    throw runtime_error("Invalid rounding mode: " + rm);
+}
+
+static const unordered_map<string, uint32_t> csrMap = {
+    {"fflags", 0x001}, {"frm", 0x002}, {"fcsr", 0x003},
+    {"mstatus", 0x300}, {"misa", 0x301}, {"mie", 0x304}, {"mtvec", 0x305},
+    {"mscratch", 0x340}, {"mepc", 0x341}, {"mcause", 0x342}, {"mtval", 0x343}, {"mip", 0x344},
+    {"time", 0xC01}, {"timeh", 0xC81}, {"mhartid", 0xF14}
+};
+
+static uint32_t csrNumber(const string& name) {
+    auto it = csrMap.find(name);
+    return (it != csrMap.end()) ? it->second : number(name);
+}
+
+string csrName(uint32_t number) {
+    for (const auto& entry : csrMap)
+        if (entry.second == number)
+            return entry.first;
+    return string();
+}
+
+// OP-FP with fmt=S: funct5 | fmt | rs2 | rs1 | funct3/rm | rd
+static uint32_t encodeOPFP(uint32_t funct5, uint32_t rs2, uint32_t rs1, uint32_t rm, uint32_t rd) {
+    return (funct5 << 27) | (rs2 << 20) | (rs1 << 15) | (rm << 12) | (rd << 7) | 0b1010011;
+}
+
+static bool encodeFloat(const vector<string>& tokens, const unordered_map<string, uint32_t>& regMap, uint32_t& code) {
+    const string& inst = tokens[0];
+
+    // Pseudo-instructions
+    if (inst == "fmv.s" || inst == "fneg.s" || inst == "fabs.s") {
+        expectOperands(tokens, 2);
+        uint32_t rm = (inst == "fmv.s") ? 0b000 : (inst == "fneg.s") ? 0b001 : 0b010;
+        uint32_t rs = fpReg(tokens[2]);
+        code = encodeOPFP(0x04, rs, rs, rm, fpReg(tokens[1]));
+        return true;
+    }
+
+    if (inst == "flw") {
+        expectOperands(tokens, 3);
+        uint32_t imm = number(tokens[3]);
+        code = ((imm & 0xFFF) << 20) | (intReg(regMap, tokens[2]) << 15) | (0b010 << 12)
+            | (fpReg(tokens[1]) << 7) | 0b0000111;
+        return true;
+    }
+    if (inst == "fsw") {
+        expectOperands(tokens, 3);
+        uint32_t imm = number(tokens[3]);
+        code = (((imm >> 5) & 0x7F) << 25) | (fpReg(tokens[1]) << 20) | (intReg(regMap, tokens[2]) << 15)
+            | (0b010 << 12) | ((imm & 0x1F) << 7) | 0b0100111;
+        return true;
+    }
+
+    // fd, fs1, fs2[, rm]
+    if (inst == "fadd.s" || inst == "fsub.s" || inst == "fmul.s" || inst == "fdiv.s") {
+        expectOperands(tokens, 3, 4);
+        uint32_t funct5 = (inst == "fadd.s") ? 0x00 : (inst == "fsub.s") ? 0x01 : (inst == "fmul.s") ? 0x02 : 0x03;
+        code = encodeOPFP(funct5, fpReg(tokens[3]), fpReg(tokens[2]), roundingMode(tokens, 4), fpReg(tokens[1]));
+        return true;
+    }
+    if (inst == "fsqrt.s") {
+        expectOperands(tokens, 2, 3);
+        code = encodeOPFP(0x0B, 0, fpReg(tokens[2]), roundingMode(tokens, 3), fpReg(tokens[1]));
+        return true;
+    }
+    // fd, fs1, fs2 with funct3 selecting the operation
+    if (inst == "fsgnj.s" || inst == "fsgnjn.s" || inst == "fsgnjx.s" || inst == "fmin.s" || inst == "fmax.s") {
+        expectOperands(tokens, 3);
+        uint32_t funct5 = (inst == "fmin.s" || inst == "fmax.s") ? 0x05 : 0x04;
+        uint32_t funct3 = (inst == "fsgnjn.s" || inst == "fmax.s") ? 0b001 : (inst == "fsgnjx.s") ? 0b010 : 0b000;
+        code = encodeOPFP(funct5, fpReg(tokens[3]), fpReg(tokens[2]), funct3, fpReg(tokens[1]));
+        return true;
+    }
+    // rd, fs1, fs2
+    if (inst == "feq.s" || inst == "flt.s" || inst == "fle.s") {
+        expectOperands(tokens, 3);
+        uint32_t funct3 = (inst == "feq.s") ? 0b010 : (inst == "flt.s") ? 0b001 : 0b000;
+        code = encodeOPFP(0x14, fpReg(tokens[3]), fpReg(tokens[2]), funct3, intReg(regMap, tokens[1]));
+        return true;
+    }
+    if (inst == "fcvt.w.s" || inst == "fcvt.wu.s") {
+        expectOperands(tokens, 2, 3);
+        code = encodeOPFP(0x18, inst == "fcvt.wu.s", fpReg(tokens[2]), roundingMode(tokens, 3), intReg(regMap, tokens[1]));
+        return true;
+    }
+    if (inst == "fcvt.s.w" || inst == "fcvt.s.wu") {
+        expectOperands(tokens, 2, 3);
+        code = encodeOPFP(0x1A, inst == "fcvt.s.wu", intReg(regMap, tokens[2]), roundingMode(tokens, 3), fpReg(tokens[1]));
+        return true;
+    }
+    if (inst == "fmv.x.w" || inst == "fclass.s") {
+        expectOperands(tokens, 2);
+        code = encodeOPFP(0x1C, 0, fpReg(tokens[2]), inst == "fclass.s", intReg(regMap, tokens[1]));
+        return true;
+    }
+    if (inst == "fmv.w.x") {
+        expectOperands(tokens, 2);
+        code = encodeOPFP(0x1E, 0, intReg(regMap, tokens[2]), 0b000, fpReg(tokens[1]));
+        return true;
+    }
+
+    // R4 format: fd, fs1, fs2, fs3[, rm]
+    if (inst == "fmadd.s" || inst == "fmsub.s" || inst == "fnmsub.s" || inst == "fnmadd.s") {
+        expectOperands(tokens, 4, 5);
+        uint32_t opcode = (inst == "fmadd.s") ? 0b1000011 : (inst == "fmsub.s") ? 0b1000111
+            : (inst == "fnmsub.s") ? 0b1001011 : 0b1001111;
+        code = (fpReg(tokens[4]) << 27) | (fpReg(tokens[3]) << 20) | (fpReg(tokens[2]) << 15)
+            | (roundingMode(tokens, 5) << 12) | (fpReg(tokens[1]) << 7) | opcode;
+        return true;
+    }
+    return false;
+}
+
+// csrrw/csrrs/csrrc(i) and the CSR pseudo-instructions.
+static bool encodeCSR(const vector<string>& tokens, const unordered_map<string, uint32_t>& regMap, uint32_t& code) {
+    string inst = tokens[0];
+    string rd = "x0", csr, src = "x0";
+
+    if (inst == "csrrw" || inst == "csrrs" || inst == "csrrc" ||
+        inst == "csrrwi" || inst == "csrrsi" || inst == "csrrci") {
+        expectOperands(tokens, 3);
+        rd = tokens[1]; csr = tokens[2]; src = tokens[3];
+    }
+    else if (inst == "csrr") { expectOperands(tokens, 2); inst = "csrrs"; rd = tokens[1]; csr = tokens[2]; }
+    else if (inst == "csrw" || inst == "csrs" || inst == "csrc" ||
+             inst == "csrwi" || inst == "csrsi" || inst == "csrci") {
+        expectOperands(tokens, 2);
+        inst = "csrr" + inst.substr(3); csr = tokens[1]; src = tokens[2];
+    }
+    else if (inst == "frcsr" || inst == "frrm" || inst == "frflags") {
+        expectOperands(tokens, 1);
+        csr = (inst == "frcsr") ? "fcsr" : (inst == "frrm") ? "frm" : "fflags";
+        inst = "csrrs"; rd = tokens[1];
+    }
+    else if (inst == "fscsr" || inst == "fsrm" || inst == "fsflags") {
+        // One operand writes the CSR, two also return the old value.
+        expectOperands(tokens, 1, 2);
+        csr = (inst == "fscsr") ? "fcsr" : (inst == "fsrm") ? "frm" : "fflags";
+        inst = "csrrw";
+        if (tokens.size() > 2) { rd = tokens[1]; src = tokens[2]; }
+        else src = tokens[1];
+    }
+    else
+        return false;
+
+    uint32_t funct3;
+    if (inst == "csrrw") funct3 = 0b001;
+    else if (inst == "csrrs") funct3 = 0b010;
+    else if (inst == "csrrc") funct3 = 0b011;
+    else if (inst == "csrrwi") funct3 = 0b101;
+    else if (inst == "csrrsi") funct3 = 0b110;
+    else funct3 = 0b111;
+    uint32_t rs1 = (funct3 & 0b100) ? (number(src) & 0x1F) : intReg(regMap, src);
+    code = ((csrNumber(csr) & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (intReg(regMap, rd) << 7) | 0b1110011;
+    return true;
+}
+
+static uint32_t labelAddress(const SymbolTable& sym, const string& name, uint32_t label) {
+    if (label != SymbolTable::NO_SYMBOL && sym.defined(label))
+        return sym.address(label);
+    return sym.getAddress(name);
+}
+
+// "%pcrel_hi(sym)" etc.: kind and symbol of a relocation operand.
+bool parseRelocation(const string& operand, string& kind, string& symbol) {
+    if (operand.size() < 4 || operand[0] != '%' || operand.back() != ')')
+        return false;
+    size_t open = operand.find('(');
+    if (open == string::npos)
+        return false;
+    kind = operand.substr(1, open - 1);
+    symbol = operand.substr(open + 1, operand.size() - open - 2);
+    return kind == "hi" || kind == "lo" || kind == "pcrel_hi" || kind == "pcrel_lo";
+}
+
+// An immediate operand: a number, or a relocation against a label. The
+// "%pcrel_lo" half is relative to the auipc that precedes its instruction,
+// which is how the assembler always emits the pair.
+static uint32_t immediate(const string& token, uint32_t address, const SymbolTable& sym, uint32_t label) {
+    string kind, symbol;
+    if (!parseRelocation(token, kind, symbol))
+        return number(token);
+    uint32_t target = labelAddress(sym, symbol, label);
+    if (kind == "pcrel_hi" || kind == "pcrel_lo")
+        target -= (kind == "pcrel_hi") ? address : address - 4;
+    if (kind == "hi" || kind == "pcrel_hi")
+        return ((target + 0x800) >> 12) & 0xFFFFF;
+    return target & 0xFFF;
+}
+
+uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const SymbolTable& sym, const unordered_map<string, uint32_t>& regMap, uint32_t label) {
     string inst = tokens[0];
     uint32_t rd, rs1, rs2, imm, opcode, funct3, funct7;
     // ───────────── Pseudo - Instructions ─────────────
-    // "li" Implemented in main function
+    // "li", "la", "call" and the other multi-instruction pseudos are expanded
+    // by the assembler (expandPseudo); these map to one instruction.
     if (inst == "nop") {
+        expectOperands(tokens, 0);
         vector<string> newtokens = { "addi","x0","x0","0" };
         return encodeInstruction(newtokens, address, sym, regMap);
     }
     if (inst == "mv") {
+        expectOperands(tokens, 2);
         vector<string> newtokens = { "addi",tokens[1],tokens[2],"0" };
         return encodeInstruction(newtokens, address, sym, regMap);
     }
     if (inst == "not") {
+        expectOperands(tokens, 2);
         vector<string> newtokens = { "xori",tokens[1],tokens[2],"-1" };
         return encodeInstruction(newtokens, address, sym, regMap);
     }
     if (inst == "neg") {
+        expectOperands(tokens, 2);
         vector<string> newtokens = { "sub",tokens[1],"x0",tokens[2]};
         return encodeInstruction(newtokens, address, sym, regMap);
     }
+    // ───────────── Vector (RVV subset) ─────────────
+    uint32_t vcode;
+    if (encodeVector(tokens, regMap, vcode))
+        return vcode;
+
+    // ───────────── Floating point (F) and CSRs ─────────────
+    uint32_t fcode;
+    if (encodeFloat(tokens, regMap, fcode) || encodeCSR(tokens, regMap, fcode))
+        return fcode;
+
+    // ───────────── Bit-manipulation (Zba/Zbb/Zbs) ─────────────
+    if (inst == "sh1add" || inst == "sh2add" || inst == "sh3add" ||
+        inst == "andn" || inst == "orn" || inst == "xnor" ||
+        inst == "min" || inst == "minu" || inst == "max" || inst == "maxu" ||
+        inst == "rol" || inst == "ror" ||
+        inst == "bclr" || inst == "bext" || inst == "binv" || inst == "bset") {
+        expectOperands(tokens, 3);
+
+        rd = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        rs2 = intReg(regMap, tokens[3]);
+        opcode = 0b0110011;
+        if (inst == "sh1add") { funct3 = 0b010; funct7 = 0b0010000; }
+        else if (inst == "sh2add") { funct3 = 0b100; funct7 = 0b0010000; }
+        else if (inst == "sh3add") { funct3 = 0b110; funct7 = 0b0010000; }
+        else if (inst == "andn") { funct3 = 0b111; funct7 = 0b0100000; }
+        else if (inst == "orn") { funct3 = 0b110; funct7 = 0b0100000; }
+        else if (inst == "xnor") { funct3 = 0b100; funct7 = 0b0100000; }
+        else if (inst == "min") { funct3 = 0b100; funct7 = 0b0000101; }
+        else if (inst == "minu") { funct3 = 0b101; funct7 = 0b0000101; }
+        else if (inst == "max") { funct3 = 0b110; funct7 = 0b0000101; }
+        else if (inst == "maxu") { funct3 = 0b111; funct7 = 0b0000101; }
+        else if (inst == "rol") { funct3 = 0b001; funct7 = 0b0110000; }
+        else if (inst == "ror") { funct3 = 0b101; funct7 = 0b0110000; }
+        else if (inst == "bclr") { funct3 = 0b001; funct7 = 0b0100100; }
+        else if (inst == "bext") { funct3 = 0b101; funct7 = 0b0100100; }
+        else if (inst == "binv") { funct3 = 0b001; funct7 = 0b0110100; }
+        else if (inst == "bset") { funct3 = 0b001; funct7 = 0b0010100; }
+
+        return (funct7 << 25) | (rs2 << 20) | (rs1 << 15)
+            | (funct3 << 12) | (rd << 7) | opcode;
+    }
+    if (inst == "rori" || inst == "bclri" || inst == "bexti" || inst == "binvi" || inst == "bseti") {
+        expectOperands(tokens, 3);
+        rd = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        imm = number(tokens[3]);
+        opcode = 0b0010011;
+        if (inst == "rori") { funct3 = 0b101; funct7 = 0b0110000; }
+        else if (inst == "bclri") { funct3 = 0b001; funct7 = 0b0100100; }
+        else if (inst == "bexti") { funct3 = 0b101; funct7 = 0b0100100; }
+        else if (inst == "binvi") { funct3 = 0b001; funct7 = 0b0110100; }
+        else if (inst == "bseti") { funct3 = 0b001; funct7 = 0b0010100; }
+        return (funct7 << 25) | ((imm & 0x1F) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+    }
+    // Unary ops: the operation is selected by the whole imm[11:0] field.
+    if (inst == "clz" || inst == "ctz" || inst == "cpop" || inst == "sext.b" || inst == "sext.h" ||
+        inst == "orc.b" || inst == "rev8") {
+        expectOperands(tokens, 2);
+        rd = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        opcode = 0b0010011;
+        if (inst == "clz") { funct3 = 0b001; imm = 0x600; }
+        else if (inst == "ctz") { funct3 = 0b001; imm = 0x601; }
+        else if (inst == "cpop") { funct3 = 0b001; imm = 0x602; }
+        else if (inst == "sext.b") { funct3 = 0b001; imm = 0x604; }
+        else if (inst == "sext.h") { funct3 = 0b001; imm = 0x605; }
+        else if (inst == "orc.b") { funct3 = 0b101; imm = 0x287; }
+        else { funct3 = 0b101; imm = 0x698; }       // rev8
+        return (imm << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+    }
+    if (inst == "zext.h") {
+        expectOperands(tokens, 2);
+        rd = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        return (0b0000100 << 25) | (rs1 << 15) | (0b100 << 12) | (rd << 7) | 0b0110011;
+    }
+
     // ───────────── R-TYPE ─────────────
     if (inst == "add" || inst == "sub" || inst == "xor" || inst == "or" || inst == "and" ||
         inst == "sll" || inst == "srl" || inst == "sra" || inst == "slt" || inst == "sltu" ||
         inst == "mul" || inst == "mulh" || inst == "mulhsu" || inst == "mulhu" ||
         inst == "div" || inst == "divu" || inst == "rem" || inst == "remu") {
+        expectOperands(tokens, 3);
 
-        rd = regMap[tokens[1]];
-        rs1 = regMap[tokens[2]];
-        rs2 = regMap[tokens[3]];
+        rd = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        rs2 = intReg(regMap, tokens[3]);
         opcode = 0b0110011;
         if (inst == "add") { funct3 = 0b000; funct7 = 0b0000000; }
         else if (inst == "sub") { funct3 = 0b000; funct7 = 0b0100000; }
@@ -74,9 +561,10 @@ uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const
         inst == "slli" || inst == "srli" || inst == "srai" ||
         inst == "slti" || inst == "sltiu" || inst == "jalr" ||
         inst == "lb" || inst == "lh" || inst == "lw" || inst == "lbu" || inst == "lhu") {
-        rd = regMap[tokens[1]];
-        rs1 = regMap[tokens[2]];
-        imm = stoul(tokens[3], nullptr,0);
+        expectOperands(tokens, 3);
+        rd = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        imm = immediate(tokens[3], address, sym, label);
         if (inst == "addi") { opcode = 0b0010011; funct3 = 0b000; }
         else if (inst == "xori") { opcode = 0b0010011; funct3 = 0b100; }
         else if (inst == "ori") { opcode = 0b0010011; funct3 = 0b110; }
@@ -98,9 +586,10 @@ uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const
 
     // ───────────── S-TYPE ─────────────
     if (inst == "sb" || inst == "sh" || inst == "sw") {
-        rs2 = regMap[tokens[1]];
-        rs1 = regMap[tokens[2]];
-        imm = stoul(tokens[3], nullptr, 0);
+        expectOperands(tokens, 3);
+        rs2 = intReg(regMap, tokens[1]);
+        rs1 = intReg(regMap, tokens[2]);
+        imm = number(tokens[3]);
         opcode = 0b0100011;
         if (inst == "sb") funct3 = 0b000;
         else if (inst == "sh") funct3 = 0b001;
@@ -114,9 +603,12 @@ uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const
 
     // ───────────── B-TYPE ─────────────
     if (inst == "beq" || inst == "bne" || inst == "blt" || inst == "bge" || inst == "bltu" || inst == "bgeu") {
-        rs1 = regMap[tokens[1]];
-        rs2 = regMap[tokens[2]];
-        int32_t offset = (int32_t)sym.getAddress(tokens[3]) - (int32_t)address;
+        expectOperands(tokens, 3);
+        rs1 = intReg(regMap, tokens[1]);
+        rs2 = intReg(regMap, tokens[2]);
+        int32_t offset = (int32_t)labelAddress(sym, tokens[3], label) - (int32_t)address;
+        if (offset < -4096 || offset > 4094)
+            throw runtime_error("branch target '" + tokens[3] + "' out of range");
         opcode = 0b1100011;
         if (inst == "beq") funct3 = 0b000;
         else if (inst == "bne") funct3 = 0b001;
@@ -137,8 +629,11 @@ uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const
 
     // ───────────── J-TYPE ─────────────
     if (inst == "jal") {
-        rd = regMap[tokens[1]];
-        int32_t offset = (int32_t)sym.getAddress(tokens[2]) - (int32_t)address;
+        expectOperands(tokens, 2);
+        rd = intReg(regMap, tokens[1]);
+        int32_t offset = (int32_t)labelAddress(sym, tokens[2], label) - (int32_t)address;
+        if (offset < -(1 << 20) || offset > (1 << 20) - 2)
+            throw runtime_error("jump target '" + tokens[2] + "' out of range");
         opcode = 0b1101111;
         uint32_t imm = offset;
         uint32_t imm20 = (imm >> 20) & 1;
@@ -152,19 +647,212 @@ uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const
 
     // ───────────── U-TYPE ─────────────
     if (inst == "lui" || inst == "auipc") {
-        rd = regMap[tokens[1]];
-        imm = stoul(tokens[2], nullptr, 0);
+        expectOperands(tokens, 2);
+        rd = intReg(regMap, tokens[1]);
+        imm = immediate(tokens[2], address, sym, label);
         opcode = (inst == "lui") ? 0b0110111 : 0b0010111;
         return (imm << 12) | (rd << 7) | opcode;
     }
 
     // ───────────── Environment ─────────────
     if (inst == "ecall") {
+        expectOperands(tokens, 0);
         return 0x00000073;
     }
     if (inst == "ebreak") {
+        expectOperands(tokens, 0);
         return 0x00100073;
     }
+    if (inst == "mret") {
+        expectOperands(tokens, 0);
+        return 0x30200073;
+    }
+    if (inst == "wfi") {
+        expectOperands(tokens, 0);
+        return 0x10500073;
+    }
 
     throw runtime_error("Unknown instruction: " + inst);
 }
+
+
+// ───────────── RV32C Compression ─────────────
+static bool lookupReg(const unordered_map<string, uint32_t>& regMap, const string& name, uint32_t& reg) {
+    auto it = regMap.find(name);
+    if (it == regMap.end())
+        return false;
+    reg = it->second;
+    return true;
+}
+
+static bool parseImm(const string& token, int32_t& imm) {
+    try {
+        size_t used;
+        imm = (int32_t)stoul(token, &used, 0);
+        return used == token.size();
+    }
+    catch (const exception&) {
+        return false;
+    }
+}
+
+static bool isCompressedReg(uint32_t reg) {
+    return reg >= 8 && reg <= 15;
+}
+
+static bool fits(int32_t imm, int bits) {
+    return imm >= -(1 << (bits - 1)) && imm < (1 << (bits - 1));
+}
+
+// CI format: funct3 | imm[5] | rd | imm[4:0] | op
+static uint16_t encodeCI(uint32_t funct3, uint32_t rd, int32_t imm, uint32_t op) {
+    return (uint16_t)((funct3 << 13) | (((imm >> 5) & 1) << 12) | (rd << 7) | ((imm & 0x1F) << 2) | op);
+}
+
+// CR format: funct4 | rd/rs1 | rs2 | op
+static uint16_t encodeCR(uint32_t funct4, uint32_t rd, uint32_t rs2) {
+    return (uint16_t)((funct4 << 12) | (rd << 7) | (rs2 << 2) | 0b10);
+}
+
+bool compressInstruction(const vector<string>& tokens, const unordered_map<string, uint32_t>& regMap, uint16_t& code) {
+    vector<string> t = tokens;
+    if (t.empty())
+        return false;
+    if (t[0] == "nop")
+        t = { "addi", "x0", "x0", "0" };
+    else if (t[0] == "mv" && t.size() == 3)
+        t = { "addi", t[1], t[2], "0" };
+
+    string inst = t[0];
+    uint32_t rd, rs1, rs2;
+    int32_t imm;
+
+    if (inst == "ebreak") {
+        code = 0x9002;
+        return true;
+    }
+
+    if (inst == "addi" && t.size() == 4 && lookupReg(regMap, t[1], rd) && lookupReg(regMap, t[2], rs1) && parseImm(t[3], imm)) {
+        if (rd == 0 && rs1 == 0 && imm == 0) {                      // c.nop
+            code = 0x0001;
+            return true;
+        }
+        if (rd != 0 && imm == 0 && rs1 != 0) {                       // c.mv
+            code = encodeCR(0b1000, rd, rs1);
+            return true;
+        }
+        if (rd != 0 && rs1 == rd && imm != 0 && fits(imm, 6)) {     // c.addi
+            code = encodeCI(0b000, rd, imm, 0b01);
+            return true;
+        }
+        if (rd != 0 && rs1 == 0 && fits(imm, 6)) {                   // c.li
+            code = encodeCI(0b010, rd, imm, 0b01);
+            return true;
+        }
+        if (rd == 2 && rs1 == 2 && imm != 0 && (imm & 0xF) == 0 && fits(imm, 10)) {    // c.addi16sp
+            code = (uint16_t)((0b011 << 13) | (((imm >> 9) & 1) << 12) | (2 << 7) | (((imm >> 4) & 1) << 6)
+                | (((imm >> 6) & 1) << 5) | (((imm >> 7) & 0x3) << 3) | (((imm >> 5) & 1) << 2) | 0b01);
+            return true;
+        }
+        if (isCompressedReg(rd) && rs1 == 2 && imm > 0 && imm < 1024 && (imm & 0x3) == 0) {    // c.addi4spn
+            code = (uint16_t)((((imm >> 4) & 0x3) << 11) | (((imm >> 6) & 0xF) << 7) | (((imm >> 2) & 1) << 6)
+                | (((imm >> 3) & 1) << 5) | ((rd - 8) << 2));
+            return true;
+        }
+        return false;
+    }
+
+    if (inst == "lui" && t.size() == 3 && lookupReg(regMap, t[1], rd) && parseImm(t[2], imm)) {
+        int32_t upper = (int32_t)((uint32_t)imm << 12) >> 12;   // 20-bit field, sign-extended
+        if (rd != 0 && rd != 2 && upper != 0 && fits(upper, 6)) {   // c.lui
+            code = encodeCI(0b011, rd, upper, 0b01);
+            return true;
+        }
+        return false;
+    }
+
+    if ((inst == "slli" || inst == "srli" || inst == "srai" || inst == "andi") && t.size() == 4
+        && lookupReg(regMap, t[1], rd) && lookupReg(regMap, t[2], rs1) && parseImm(t[3], imm) && rd == rs1) {
+        if (inst == "slli" && rd != 0 && imm > 0 && imm < 32) {    // c.slli
+            code = encodeCI(0b000, rd, imm, 0b10);
+            return true;
+        }
+        if (!isCompressedReg(rd))
+            return false;
+        if ((inst == "srli" || inst == "srai") && imm > 0 && imm < 32) {    // c.srli / c.srai
+            uint32_t funct2 = (inst == "srli") ? 0b00 : 0b01;
+            code = (uint16_t)((0b100 << 13) | (funct2 << 10) | ((rd - 8) << 7) | (imm << 2) | 0b01);
+            return true;
+        }
+        if (inst == "andi" && fits(imm, 6)) {                        // c.andi
+            code = (uint16_t)((0b100 << 13) | (((imm >> 5) & 1) << 12) | (0b10 << 10) | ((rd - 8) << 7)
+                | ((imm & 0x1F) << 2) | 0b01);
+            return true;
+        }
+        return false;
+    }
+
+    if ((inst == "add" || inst == "sub" || inst == "xor" || inst == "or" || inst == "and") && t.size() == 4
+        && lookupReg(regMap, t[1], rd) && lookupReg(regMap, t[2], rs1) && lookupReg(regMap, t[3], rs2)) {
+        if (inst == "add") {
+            if (rd == 0)
+                return false;
+            if (rs1 == 0 && rs2 != 0) {                              // c.mv
+                code = encodeCR(0b1000, rd, rs2);
+                return true;
+            }
+            if (rs1 == rd && rs2 != 0) {                             // c.add
+                code = encodeCR(0b1001, rd, rs2);
+                return true;
+            }
+            if (rs2 == rd && rs1 != 0) {
+                code = encodeCR(0b1001, rd, rs1);
+                return true;
+            }
+            return false;
+        }
+        if (rd != rs1 || !isCompressedReg(rd) || !isCompressedReg(rs2))
+            return false;
+        uint32_t funct2 = (inst == "sub") ? 0b00 : (inst == "xor") ? 0b01 : (inst == "or") ? 0b10 : 0b11;
+        code = (uint16_t)((0b100011 << 10) | ((rd - 8) << 7) | (funct2 << 5) | ((rs2 - 8) << 2) | 0b01);
+        return true;
+    }
+
+    if ((inst == "lw" || inst == "sw") && t.size() == 4
+        && lookupReg(regMap, t[1], rd) && lookupReg(regMap, t[2], rs1) && parseImm(t[3], imm)) {
+        if (imm < 0 || (imm & 0x3) != 0)
+            return false;
+        if (rs1 == 2 && imm < 256) {
+            if (inst == "lw" && rd != 0) {                           // c.lwsp
+                code = (uint16_t)((0b010 << 13) | (((imm >> 5) & 1) << 12) | (rd << 7)
+                    | (((imm >> 2) & 0x7) << 4) | (((imm >> 6) & 0x3) << 2) | 0b10);
+                return true;
+            }
+            if (inst == "sw") {                                      // c.swsp
+                code = (uint16_t)((0b110 << 13) | (((imm >> 2) & 0xF) << 9) | (((imm >> 6) & 0x3) << 7)
+                    | (rd << 2) | 0b10);
+                return true;
+            }
+        }
+        if (isCompressedReg(rd) && isCompressedReg(rs1) && imm < 128) {    // c.lw / c.sw
+            uint32_t funct3 = (inst == "lw") ? 0b010 : 0b110;
+            code = (uint16_t)((funct3 << 13) | (((imm >> 3) & 0x7) << 10) | ((rs1 - 8) << 7)
+                | (((imm >> 2) & 1) << 6) | (((imm >> 6) & 1) << 5) | ((rd - 8) << 2));
+            return true;
+        }
+        return false;
+    }
+
+    if (inst == "jalr" && t.size() == 4 && lookupReg(regMap, t[1], rd) && lookupReg(regMap, t[2], rs1)
+        && parseImm(t[3], imm) && imm == 0 && rs1 != 0) {
+        if (rd == 0) {                                               // c.jr
+            code = encodeCR(0b1000, rs1, 0);
+            return true;
+        }
+        if (rd == 1) {                                               // c.jalr
+            code = encodeCR(0b1001, rs1, 0);
+            return true;
+        }
+    }
+    return false;
+}
@@ -9,16 +9,23 @@
 #include <string>
 #include <cstdint>
 #include <stdexcept>
+#include "symboltable.h"
 using namespace std;
-class SymbolTable {
-public:
-    unordered_map<string, uint32_t> table;
-    SymbolTable() = default;
-    void addLabel(const string& label, uint32_t address);
-    bool hasLabel(const string& label) const;
-    uint32_t getAddress(const string& label) const;
-};
 
-uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const SymbolTable& sym, unordered_map<string, uint32_t> regMap);
+// label, when given, is the interned id of the branch or jump target; the
+// label operand is then not looked up by name.
+uint32_t encodeInstruction(const vector<string>& tokens, uint32_t address, const SymbolTable& sym, const unordered_map<string, uint32_t>& regMap, uint32_t label = SymbolTable::NO_SYMBOL);
+
+// "%hi(sym)", "%lo(sym)", "%pcrel_hi(sym)", "%pcrel_lo(sym)": the relocation
+// operators accepted as immediates of lui/auipc and I-type instructions.
+bool parseRelocation(const string& operand, string& kind, string& symbol);
+
+// The name the assembler accepts for a CSR number, or empty if it has none.
+string csrName(uint32_t number);
+
+// Chooses a 16-bit RV32C form for the instruction if its operands fit one.
+// Label-relative branches and jumps are never compressed, so the size of an
+// instruction is known before any label has been resolved.
+bool compressInstruction(const vector<string>& tokens, const unordered_map<string, uint32_t>& regMap, uint16_t& code);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,389 @@
+﻿#include "simulator.h"
+#include <cfenv>
+#include <cmath>
+#include <cstring>
+
+const uint32_t CANONICAL_NAN = 0x7FC00000;
+
+// fflags bits
+const uint32_t FFLAG_NX = 0x01;
+const uint32_t FFLAG_UF = 0x02;
+const uint32_t FFLAG_OF = 0x04;
+const uint32_t FFLAG_DZ = 0x08;
+const uint32_t FFLAG_NV = 0x10;
+
+// Rounding modes (frm / instruction rm field)
+const uint32_t RM_RNE = 0;
+const uint32_t RM_RTZ = 1;
+const uint32_t RM_RDN = 2;
+const uint32_t RM_RUP = 3;
+const uint32_t RM_RMM = 4;
+const uint32_t RM_DYN = 7;
+
+static float as_float(uint32_t bits)
+{
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint32_t as_bits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+static bool is_nan(uint32_t bits)
+{
+    return (bits & 0x7F800000) == 0x7F800000 && (bits & 0x007FFFFF) != 0;
+}
+
+static bool is_snan(uint32_t bits)
+{
+    return is_nan(bits) && !(bits & 0x00400000);
+}
+
+static uint32_t canonicalize(float f)
+{
+    uint32_t bits = as_bits(f);
+    return is_nan(bits) ? CANONICAL_NAN : bits;
+}
+
+static uint32_t host_flags_to_fflags()
+{
+    uint32_t flags = 0;
+    if (fetestexcept(FE_INEXACT))   flags |= FFLAG_NX;
+    if (fetestexcept(FE_UNDERFLOW)) flags |= FFLAG_UF;
+    if (fetestexcept(FE_OVERFLOW))  flags |= FFLAG_OF;
+    if (fetestexcept(FE_DIVBYZERO)) flags |= FFLAG_DZ;
+    if (fetestexcept(FE_INVALID))   flags |= FFLAG_NV;
+    return flags;
+}
+
+// fclass.s result bit for each category
+static uint32_t classify(uint32_t bits)
+{
+    bool sign = bits >> 31;
+    uint32_t exp = (bits >> 23) & 0xFF;
+    uint32_t frac = bits & 0x7FFFFF;
+    if (exp == 0xFF)
+    {
+        if (frac == 0) return sign ? 1u << 0 : 1u << 7;          // -inf / +inf
+        return (frac & 0x400000) ? 1u << 9 : 1u << 8;            // quiet / signaling NaN
+    }
+    if (exp == 0)
+    {
+        if (frac == 0) return sign ? 1u << 3 : 1u << 4;          // -0 / +0
+        return sign ? 1u << 2 : 1u << 5;                         // subnormal
+    }
+    return sign ? 1u << 1 : 1u << 6;                             // normal
+}
+
+// Selects the host rounding mode for a guest rm (after resolving DYN).
+// The mode belongs to the host thread, not to this simulator, so it is
+// compared with fegetround() and fesetround is only called when it differs.
+// RMM has no host equivalent and runs as round-to-nearest-even except in
+// conversions to integer, which handle it exactly. Returns false for a
+// reserved mode.
+bool Simulator::set_host_rounding(uint32_t rm)
+{
+    if (rm == RM_DYN)
+        rm = frm;
+    if (rm > RM_RMM)
+        return false;
+    int mode;
+    switch (rm)
+    {
+    case RM_RTZ: mode = FE_TOWARDZERO; break;
+    case RM_RDN: mode = FE_DOWNWARD; break;
+    case RM_RUP: mode = FE_UPWARD; break;
+    default:     mode = FE_TONEAREST; break;
+    }
+    if (fegetround() != mode)
+        fesetround(mode);
+    return true;
+}
+
+// Returns true if the instruction is illegal (the simulator halts).
+template <class Observe>
+bool Simulator::F_type(uint32_t instr)
+{
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t rm = (instr >> 12) & 0x7;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    uint32_t funct7 = instr >> 25;
+
+    // Instructions whose funct3 is a rounding mode
+    bool usesRm = (funct7 == 0x00 || funct7 == 0x04 || funct7 == 0x08 || funct7 == 0x0C ||
+                   funct7 == 0x2C || funct7 == 0x60 || funct7 == 0x68);
+    if (usesRm && !set_host_rounding(rm))
+        return true;
+    uint32_t effectiveRm = (rm == RM_DYN) ? frm : rm;
+
+    // Cycle 4: A ← f[rs1] (or x[rs1]), B ← f[rs2]
+    clk++;
+    bool intSource = (funct7 == 0x68 || funct7 == 0x78);
+    A.write(intSource ? regfile[rs1].read() : read_freg(rs1));
+    B.write(read_freg(rs2));
+    print_state();
+
+    // Cycle 5: ALUOut ← result on the host FPU
+    clk++;
+    uint32_t a = A.read();
+    uint32_t b = B.read();
+    volatile float fa = as_float(a);
+    volatile float fb = as_float(b);
+    uint32_t result = 0;
+    bool toIntReg = false;
+    uint32_t flags = 0;
+    feclearexcept(FE_ALL_EXCEPT);
+
+    switch (funct7)
+    {
+    case 0x00: result = canonicalize(fa + fb); flags = host_flags_to_fflags(); break;    // fadd.s
+    case 0x04: result = canonicalize(fa - fb); flags = host_flags_to_fflags(); break;    // fsub.s
+    case 0x08: result = canonicalize(fa * fb); flags = host_flags_to_fflags(); break;    // fmul.s
+    case 0x0C: result = canonicalize(fa / fb); flags = host_flags_to_fflags(); break;    // fdiv.s
+    case 0x2C:                                                                           // fsqrt.s
+        if (rs2 != 0) return true;
+        result = canonicalize(sqrtf(fa));
+        flags = host_flags_to_fflags();
+        break;
+
+    case 0x10:  // fsgnj.s / fsgnjn.s / fsgnjx.s operate on raw bits
+        if (rm == 0)      result = (a & 0x7FFFFFFF) | (b & 0x80000000);
+        else if (rm == 1) result = (a & 0x7FFFFFFF) | (~b & 0x80000000);
+        else if (rm == 2) result = a ^ (b & 0x80000000);
+        else return true;
+        break;
+
+    case 0x14:  // fmin.s / fmax.s: a single NaN operand is ignored, -0 < +0
+    {
+        if (rm > 1) return true;
+        if (is_snan(a) || is_snan(b)) flags |= FFLAG_NV;
+        if (is_nan(a) && is_nan(b)) result = CANONICAL_NAN;
+        else if (is_nan(a)) result = b;
+        else if (is_nan(b)) result = a;
+        else
+        {
+            bool aLess = (fa < fb) || (fa == fb && (a >> 31) && !(b >> 31));
+            result = (rm == 0) == aLess ? a : b;
+        }
+        break;
+    }
+
+    case 0x50:  // fle.s / flt.s (signaling) and feq.s (quiet)
+        toIntReg = true;
+        if (rm == 2)
+        {
+            if (is_snan(a) || is_snan(b)) flags |= FFLAG_NV;
+            result = (!is_nan(a) && !is_nan(b) && fa == fb);
+        }
+        else if (rm == 1 || rm == 0)
+        {
+            if (is_nan(a) || is_nan(b)) { flags |= FFLAG_NV; result = 0; }
+            else result = (rm == 1) ? (fa < fb) : (fa <= fb);
+        }
+        else return true;
+        break;
+
+    case 0x60:  // fcvt.w.s / fcvt.wu.s: round per rm, saturate and raise NV when out of range
+    {
+        toIntReg = true;
+        float rounded = (effectiveRm == RM_RMM) ? roundf(fa) : nearbyintf(fa);
+        if (rs2 == 0)
+        {
+            if (is_nan(a) || rounded >= 2147483648.0f) { result = INT32_MAX; flags |= FFLAG_NV; }
+            else if (rounded < -2147483648.0f) { result = uint32_t(INT32_MIN); flags |= FFLAG_NV; }
+            else { result = uint32_t(int32_t(rounded)); if (rounded != fa) flags |= FFLAG_NX; }
+        }
+        else if (rs2 == 1)
+        {
+            if (is_nan(a) || rounded >= 4294967296.0f) { result = UINT32_MAX; flags |= FFLAG_NV; }
+            else if (rounded <= -1.0f) { result = 0; flags |= FFLAG_NV; }
+            else { result = uint32_t(rounded); if (rounded != fa) flags |= FFLAG_NX; }
+        }
+        else return true;
+        break;
+    }
+
+    case 0x68:  // fcvt.s.w / fcvt.s.wu (A holds the integer source)
+        if (rs2 == 0) result = as_bits(float(int32_t(a)));
+        else if (rs2 == 1) result = as_bits(float(a));
+        else return true;
+        flags = host_flags_to_fflags();
+        break;
+
+    case 0x70:  // fmv.x.w / fclass.s
+        if (rs2 != 0) return true;
+        toIntReg = true;
+        if (rm == 0) result = a;
+        else if (rm == 1) result = classify(a);
+        else return true;
+        break;
+
+    case 0x78:  // fmv.w.x
+        if (rs2 != 0 || rm != 0) return true;
+        result = a;
+        break;
+
+    default:
+        return true;
+    }
+    fflags |= flags;
+    ALUOut.write(result);
+    print_state();
+
+    // Cycle 6: write-back to the FP or integer register file
+    clk++;
+    if (toIntReg)
+    {
+        if (rd != 0)
+            write_back<Observe>(rd, ALUOut.read());
+    }
+    else
+        write_freg(rd, ALUOut.read());
+    print_state();
+    reset_clk();
+    return false;
+}
+
+template bool Simulator::F_type<Observed>(uint32_t);
+template bool Simulator::F_type<Unobserved>(uint32_t);
+
+// fmadd.s / fmsub.s / fnmsub.s / fnmadd.s with a single rounding via fmaf.
+bool Simulator::F_fma(uint32_t instr, uint32_t opcode)
+{
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t rm = (instr >> 12) & 0x7;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    uint32_t fmt = (instr >> 25) & 0x3;
+    uint32_t rs3 = instr >> 27;
+    if (fmt != 0 || !set_host_rounding(rm))
+        return true;
+
+    // Cycle 4: A ← f[rs1], B ← f[rs2] (f[rs3] is read alongside)
+    clk++;
+    A.write(read_freg(rs1));
+    B.write(read_freg(rs2));
+    uint32_t c = read_freg(rs3);
+    print_state();
+
+    // Cycle 5: ALUOut ← ±(A × B) ± C
+    clk++;
+    volatile float fa = as_float(A.read());
+    volatile float fb = as_float(B.read());
+    volatile float fc = as_float(c);
+    feclearexcept(FE_ALL_EXCEPT);
+    float r;
+    switch (opcode)
+    {
+    case 0x43: r = fmaf(fa, fb, fc); break;      // fmadd.s
+    case 0x47: r = fmaf(fa, fb, -fc); break;     // fmsub.s
+    case 0x4B: r = fmaf(-fa, fb, fc); break;     // fnmsub.s
+    default:   r = fmaf(-fa, fb, -fc); break;    // fnmadd.s
+    }
+    fflags |= host_flags_to_fflags();
+    ALUOut.write(canonicalize(r));
+    print_state();
+
+    // Cycle 6: f[rd] ← ALUOut
+    clk++;
+    write_freg(rd, ALUOut.read());
+    print_state();
+    reset_clk();
+    return false;
+}
+
+// flw: same cycles as lw, written NaN-boxed into f[rd]
+template <class Observe>
+void Simulator::F_load(uint32_t instr)
+{
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    int32_t imm = int32_t(instr) >> 20;
+
+    clk++;
+    A.write(regfile[rs1].read());
+    B.write(imm);
+    print_state();
+
+    clk++;
+    ALUOut.write(A.read() + B.read());
+    print_state();
+
+    clk++;
+    MAR.write(ALUOut.read());
+    print_state();
+
+    clk++;
+    {
+        uint32_t addr = MAR.read();
+        uint32_t idxW = (addr & ~0x3) / 4;
+        uint32_t dataW = (idxW < MEM_SIZE) ? mem[idxW] : 0;
+        MDR.write(dataW);
+        if (is_watched(idxW))
+            check_watch(addr, 4, false, dataW);
+        if constexpr (Observe::enabled)
+            note_memory(addr, dataW, 4, false);
+    }
+    print_state();
+
+    clk++;
+    write_freg(rd, MDR.read());
+    print_state();
+    reset_clk();
+}
+
+template void Simulator::F_load<Observed>(uint32_t);
+template void Simulator::F_load<Unobserved>(uint32_t);
+
+// fsw: same cycles as sw, storing the low 32 bits of f[rs2]
+template <class Observe>
+void Simulator::F_store(uint32_t instr)
+{
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    int32_t imm = ((instr >> 25) << 5) | ((instr >> 7) & 0x1F);
+    imm = (imm << 20) >> 20;
+
+    clk++;
+    A.write(regfile[rs1].read());
+    B.write(imm);
+    print_state();
+
+    clk++;
+    ALUOut.write(A.read() + B.read());
+    print_state();
+
+    clk++;
+    MAR.write(ALUOut.read());
+    print_state();
+
+    clk++;
+    MDR.write(uint32_t(fregs[rs2]));
+    print_state();
+
+    clk++;
+    {
+        uint32_t addr = MAR.read();
+        uint32_t addrWord = (addr & ~0x3u) / 4;
+        if (addrWord < MEM_SIZE)
+        {
+            mem[addrWord] = MDR.read();
+            mark_dirty(addrWord);
+            if (is_watched(addrWord))
+                check_watch(addr, 4, true, MDR.read());
+        }
+        if constexpr (Observe::enabled)
+            note_memory(addr, MDR.read(), 4, true);
+    }
+    print_state();
+    reset_clk();
+}
+
+template void Simulator::F_store<Observed>(uint32_t);
+template void Simulator::F_store<Unobserved>(uint32_t);
@@ -0,0 +1,193 @@
+﻿#include "simulator.h"
+
+// ───────────── Macro-op fusion ─────────────
+// A fused pair executes with the sequential semantics of its two
+// instructions but in one dispatch and without the micro-cycles; the
+// A/B/ALUOut registers are not updated. Entries are keyed by the address of
+// the first instruction, so a branch straight to the second one simply
+// looks up that address and runs it on its own.
+
+static const char* const fusion_names[FUSE_COUNT] = {
+    "lui+addi", "auipc+jalr", "slli+add", "addi+bne", "lw+lw"
+};
+
+void Simulator::set_fusion(bool enabled)
+{
+    fusion = enabled;
+    if (enabled && fusion_cache.empty())
+        fusion_cache.assign(MEM_SIZE * 2, FusedPair{});
+}
+
+// The instruction at addr as it reaches IR: RVC parcels are expanded.
+uint32_t Simulator::fetch_expanded(uint32_t addr, uint8_t& size) const
+{
+    uint32_t parcel = read_half(addr);
+    if ((parcel & 0x3) != 0x3)
+    {
+        size = 2;
+        return expand_compressed(uint16_t(parcel));
+    }
+    size = 4;
+    return parcel | (read_half(addr + 2) << 16);
+}
+
+void Simulator::decode_pair(uint32_t pc, FusedPair& e) const
+{
+    uint32_t first = fetch_expanded(pc, e.size1);
+    uint32_t pc2 = pc + e.size1;
+    uint32_t second = fetch_expanded(pc2, e.size2);
+    e.raw1 = (e.size1 == 2) ? read_half(pc) : read_word(pc);
+    e.raw2 = (e.size2 == 2) ? read_half(pc2) : read_word(pc2);
+    e.lead = FUSE_NONE;
+    e.fuses = false;
+
+    uint32_t opcode = first & 0x7F;
+    uint32_t funct3 = (first >> 12) & 0x7;
+    e.rd1 = (first >> 7) & 0x1F;
+    e.rs1 = (first >> 15) & 0x1F;
+    if (e.rd1 == 0)
+        return;
+    if (opcode == 0x37)
+        e.lead = FUSE_LUI_ADDI;
+    else if (opcode == 0x17)
+        e.lead = FUSE_AUIPC_JALR;
+    else if (opcode == 0x13 && funct3 == 0x1 && (first >> 25) == 0)
+        e.lead = FUSE_SLLI_ADD;
+    else if (opcode == 0x13 && funct3 == 0x0)
+        e.lead = FUSE_ADDI_BNE;
+    else if (opcode == 0x03 && funct3 == 0x2 && e.rd1 != e.rs1)
+        e.lead = FUSE_LW_LW;
+    else
+        return;
+    e.cycles = uint8_t(instruction_cycles(first) + instruction_cycles(second));
+    if (e.lead == FUSE_LUI_ADDI || e.lead == FUSE_AUIPC_JALR)
+        e.imm1 = int32_t(first & 0xFFFFF000);
+    else if (e.lead == FUSE_SLLI_ADD)
+        e.imm1 = (first >> 20) & 0x1F;
+    else
+        e.imm1 = int32_t(first) >> 20;
+
+    uint32_t opcode2 = second & 0x7F;
+    uint32_t funct3_2 = (second >> 12) & 0x7;
+    e.rd2 = (second >> 7) & 0x1F;
+    e.rs2a = (second >> 15) & 0x1F;
+    e.rs2b = (second >> 20) & 0x1F;
+    e.imm2 = int32_t(second) >> 20;
+    bool uses = (e.rs2a == e.rd1 || e.rs2b == e.rd1);
+    switch (e.lead)
+    {
+    case FUSE_LUI_ADDI:
+        e.fuses = opcode2 == 0x13 && funct3_2 == 0x0 && e.rs2a == e.rd1;
+        break;
+    case FUSE_AUIPC_JALR:
+        e.fuses = opcode2 == 0x67 && funct3_2 == 0x0 && e.rs2a == e.rd1;
+        break;
+    case FUSE_SLLI_ADD:
+        e.fuses = opcode2 == 0x33 && funct3_2 == 0x0 && (second >> 25) == 0 && uses;
+        break;
+    case FUSE_ADDI_BNE:
+        e.fuses = opcode2 == 0x63 && funct3_2 == 0x1 && uses;
+        e.imm2 = (((second >> 31) & 0x1) << 12) | (((second >> 7) & 0x1) << 11)
+               | (((second >> 25) & 0x3F) << 5) | (((second >> 8) & 0xF) << 1);
+        e.imm2 = (e.imm2 << 19) >> 19;
+        break;
+    case FUSE_LW_LW:
+        e.fuses = opcode2 == 0x03 && funct3_2 == 0x2 && e.rs2a == e.rs1;
+        break;
+    }
+}
+
+// Runs the instruction pair at PC as one superinstruction. Returns false,
+// having changed nothing, when the instruction at PC does not start a
+// fusable pair; step() then executes it normally.
+bool Simulator::fused_step()
+{
+    // A device event due after the first instruction is serviced before the
+    // second, so an interrupt sees exactly the state it would unfused.
+    if (mtime + 1 >= next_event)
+        return false;
+    uint32_t pc = PC.read();
+    uint32_t slot = pc >> 1;
+    if ((pc & 1) || slot >= fusion_cache.size())
+        return false;
+
+    FusedPair& e = fusion_cache[slot];
+    uint32_t pc2 = pc + e.size1;
+    if (e.size1 == 0 || e.raw1 != ((e.size1 == 2) ? read_half(pc) : read_word(pc)))
+        decode_pair(pc, e);
+    else if (e.lead != FUSE_NONE && e.raw2 != ((e.size2 == 2) ? read_half(pc2) : read_word(pc2)))
+        decode_pair(pc, e);     // a store rewrote the second instruction
+    if (e.lead == FUSE_NONE)
+        return false;
+
+    fusion_leads[e.lead]++;
+    pc2 = pc + e.size1;
+    if (!e.fuses || is_breakpoint(pc2))
+        return false;
+
+    auto reg = [&](int r) { return regfile[r].read(); };
+    auto set = [&](int r, uint32_t v) { if (r != 0) regfile[r].write(v); };
+    uint32_t next = pc2 + e.size2;
+    switch (e.lead)
+    {
+    case FUSE_LUI_ADDI:
+        set(e.rd1, e.imm1);
+        set(e.rd2, reg(e.rs2a) + e.imm2);
+        break;
+    case FUSE_AUIPC_JALR:
+    {
+        set(e.rd1, pc + e.imm1);
+        uint32_t target = (reg(e.rs2a) + e.imm2) & ~1u;
+        set(e.rd2, next);
+        next = target;
+        break;
+    }
+    case FUSE_SLLI_ADD:
+        set(e.rd1, reg(e.rs1) << e.imm1);
+        set(e.rd2, reg(e.rs2a) + reg(e.rs2b));
+        break;
+    case FUSE_ADDI_BNE:
+        set(e.rd1, reg(e.rs1) + e.imm1);
+        if (reg(e.rs2a) != reg(e.rs2b))
+            next = pc2 + e.imm2;
+        break;
+    case FUSE_LW_LW:
+    {
+        // Both loads use the same base, which the first does not overwrite.
+        uint32_t addr1 = reg(e.rs1) + e.imm1;
+        uint32_t addr2 = reg(e.rs1) + e.imm2;
+        if (is_watched((addr1 & ~0x3) / 4) || is_watched((addr2 & ~0x3) / 4))
+            return false;
+        set(e.rd1, load<HeadlessPolicy>(addr1, 0x2));
+        set(e.rd2, load<HeadlessPolicy>(addr2, 0x2));
+        break;
+    }
+    }
+    inst_pc = pc2;
+    PC.write(next);
+    cycle_count += e.cycles;
+    fusion_hits[e.lead]++;
+    return true;
+}
+
+void Simulator::print_fusion_report(ostream& out) const
+{
+    uint64_t leads = 0, hits = 0;
+    for (int i = 0; i < FUSE_COUNT; i++)
+    {
+        leads += fusion_leads[i];
+        hits += fusion_hits[i];
+    }
+    // Built separately so the stream's fill and precision are left alone.
+    ostringstream ss;
+    auto line = [&](const char* name, uint64_t fused, uint64_t seen) {
+        ss << "fusion: " << left << setw(11) << name << right << fused << "/" << seen;
+        if (seen != 0)
+            ss << " (" << fixed << setprecision(1) << 100.0 * fused / seen << "%)";
+        ss << "\n";
+    };
+    for (int i = 0; i < FUSE_COUNT; i++)
+        line(fusion_names[i], fusion_hits[i], fusion_leads[i]);
+    line("total", hits, leads);
+    out << ss.str();
+}
@@ -0,0 +1,313 @@
+﻿#include "simulator.h"
+#include "refmodel.h"
+#include <random>
+#include <memory>
+#include <iomanip>
+using namespace std;
+
+// Differential fuzzer: random RV32IM blocks are run in lockstep on the
+// Simulator and on the independent RefModel, and the architectural state is
+// compared after every instruction. A failing case is minimised before it is
+// printed.
+//
+//   fuzz [--seed N] [--cases N] [--length N] [--keep-going] [--unchecked]
+//
+// --unchecked runs the simulator through run_unchecked(); every case keeps
+// its accesses inside guest memory, so it must match run() exactly.
+
+// Memory layout of a case: loads and stores address the data window with
+// base x0, so the code block sits just above it where jalr x0 can reach it.
+const uint32_t DATA_BYTES = 0x400;
+const uint32_t CODE_START = 0x400;
+const uint32_t MAX_LENGTH = (0x800 - CODE_START) / 4;
+const uint32_t NOP = 0x00000013;
+
+struct FuzzCase
+{
+    uint32_t regs[32];
+    vector<uint32_t> data;      // DATA_BYTES / 4 words
+    vector<uint32_t> code;
+};
+
+struct Divergence
+{
+    bool found = false;
+    size_t index = 0;           // instruction in code that diverged
+    string what;
+};
+
+class Generator
+{
+public:
+    explicit Generator(uint64_t seed) : rng(seed) {}
+
+    FuzzCase make(uint32_t length)
+    {
+        FuzzCase c;
+        c.regs[0] = 0;
+        for (int i = 1; i < 32; i++)
+            c.regs[i] = value();
+        c.data.resize(DATA_BYTES / 4);
+        for (auto& w : c.data)
+            w = uint32_t(rng());
+        for (uint32_t i = 0; i < length; i++)
+            c.code.push_back(instruction(i, length));
+        return c;
+    }
+
+private:
+    mt19937_64 rng;
+
+    uint32_t below(uint32_t n) { return uint32_t(rng() % n); }
+
+    // Boundary values are over-represented; they are where bugs live.
+    uint32_t value()
+    {
+        static const uint32_t special[] = { 0, 1, 2, 0xFFFFFFFF, 0x80000000, 0x7FFFFFFF, 0x7FF, 0x800, 31, 32 };
+        if (below(3) == 0)
+            return special[below(sizeof(special) / sizeof(special[0]))];
+        return uint32_t(rng());
+    }
+
+    // A few registers are favoured so that results feed later operands.
+    uint32_t reg() { return below(4) == 0 ? below(32) : 1 + below(6); }
+
+    uint32_t instruction(uint32_t index, uint32_t length)
+    {
+        const vector<RefOp>& ops = ref_ops();
+        const RefOp& op = ops[below(uint32_t(ops.size()))];
+        uint32_t rd = reg(), rs1 = reg(), rs2 = reg();
+        uint32_t instr = op.match;
+        // Forward targets inside the block (or just past its end)
+        uint32_t target = (index + 1 + below(length - index)) * 4;
+
+        switch (op.format)
+        {
+        case RefFormat::R:
+            return instr | (rs2 << 20) | (rs1 << 15) | (rd << 7);
+        case RefFormat::I:
+            return instr | (uint32_t(value() & 0xFFF) << 20) | (rs1 << 15) | (rd << 7);
+        case RefFormat::Shift:
+            return instr | (below(32) << 20) | (rs1 << 15) | (rd << 7);
+        case RefFormat::Load:
+            return instr | ((below(DATA_BYTES) & ~(op.width - 1)) << 20) | (rd << 7);
+        case RefFormat::Store:
+        {
+            uint32_t imm = below(DATA_BYTES) & ~(op.width - 1);
+            return instr | ((imm >> 5) << 25) | (rs2 << 20) | ((imm & 0x1F) << 7);
+        }
+        case RefFormat::Branch:
+        {
+            uint32_t imm = target - index * 4;
+            return instr | ((imm >> 12) << 31) | (((imm >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15)
+                | (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 1) << 7);
+        }
+        case RefFormat::Lui:
+        case RefFormat::Auipc:
+            return instr | (value() << 12) | (rd << 7);
+        case RefFormat::Jal:
+        {
+            uint32_t imm = target - index * 4;
+            return instr | (((imm >> 1) & 0x3FF) << 21) | (((imm >> 11) & 1) << 20) | (rd << 7);
+        }
+        case RefFormat::Jalr:
+            // Absolute target through x0; occasionally through a random register
+            if (below(8) == 0)
+                return instr | (value() << 20) | (rs1 << 15) | (rd << 7);
+            return instr | ((CODE_START + target) << 20) | (rd << 7);
+        }
+        return NOP;
+    }
+};
+
+static string hex32(uint32_t v)
+{
+    ostringstream out;
+    out << "0x" << hex << setw(8) << setfill('0') << v;
+    return out.str();
+}
+
+// Runs a case on both engines until control leaves the block, returning the
+// first difference in pc, registers or the word touched by a store.
+// Simulator::run, or run_unchecked with --unchecked.
+static StopReason (Simulator::*run_one)(uint64_t, bool) = &Simulator::run;
+
+static Divergence run_case(Simulator& sim, RefModel& ref, const FuzzCase& c, uint64_t& executed)
+{
+    Divergence d;
+    uint32_t codeEnd = CODE_START + uint32_t(c.code.size()) * 4;
+    for (int i = 0; i < 32; i++)
+    {
+        sim.set_reg(i, c.regs[i]);
+        ref.x[i] = c.regs[i];
+    }
+    for (uint32_t i = 0; i < c.data.size(); i++)
+    {
+        sim.writeWord(c.data[i], i * 4);
+        ref.store(i * 4, 4, c.data[i]);
+    }
+    for (uint32_t i = 0; i < c.code.size(); i++)
+    {
+        sim.writeWord(c.code[i], CODE_START + i * 4);
+        ref.store(CODE_START + i * 4, 4, c.code[i]);
+    }
+    sim.set_pc(CODE_START);
+    ref.pc = CODE_START;
+
+    // Branches and jal only go forward, but jalr through a link register can
+    // loop, so the number of steps is bounded as well. A jalr target that is
+    // only halfword aligned also ends the case: the reference model has no
+    // compressed instructions.
+    uint32_t budget = uint32_t(c.code.size()) * 4;
+    while (ref.pc >= CODE_START && ref.pc < codeEnd && (ref.pc & 3) == 0 && budget-- != 0)
+    {
+        d.index = (ref.pc - CODE_START) / 4;
+        if (!ref.step())
+        {
+            d.found = true;
+            d.what = "reference model rejected the instruction";
+            return d;
+        }
+        executed++;
+        if ((sim.*run_one)(1, true) == StopReason::Halted)
+        {
+            d.found = true;
+            d.what = "simulator halted";
+            return d;
+        }
+        if (sim.get_pc() != ref.pc)
+        {
+            d.found = true;
+            d.what = "pc: ref " + hex32(ref.pc) + " sim " + hex32(sim.get_pc());
+            return d;
+        }
+        for (int r = 1; r < 32; r++)
+        {
+            if (sim.get_reg(r) != ref.x[r])
+            {
+                d.found = true;
+                d.what = "x" + to_string(r) + ": ref " + hex32(ref.x[r]) + " sim " + hex32(sim.get_reg(r));
+                return d;
+            }
+        }
+        if (ref.last_store_addr != ~0u)
+        {
+            uint32_t want = ref.load(ref.last_store_addr, 4);
+            uint32_t got = sim.read_word(ref.last_store_addr);
+            if (want != got)
+            {
+                d.found = true;
+                d.what = "mem[" + hex32(ref.last_store_addr) + "]: ref " + hex32(want) + " sim " + hex32(got);
+                return d;
+            }
+        }
+    }
+    return d;
+}
+
+// Replaces instructions with nops and zeroes registers for as long as the
+// case keeps diverging. Nops keep every branch offset valid.
+static FuzzCase minimise(Simulator& sim, RefModel& ref, FuzzCase c)
+{
+    uint64_t ignored = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 0; i < c.code.size(); i++)
+        {
+            if (c.code[i] == NOP)
+                continue;
+            FuzzCase trial = c;
+            trial.code[i] = NOP;
+            if (run_case(sim, ref, trial, ignored).found)
+            {
+                c = trial;
+                changed = true;
+            }
+        }
+        for (int r = 1; r < 32; r++)
+        {
+            if (c.regs[r] == 0)
+                continue;
+            FuzzCase trial = c;
+            trial.regs[r] = 0;
+            if (run_case(sim, ref, trial, ignored).found)
+            {
+                c = trial;
+                changed = true;
+            }
+        }
+    }
+    // Trailing nops add nothing to the report, unless control lands on them.
+    FuzzCase trimmed = c;
+    while (trimmed.code.size() > 1 && trimmed.code.back() == NOP)
+        trimmed.code.pop_back();
+    return run_case(sim, ref, trimmed, ignored).found ? trimmed : c;
+}
+
+static void report(Simulator& sim, RefModel& ref, const FuzzCase& c, uint64_t caseNumber)
+{
+    uint64_t ignored = 0;
+    Divergence d = run_case(sim, ref, c, ignored);
+    cout << "DIVERGENCE in case " << caseNumber << ": " << d.what << "\n";
+    cout << "  initial registers:";
+    for (int r = 1; r < 32; r++)
+        if (c.regs[r] != 0)
+            cout << " x" << r << "=" << hex32(c.regs[r]);
+    cout << "\n";
+    for (size_t i = 0; i < c.code.size(); i++)
+    {
+        if (c.code[i] == NOP && i != d.index)
+            continue;
+        cout << (i == d.index ? "  > " : "    ") << hex32(CODE_START + uint32_t(i) * 4) << ": "
+             << hex32(c.code[i]) << "  " << RefModel::disassemble(c.code[i]) << "\n";
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t seed = random_device{}();
+    uint64_t cases = 100000;
+    uint32_t length = 32;
+    bool keepGoing = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--seed" && i + 1 < argc)
+            seed = stoull(argv[++i]);
+        else if (arg == "--cases" && i + 1 < argc)
+            cases = stoull(argv[++i]);
+        else if (arg == "--length" && i + 1 < argc)
+            length = min<uint32_t>(max(1ul, stoul(argv[++i])), MAX_LENGTH);
+        else if (arg == "--keep-going")
+            keepGoing = true;
+        else if (arg == "--unchecked")
+            run_one = &Simulator::run_unchecked;
+    }
+
+    auto sim = make_unique<Simulator>();
+    RefModel ref(MEM_SIZE * 4);
+    Generator gen(seed);
+    uint64_t executed = 0;
+    uint64_t failures = 0;
+    cout << "seed " << seed << ", " << cases << " cases of " << length << " instructions\n";
+
+    auto begin = chrono::steady_clock::now();
+    for (uint64_t n = 0; n < cases; n++)
+    {
+        FuzzCase c = gen.make(length);
+        if (!run_case(*sim, ref, c, executed).found)
+            continue;
+        failures++;
+        report(*sim, ref, minimise(*sim, ref, c), n);
+        if (!keepGoing)
+            break;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    cout << executed << " instructions in " << fixed << setprecision(2) << seconds << " s ("
+         << setprecision(1) << (seconds > 0 ? executed / seconds / 1e6 : 0.0) << " M/s), "
+         << failures << " divergence(s)\n";
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,425 @@
+﻿#include "gdbstub.h"
+#ifdef _WIN32
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+typedef int socklen_t;
+#define CLOSE_SOCKET closesocket
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#define CLOSE_SOCKET close
+#endif
+
+// Instructions executed between checks for a Ctrl-C from gdb while continuing.
+const uint64_t GDB_RUN_CHUNK = 1 << 16;
+
+static const char* target_xml =
+    "<?xml version=\"1.0\"?>"
+    "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+    "<target version=\"1.0\">"
+    "<architecture>riscv:rv32</architecture>"
+    "<feature name=\"org.gnu.gdb.riscv.cpu\">"
+    "<reg name=\"zero\" bitsize=\"32\" type=\"int\" regnum=\"0\"/>"
+    "<reg name=\"ra\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "<reg name=\"sp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"gp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"tp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"t0\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"fp\" bitsize=\"32\" type=\"data_ptr\"/>"
+    "<reg name=\"s1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a0\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a1\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"a7\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s2\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s7\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s8\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s9\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s10\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"s11\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t3\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t4\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t5\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"t6\" bitsize=\"32\" type=\"int\"/>"
+    "<reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>"
+    "</feature>"
+    "</target>";
+
+static string to_hex_le(uint32_t v)
+{
+    static const char* digits = "0123456789abcdef";
+    string out;
+    for (int i = 0; i < 4; i++)
+    {
+        uint8_t b = uint8_t(v >> (i * 8));
+        out += digits[b >> 4];
+        out += digits[b & 0xF];
+    }
+    return out;
+}
+
+static uint32_t from_hex_le(const string& s)
+{
+    uint32_t v = 0;
+    for (size_t i = 0; i + 1 < s.size() && i < 8; i += 2)
+        v |= uint32_t(stoul(s.substr(i, 2), nullptr, 16)) << (i * 4);
+    return v;
+}
+
+GdbStub::GdbStub(Simulator& simulator, int _port)
+    : sim(simulator), port(_port), listen_fd(-1), client_fd(-1), no_ack(false), start_no_ack(false)
+{
+#ifdef _WIN32
+    WSADATA wsa;
+    WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+}
+
+GdbStub::~GdbStub()
+{
+    if (client_fd >= 0)
+        CLOSE_SOCKET(client_fd);
+    if (listen_fd >= 0)
+        CLOSE_SOCKET(listen_fd);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void GdbStub::serve()
+{
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        throw runtime_error("Cannot create gdb socket");
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(uint16_t(port));
+    if (::bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 1) < 0)
+        throw runtime_error("Cannot listen on gdb port " + to_string(port));
+
+    cout << "\033[1;91mWaiting for gdb on localhost:" << dec << port << "...\033[0m\n";
+    client_fd = accept(listen_fd, nullptr, nullptr);
+    if (client_fd < 0)
+        throw runtime_error("gdb accept failed");
+
+    string packet;
+    bool detach = false;
+    while (!detach && read_packet(packet))
+    {
+        // A malformed packet gets an error reply instead of ending the session.
+        string reply;
+        try
+        {
+            reply = handle(packet, detach);
+        }
+        catch (const exception&)
+        {
+            reply = "E01";
+        }
+        if (packet == "k")
+            break;      // kill has no reply
+        send_packet(reply);
+        // No-ack mode starts once the OK to QStartNoAckMode has gone out.
+        if (start_no_ack)
+            no_ack = true;
+    }
+}
+
+// Reads one "$data#cs" packet, acknowledging it unless no-ack mode is on.
+// Stray Ctrl-C bytes between packets are ignored.
+bool GdbStub::read_packet(string& packet)
+{
+    while (true)
+    {
+        size_t start = inbuf.find('$');
+        size_t hash = (start == string::npos) ? string::npos : inbuf.find('#', start);
+        if (hash != string::npos && hash + 2 < inbuf.size())
+        {
+            packet = inbuf.substr(start + 1, hash - start - 1);
+            inbuf.erase(0, hash + 3);
+            if (!no_ack)
+                ::send(client_fd, "+", 1, 0);
+            return true;
+        }
+
+        char buf[4096];
+        int n = recv(client_fd, buf, sizeof(buf), 0);
+        if (n <= 0)
+            return false;
+        inbuf.append(buf, n);
+    }
+}
+
+void GdbStub::send_packet(const string& data)
+{
+    uint8_t sum = 0;
+    for (char c : data)
+        sum += uint8_t(c);
+    stringstream ss;
+    ss << '$' << data << '#' << hex << setw(2) << setfill('0') << int(sum);
+    string out = ss.str();
+    ::send(client_fd, out.data(), int(out.size()), 0);
+}
+
+// Non-blocking check for the 0x03 interrupt byte gdb sends on Ctrl-C.
+bool GdbStub::interrupt_pending()
+{
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(client_fd, &fds);
+    timeval tv = { 0, 0 };
+    if (select(int(client_fd + 1), &fds, nullptr, nullptr, &tv) <= 0)
+        return false;
+
+    char buf[4096];
+    int n = recv(client_fd, buf, sizeof(buf), 0);
+    if (n <= 0)
+        return true;
+    inbuf.append(buf, n);
+    size_t pos = inbuf.find('\x03');
+    if (pos == string::npos)
+        return false;
+    inbuf.erase(pos, 1);
+    return true;
+}
+
+string GdbStub::handle(const string& packet, bool& detach)
+{
+    if (packet.empty())
+        return "";
+
+    switch (packet[0])
+    {
+    case '?':
+        return "S05";
+    case 'g':
+        return read_registers();
+    case 'G':
+        for (int i = 0; i < 33 && size_t(i * 8 + 9) <= packet.size(); i++)
+        {
+            uint32_t v = from_hex_le(packet.substr(1 + i * 8, 8));
+            if (i == 32) sim.set_pc(v);
+            else sim.set_reg(i, v);
+        }
+        return "OK";
+    case 'p':
+    {
+        uint32_t n = stoul(packet.substr(1), nullptr, 16);
+        if (n < 32) return to_hex_le(sim.get_reg(n));
+        if (n == 32) return to_hex_le(sim.get_pc());
+        return "E01";
+    }
+    case 'P':
+    {
+        size_t eq = packet.find('=');
+        uint32_t n = stoul(packet.substr(1, eq - 1), nullptr, 16);
+        uint32_t v = from_hex_le(packet.substr(eq + 1));
+        if (n < 32) sim.set_reg(n, v);
+        else if (n == 32) sim.set_pc(v);
+        else return "E01";
+        return "OK";
+    }
+    case 'm':
+    {
+        size_t comma = packet.find(',');
+        uint32_t addr = stoul(packet.substr(1, comma - 1), nullptr, 16);
+        uint32_t len = stoul(packet.substr(comma + 1), nullptr, 16);
+        return read_memory(addr, len);
+    }
+    case 'M':
+    {
+        size_t comma = packet.find(',');
+        size_t colon = packet.find(':');
+        uint32_t addr = stoul(packet.substr(1, comma - 1), nullptr, 16);
+        return write_memory(addr, packet.substr(colon + 1));
+    }
+    case 'c':
+        if (packet.size() > 1) sim.set_pc(stoul(packet.substr(1), nullptr, 16));
+        return resume(false);
+    case 's':
+        if (packet.size() > 1) sim.set_pc(stoul(packet.substr(1), nullptr, 16));
+        return resume(true);
+    case 'Z':
+        return breakpoint_packet(packet, true);
+    case 'z':
+        return breakpoint_packet(packet, false);
+    case 'H':
+        return "OK";
+    case 'T':
+        return "OK";
+    case 'D':
+        detach = true;
+        return "OK";
+    case 'k':
+        detach = true;
+        return "";
+    }
+
+    if (packet == "vCont?")
+        return "vCont;c;C;s;S";
+    if (packet.compare(0, 6, "vCont;") == 0)
+    {
+        // Single-threaded target: the first action decides the resume mode.
+        char action = packet.size() > 6 ? packet[6] : 'c';
+        return resume(action == 's' || action == 'S');
+    }
+    if (packet.compare(0, 10, "qSupported") == 0)
+        return "PacketSize=4000;qXfer:features:read+;QStartNoAckMode+;swbreak+;hwbreak+;vContSupported+";
+    if (packet == "QStartNoAckMode")
+    {
+        start_no_ack = true;
+        return "OK";
+    }
+    if (packet.compare(0, 31, "qXfer:features:read:target.xml:") == 0)
+    {
+        size_t comma = packet.find(',', 31);
+        uint32_t offset = stoul(packet.substr(31, comma - 31), nullptr, 16);
+        uint32_t len = stoul(packet.substr(comma + 1), nullptr, 16);
+        string xml = target_xml;
+        if (offset >= xml.size())
+            return "l";
+        string chunk = xml.substr(offset, len);
+        return (offset + chunk.size() >= xml.size() ? "l" : "m") + chunk;
+    }
+    if (packet == "qAttached")
+        return "1";
+    if (packet == "qC")
+        return "QC1";
+    if (packet == "qfThreadInfo")
+        return "m1";
+    if (packet == "qsThreadInfo")
+        return "l";
+
+    // Unsupported packets get an empty reply.
+    return "";
+}
+
+string GdbStub::resume(bool singleStep)
+{
+    if (singleStep)
+    {
+        return stop_reply(sim.run(1));
+    }
+
+    bool first = true;
+    while (true)
+    {
+        StopReason r = sim.run(GDB_RUN_CHUNK, first);
+        first = false;
+        if (r != StopReason::Limit)
+            return stop_reply(r);
+        if (interrupt_pending())
+            return "S02";
+    }
+}
+
+string GdbStub::stop_reply(StopReason reason)
+{
+    if (reason == StopReason::Halted)
+    {
+        stringstream ss;
+        ss << 'W' << hex << setw(2) << setfill('0') << (sim.exit_code() & 0xFF);
+        return ss.str();
+    }
+    if (reason == StopReason::Watchpoint)
+    {
+        stringstream ss;
+        ss << "T05" << (sim.last_watch_was_write() ? "watch" : "rwatch") << ':'
+            << hex << sim.last_watch_addr() << ';';
+        return ss.str();
+    }
+    if (reason == StopReason::Breakpoint)
+        return "T05swbreak:;";
+    return "S05";       // a completed single step
+}
+
+string GdbStub::read_registers() const
+{
+    string out;
+    for (int i = 0; i < 32; i++)
+        out += to_hex_le(sim.get_reg(i));
+    out += to_hex_le(sim.get_pc());
+    return out;
+}
+
+string GdbStub::read_memory(uint32_t addr, uint32_t len) const
+{
+    static const char* digits = "0123456789abcdef";
+    string out;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint8_t b;
+        if (!sim.readByte(addr + i, b))
+            return out.empty() ? "E14" : out;
+        out += digits[b >> 4];
+        out += digits[b & 0xF];
+    }
+    return out;
+}
+
+string GdbStub::write_memory(uint32_t addr, const string& hexData)
+{
+    for (size_t i = 0; i + 1 < hexData.size(); i += 2)
+    {
+        uint8_t dummy;
+        if (!sim.readByte(addr, dummy))
+            return "E14";
+        sim.writeByte(uint8_t(stoul(hexData.substr(i, 2), nullptr, 16)), addr++);
+    }
+    return "OK";
+}
+
+// Z/z type,addr,kind: 0/1 are code breakpoints, 2/3/4 write/read/access
+// watchpoints. Both map onto the simulator's bitmaps, so guest memory is
+// never patched with ebreak.
+string GdbStub::breakpoint_packet(const string& packet, bool insert)
+{
+    size_t c1 = packet.find(',');
+    size_t c2 = packet.find(',', c1 + 1);
+    if (c1 == string::npos || c2 == string::npos)
+        return "E01";
+    int type = packet[1] - '0';
+    uint32_t addr = stoul(packet.substr(c1 + 1, c2 - c1 - 1), nullptr, 16);
+    uint32_t kind = stoul(packet.substr(c2 + 1), nullptr, 16);
+
+    try
+    {
+        if (type == 0 || type == 1)
+        {
+            if (insert) sim.add_breakpoint(addr);
+            else sim.remove_breakpoint(addr);
+            return "OK";
+        }
+        if (type >= 2 && type <= 4)
+        {
+            bool onWrite = (type == 2 || type == 4);
+            bool onRead = (type == 3 || type == 4);
+            uint32_t end = addr + (kind ? kind : 1) - 1;
+            if (insert) sim.add_watchpoint({ addr, end, onRead, onWrite, false, 0 });
+            else sim.remove_watchpoint(addr, end, onRead, onWrite);
+            return "OK";
+        }
+    }
+    catch (const exception&)
+    {
+        return "E22";
+    }
+    return "";
+}
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+#include "simulator.h"
+
+// Minimal GDB remote serial protocol server. It listens on a local TCP port,
+// accepts one debugger connection and drives the simulator headless, so
+// `continue` runs at full speed and only stops on breakpoints, watchpoints,
+// halt or a Ctrl-C from gdb.
+class GdbStub
+{
+    Simulator& sim;
+    int port;
+    intptr_t listen_fd;
+    intptr_t client_fd;
+    bool no_ack;
+    bool start_no_ack;
+    string inbuf;
+
+    bool read_packet(string& packet);
+    void send_packet(const string& data);
+    bool interrupt_pending();
+    string handle(const string& packet, bool& detach);
+    string resume(bool singleStep);
+    string stop_reply(StopReason reason);
+    string read_registers() const;
+    string read_memory(uint32_t addr, uint32_t len) const;
+    string write_memory(uint32_t addr, const string& hexData);
+    string breakpoint_packet(const string& packet, bool insert);
+public:
+    GdbStub(Simulator& simulator, int port);
+    ~GdbStub();
+    void serve();
+};
+
+#endif
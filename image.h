@@ -0,0 +1,39 @@
+#pragma once
+#ifndef IMAGE_H
+#define IMAGE_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+// An assembled program in memory: runs of bytes at their load addresses and
+// the address execution starts at. This is what the assembler produces and
+// Simulator::load_image consumes, so no file is involved in between.
+
+struct ImageChunk
+{
+    uint32_t address;
+    vector<uint8_t> bytes;
+};
+
+struct ProgramImage
+{
+    uint32_t entry = 0x1000;
+    vector<ImageChunk> chunks;
+
+    // Appends to the last chunk when the bytes follow on from it.
+    void write(uint32_t address, const uint8_t* data, size_t size)
+    {
+        if (chunks.empty() || chunks.back().address + chunks.back().bytes.size() != address)
+            chunks.push_back({ address, {} });
+        chunks.back().bytes.insert(chunks.back().bytes.end(), data, data + size);
+    }
+
+    void write_le(uint32_t address, uint32_t value, size_t size)
+    {
+        uint8_t bytes[4] = { uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24) };
+        write(address, bytes, size);
+    }
+};
+
+#endif
@@ -1,170 +1,169 @@
-﻿#include "encoder.h"
+﻿#include "asmcache.h"
+#include "disasm.h"
 #include "simulator.h"
+#include "gdbstub.h"
+#include <unistd.h>
 using namespace std;
 
-// === Utility Functions ===
-string trim(const string& s) {
-    size_t start = s.find_first_not_of(" \t\n\r");
-    size_t end = s.find_last_not_of(" \t\n\r");
-    return (start == string::npos) ? "" : s.substr(start, end - start + 1);
-}
-string remove_commas(const string& s) {
-    string result;
-    for (char c : s) if (c != ',') result += c;
-    return result;
-}
-vector<string> split(const string& s, char delimiter) {
-    vector<string> tokens;
-    string token;
-    istringstream ss(s);
-    while (getline(ss, token, delimiter)) {
-        tokens.push_back(trim(token));
-    }
-    return tokens;
-}
-pair<string, string> parseMemoryOperand(const string& operand) {
-    size_t open = operand.find('(');
-    size_t close = operand.find(')');
-    if (open == string::npos || close == string::npos || close <= open)
-        throw runtime_error("Invalid memory operand: " + operand);
-    string imm = operand.substr(0, open);
-    string reg = operand.substr(open + 1, close - open - 1);
-    return { trim(imm), trim(reg) };
-}
-unordered_map<string, uint32_t> regMap = {
-    {"x0", 0}, {"x1", 1}, {"x2", 2}, {"x3", 3}, {"x4", 4}, {"x5", 5},
-    {"x6", 6}, {"x7", 7}, {"x8", 8}, {"x9", 9}, {"x10", 10}, {"x11", 11},
-    {"x12", 12}, {"x13", 13}, {"x14", 14}, {"x15", 15}, {"x16", 16}, {"x17", 17},
-    {"x18", 18}, {"x19", 19}, {"x20", 20}, {"x21", 21}, {"x22", 22}, {"x23", 23},
-    {"x24", 24}, {"x25", 25}, {"x26", 26}, {"x27", 27}, {"x28", 28}, {"x29", 29},
-    {"x30", 30}, {"x31", 31}
-};
+// --check-cycles: runs the program headless on the fast engine, then again
+// instruction by instruction on the staged one checking the cost table
+// against the cycles the handlers step, and compares the two totals. Piped
+// guest input is read up front so that both runs see the same; a terminal
+// is not read, the guest sees end of input. Only the first run's output is
+// shown.
+static int checkCycles(const AssembledProgram& program, uint32_t vlen, const string& sandboxDir, bool fusion) {
+    stringstream input;
+    if (!isatty(STDIN_FILENO))
+        input << cin.rdbuf();
 
-int main() {
-    SymbolTable symbolTable;
-    vector<string> instructions;
-    uint32_t address = 0x1000;
-    ifstream infile("input.asm");
-    string line;
-    Simulator simulator;
+    Simulator fast;
+    fast.set_vlen(vlen);
+    fast.load_image(program.image);
+    fast.set_sandbox(sandboxDir);
+    fast.set_fusion(fusion);
+    istringstream fastIn(input.str());
+    fast.set_console(&fastIn, &cout, &cerr);
+    auto start = chrono::steady_clock::now();
+    fast.run(UINT64_MAX, false);
+    double fastMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-    // ─────[ Pass 1: Label Parsing and Directives ]─────
-    while (getline(infile, line)) {
-        line = trim(line);
-        if (line.empty() || line[0] == '#') 
-            continue;
+    Simulator stepped;
+    stepped.set_vlen(vlen);
+    stepped.load_image(program.image);
+    stepped.set_sandbox(sandboxDir);
+    istringstream steppedIn(input.str());
+    ostringstream discard;
+    stepped.set_console(&steppedIn, &discard, &discard);
+    start = chrono::steady_clock::now();
+    CycleCheck check = stepped.check_cycles(UINT64_MAX);
+    double steppedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
 
-        if (line.find(':') != string::npos) {
-            string label = trim(line.substr(0, line.find(':')));
-            symbolTable.addLabel(label, address);
-            line = trim(line.substr(line.find(':') + 1));
-            if (line.empty()) 
-                continue;
-        }
+    if (!check.match) {
+        cout << "cycles: instruction " << check.instructions << " at 0x" << hex << check.pc
+            << " (0x" << setw(8) << setfill('0') << check.instr << setfill(' ') << dec << ") stepped "
+            << check.stepped << " cycles, the table charged " << check.table << endl;
+        return 1;
+    }
+    cout << fixed << setprecision(1) << "cycles: " << fast.cycles() << " in " << fastMs << " ms, "
+        << stepped.cycles() << " stepped in " << steppedMs << " ms over " << check.instructions << " instructions";
+    if (fast.cycles() != stepped.cycles()) {
+        cout << ": MISMATCH" << endl;
+        return 1;
+    }
+    cout << ": match" << endl;
+    return fast.exit_code();
+}
 
-        if (line[0] == '.') {
-            vector<string> tokens = split(line, ' ');
-            string directive = tokens[0];
+int main(int argc, char* argv[]) {
+    // --gdb <port>: serve the GDB remote protocol instead of the interactive run
+    // --sandbox <dir>: directory the guest's openat() is confined to
+    // --no-rvc: never emit 16-bit compressed instructions
+    // --vlen <bits>: vector register length for the V extension
+    // --cache <dir>: reuse the assembled image of an identical earlier source
+    // --stream: assemble stdin to hex on stdout with bounded memory, no simulation
+    // --peephole: remove redundant instructions and report the savings
+    // --fusion: fuse common instruction pairs in run-until-break mode and report the hit rate
+    // --listing: also write output.lst, the annotated listing with static cycle costs
+    // --check-cycles: verify the cycle cost table against the micro-stepped handlers
+    int gdbPort = 0;
+    uint32_t vlen = DEFAULT_VLEN;
+    string sandboxDir = ".";
+    bool useRvc = true;
+    string cacheDir;
+    bool stream = false;
+    bool optimize = false;
+    bool fusion = false;
+    bool listing = false;
+    bool cycleCheck = false;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--gdb" && i + 1 < argc)
+            gdbPort = stoi(argv[++i]);
+        else if (arg == "--sandbox" && i + 1 < argc)
+            sandboxDir = argv[++i];
+        else if (arg == "--no-rvc")
+            useRvc = false;
+        else if (arg == "--vlen" && i + 1 < argc)
+            vlen = stoul(argv[++i]);
+        else if (arg == "--cache" && i + 1 < argc)
+            cacheDir = argv[++i];
+        else if (arg == "--stream")
+            stream = true;
+        else if (arg == "--peephole")
+            optimize = true;
+        else if (arg == "--fusion")
+            fusion = true;
+        else if (arg == "--listing")
+            listing = true;
+        else if (arg == "--check-cycles")
+            cycleCheck = true;
+    }
 
-            if (directive == ".org") {
-                address = stoul(tokens[1], nullptr, 0);
-            }
-            else if (directive == ".word") {
-                simulator.writeWord(stoul(tokens[1], nullptr, 0), address);
-                address += 4;
-            }
-            else if (directive == ".half") {
-                simulator.writeHalf((uint16_t)stoul(tokens[1], nullptr, 0), address);
-                address += 2;
-            }
-            else if (directive == ".byte") {
-                simulator.writeByte((uint8_t)stoul(tokens[1], nullptr, 0), address);
-                address += 1;
-            }
-            else if (directive == ".align") {
-                int n = stoul(tokens[1]);
-                uint32_t alignTo = 1 << n;
-                address = (address + alignTo - 1) & ~(alignTo - 1);
-            }
-            continue;
+    AssemblerOptions options;
+    options.compress = useRvc;
+    options.optimize = optimize;
+    if (stream) {
+        StreamingAssembler assembler(cout, options);
+        string line;
+        try {
+            while (getline(cin, line))
+                assembler.feed(line);
+            assembler.finish();
         }
-
-        instructions.push_back(line);
-        address += 4;
+        catch (const exception& e) {
+            cerr << "stdin: " << e.what() << endl;
+            return 1;
+        }
+        return 0;
     }
 
-    // ─────[ Pass 2: Instruction Encoding ]─────
-    ofstream outfile("output.txt");
-    address = 0x1000;
-    ifstream infile2("input.asm");
-    string instr;
-    string working_string;
-    while (getline(infile2, instr)) {
-        working_string = trim(instr);
-        if (working_string.empty() || working_string[0] == '#') 
-            continue;
-        if (working_string.find(':') != string::npos) {
-            working_string = trim(working_string.substr(working_string.find(':') + 1));
-            if (working_string.empty()) 
-                continue;
-        }
+    ifstream infile("input.asm");
+    stringstream source;
+    source << infile.rdbuf();
+    AssembledProgram program;
+    try {
+        if (cacheDir.empty())
+            program = assemble(source.str(), options);
+        else
+            program = *AssemblyCache(1, cacheDir).assemble(source.str(), options);
+    }
+    catch (const exception& e) {
+        cerr << "input.asm: " << e.what() << endl;
+        return 1;
+    }
 
-        if (working_string[0] == '.') {
-            vector<string> tokens = split(working_string, ' ');
-            string directive = tokens[0];
-            if (directive == ".org") {
-                address = stoul(tokens[1], nullptr, 0);
-            }
-            else if (directive == ".word" || directive == ".half" || directive == ".byte") {
-                if (directive == ".word") 
-                    address += 4;
-                else if (directive == ".half") 
-                    address += 2;
-                else if (directive == ".byte") 
-                    address += 1;
-            }
-            else if (directive == ".align") {
-                int n = stoi(tokens[1]);
-                uint32_t alignTo = 1 << n;
-                address = (address + alignTo - 1) & ~(alignTo - 1);
-            }
-            continue;
-        }
-        string inputline = remove_commas(trim(instr));
-        vector<string> tokens = split(inputline, ' ');
-        if (tokens[0] == "li") {
-            uint32_t imm = stoul(tokens[2], nullptr, 0);
-            if (imm <= 0xFFF) {
-                vector<string> newtokens = { "addi",tokens[1],"x0",tokens[2]};
-                uint32_t code = encodeInstruction(newtokens, address, symbolTable, regMap);
-                outfile << hex << setw(8) << setfill('0') << code << endl;
-                continue;
-            }
-            uint32_t upper = imm >> 12;
-            uint32_t lower = imm & 0xFFF;
-            vector<string> newtokens = { "lui",tokens[1],to_string(upper)};
-            uint32_t code = encodeInstruction(newtokens, address, symbolTable, regMap);
-            outfile << hex << setw(8) << setfill('0') << code << endl;
-            vector<string> newtokens2 = { "addi",tokens[1],tokens[1],to_string(lower)};
-            code = encodeInstruction(newtokens2, address, symbolTable, regMap);
-            outfile << hex << setw(8) << setfill('0') << code << endl;
-            continue;
-        }
-        if (tokens.size() == 3 && tokens[2].find('(') != string::npos) {
-            pair<string, string> temp = parseMemoryOperand(tokens[2]);
-            tokens.pop_back();
-            tokens.push_back(temp.second);
-            tokens.push_back(temp.first);
-        }
-;       uint32_t code = encodeInstruction(tokens, address, symbolTable, regMap);
-        outfile << hex << setw(8) << setfill('0') << code << endl;
-        simulator.writeWord(code, address);
-        address += 4;
+    if (optimize) {
+        const PeepholeReport& report = program.peephole;
+        cout << "peephole: " << report.removed << " removed, " << report.rewritten << " rewritten, "
+            << report.retargeted << " retargeted; ~" << report.cycles << " clk cycles saved" << endl;
     }
-    infile2.close();
+
+    ofstream outfile("output.txt");
+    write_hex(outfile, program);
     outfile.close();
+    if (listing) {
+        ofstream lst("output.lst");
+        write_listing(lst, program, source.str());
+    }
+
+    if (cycleCheck)
+        return checkCycles(program, vlen, sandboxDir, fusion);
+
+    Simulator simulator;
+    simulator.set_vlen(vlen);
 
     // ─────[ Pass 3: Simulation ]─────
-    simulator.load_program("output.txt");
+    simulator.load_image(program.image);
+    simulator.set_symbols(program.symbols.to_map());
+    simulator.set_sandbox(sandboxDir);
+    simulator.set_fusion(fusion);
+    if (gdbPort != 0) {
+        GdbStub stub(simulator, gdbPort);
+        stub.serve();
+        return simulator.exit_code();
+    }
     simulator.start();
+    if (fusion)
+        simulator.print_fusion_report(cout);
+    return simulator.exit_code();
 }
\ No newline at end of file
@@ -0,0 +1,132 @@
+﻿#include "simulator.h"
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// A run of at least this many pages that go back to zero is handed to the
+// kernel with madvise rather than cleared word by word.
+const uint32_t DISCARD_MIN_PAGES = 16;
+const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+void Simulator::map_memory()
+{
+    mapped_bytes = size_t(MEM_SIZE) * 4;
+#ifdef _WIN32
+    // Large pages need a privilege most accounts do not have; ordinary
+    // committed pages are zeroed by the system just the same.
+    huge_pages = false;
+    mem = static_cast<uint32_t*>(VirtualAlloc(nullptr, mapped_bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+    if (mem == nullptr)
+        throw runtime_error("Cannot allocate guest memory");
+#else
+    void* p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (huge_pages)
+    {
+        size_t bytes = (mapped_bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+        p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+            mapped_bytes = bytes;
+    }
+#endif
+    if (p == MAP_FAILED)
+    {
+        huge_pages = false;
+        p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (p == MAP_FAILED)
+        throw runtime_error("Cannot allocate guest memory");
+    mem = static_cast<uint32_t*>(p);
+#endif
+}
+
+Simulator::~Simulator()
+{
+    flush_output();
+    while (!guest_fds.empty())
+        sys_close(guest_fds.begin()->first);
+#ifdef _WIN32
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, mapped_bytes);
+#endif
+}
+
+// Zeroes count pages starting at page first.
+void Simulator::clear_pages(uint32_t first, uint32_t count)
+{
+    uint32_t* start = mem + size_t(first) * PAGE_WORDS;
+    size_t bytes = size_t(count) * PAGE_WORDS * 4;
+#ifdef __linux__
+    // Dropping private anonymous pages makes them read back as zeros; with
+    // huge pages that would discard the whole huge page instead.
+    if (!huge_pages && count >= DISCARD_MIN_PAGES && madvise(start, bytes, MADV_DONTNEED) == 0)
+        return;
+#endif
+    memset(start, 0, bytes);
+}
+
+void Simulator::snapshot()
+{
+    pristine.assign(mem, mem + MEM_SIZE);
+    pristine_pages.assign(dirty_pages.size(), 0);
+    for (uint32_t page = 0; page < MEM_SIZE / PAGE_WORDS; page++)
+    {
+        const uint32_t* words = mem + size_t(page) * PAGE_WORDS;
+        if (any_of(words, words + PAGE_WORDS, [](uint32_t w) { return w != 0; }))
+            pristine_pages[page / 64] |= 1ull << (page % 64);
+    }
+    fill(dirty_pages.begin(), dirty_pages.end(), 0);
+    pristine_pc = PC.read();
+    pristine_image_end = image_end;
+}
+
+void Simulator::reset()
+{
+    flush_output();
+    while (!guest_fds.empty())
+        sys_close(guest_fds.begin()->first);
+
+    // Consecutive pages that go back to zero are cleared together so a
+    // large run can be discarded in one call.
+    uint32_t zeroStart = 0, zeroCount = 0;
+    for (uint32_t page = 0; page < MEM_SIZE / PAGE_WORDS; page++)
+    {
+        uint64_t bit = 1ull << (page % 64);
+        if (!(dirty_pages[page / 64] & bit))
+            continue;
+        if (!pristine_pages.empty() && (pristine_pages[page / 64] & bit))
+        {
+            memcpy(mem + size_t(page) * PAGE_WORDS, pristine.data() + size_t(page) * PAGE_WORDS, PAGE_WORDS * 4);
+            continue;
+        }
+        if (zeroCount != 0 && zeroStart + zeroCount == page)
+        {
+            zeroCount++;
+            continue;
+        }
+        if (zeroCount != 0)
+            clear_pages(zeroStart, zeroCount);
+        zeroStart = page;
+        zeroCount = 1;
+    }
+    if (zeroCount != 0)
+        clear_pages(zeroStart, zeroCount);
+
+    fill(dirty_pages.begin(), dirty_pages.end(), 0);
+    reset_state();
+    set_vlen(vlen);
+}
+
+size_t Simulator::dirty_page_count() const
+{
+    size_t count = 0;
+    for (uint64_t bits : dirty_pages)
+        count += bitset<64>(bits).count();
+    return count;
+}
@@ -0,0 +1,63 @@
+﻿#include "simulator.h"
+#include <algorithm>
+
+const uint32_t INSTR_ECALL = 0x00000073;
+const uint32_t INSTR_EBREAK = 0x00100073;
+
+void Simulator::add_observer(SimObserver* observer)
+{
+    if (find(observers.begin(), observers.end(), observer) == observers.end())
+        observers.push_back(observer);
+}
+
+void Simulator::remove_observer(SimObserver* observer)
+{
+    flush_events();
+    observers.erase(remove(observers.begin(), observers.end(), observer), observers.end());
+}
+
+// Called once per instruction of an observed run. An instruction that went
+// to the guest's trap handler was reported by take_trap() and does not
+// retire. Otherwise ecall is serviced by the host and execution continues,
+// so it both traps and retires unless it was the exit call; ebreak and
+// illegal instructions stop the run.
+void Simulator::note_step(bool halted)
+{
+    if (trap_taken)
+    {
+        trap_taken = false;
+    }
+    else
+    {
+        if (inst_word == INSTR_ECALL)
+            trap_events.push_back({ event_seq, inst_pc, CAUSE_ECALL_M });
+        else if (halted)
+            trap_events.push_back({ event_seq, inst_pc, inst_word == INSTR_EBREAK ? CAUSE_BREAKPOINT : CAUSE_ILLEGAL_INSTRUCTION });
+        if (!halted)
+            retire_events.push_back({ event_seq, inst_pc, inst_word });
+    }
+    if (++event_seq % observer_batch == 0)
+        flush_events();
+}
+
+void Simulator::flush_events()
+{
+    for (SimObserver* observer : observers)
+    {
+        if (!retire_events.empty())
+            observer->on_retire(retire_events.data(), retire_events.size());
+        if (!memory_events.empty())
+            observer->on_memory(memory_events.data(), memory_events.size());
+        if (!register_events.empty())
+            observer->on_register(register_events.data(), register_events.size());
+        if (!branch_events.empty())
+            observer->on_branch(branch_events.data(), branch_events.size());
+        if (!trap_events.empty())
+            observer->on_trap(trap_events.data(), trap_events.size());
+    }
+    retire_events.clear();
+    memory_events.clear();
+    register_events.clear();
+    branch_events.clear();
+    trap_events.clear();
+}
@@ -0,0 +1,70 @@
+#pragma once
+#ifndef OBSERVER_H
+#define OBSERVER_H
+#include <cstddef>
+#include <cstdint>
+
+// Events a headless run reports to attached observers. Every event carries
+// seq, the number of the instruction it belongs to (counting from 0 at the
+// first observed instruction), so events of different kinds can be put back
+// in program order.
+
+struct RetireEvent
+{
+    uint64_t seq;
+    uint32_t pc;
+    uint32_t instr;             // as executed: RVC parcels are expanded
+};
+
+struct MemoryEvent
+{
+    uint64_t seq;
+    uint32_t pc;
+    uint32_t addr;
+    uint32_t value;
+    uint8_t size;               // bytes
+    bool write;
+};
+
+struct RegisterEvent
+{
+    uint64_t seq;
+    uint32_t pc;
+    uint32_t reg;               // x1..x31; writes to x0 are not reported
+    uint32_t value;
+};
+
+struct BranchEvent
+{
+    uint64_t seq;
+    uint32_t pc;
+    uint32_t target;            // where a taken branch goes
+    bool taken;
+    bool conditional;           // false for jal and jalr
+};
+
+// cause uses the mcause codes: 2 illegal instruction, 3 ebreak, 11 ecall,
+// and with bit 31 set 3, 7 and 11 for software, timer and external
+// interrupts. For an interrupt pc is where execution resumes after mret.
+struct TrapEvent
+{
+    uint64_t seq;
+    uint32_t pc;
+    uint32_t cause;
+};
+
+// Override the callbacks of interest. Events are buffered and delivered in
+// arrays, one call per kind, every batch of instructions (see
+// Simulator::set_observer_batch) and when a run stops.
+class SimObserver
+{
+public:
+    virtual ~SimObserver() = default;
+    virtual void on_retire(const RetireEvent*, size_t) {}
+    virtual void on_memory(const MemoryEvent*, size_t) {}
+    virtual void on_register(const RegisterEvent*, size_t) {}
+    virtual void on_branch(const BranchEvent*, size_t) {}
+    virtual void on_trap(const TrapEvent*, size_t) {}
+};
+
+#endif
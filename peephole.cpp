@@ -0,0 +1,260 @@
+﻿#include "assembler.h"
+#include "cycles.h"
+#include <algorithm>
+
+// ───────────── Peephole pass ─────────────
+// Runs on the parsed lines before layout, so deleting an instruction just
+// shrinks its line and every label address comes out of the normal pass 1.
+
+static const size_t NONE = ~size_t(0);
+
+static bool reg(const string& name, uint32_t& number) {
+    auto it = regMap.find(name);
+    if (it == regMap.end())
+        return false;
+    number = it->second;
+    return true;
+}
+
+static bool zero(const string& token) {
+    try {
+        size_t used;
+        return stol(token, &used, 0) == 0 && used == token.size();
+    }
+    catch (const exception&) {
+        return false;
+    }
+}
+
+static bool isLoad(const string& inst) {
+    return inst == "lw" || inst == "lh" || inst == "lhu" || inst == "lb" || inst == "lbu";
+}
+
+// Cost in the simulator's multi-cycle model, from the table it charges
+// (cycles.h). The table only looks at the opcode, so a label operand is
+// encoded at the label's own address, where it is always in range. An
+// operand that does not encode is reported by pass 2; it saves nothing.
+static uint32_t cycleCost(const vector<string>& tokens, const SymbolTable& symbols, uint32_t label) {
+    uint32_t address = (label != SymbolTable::NO_SYMBOL) ? symbols.address(label) : 0;
+    try {
+        return instruction_cycles(encodeInstruction(tokens, address, symbols, regMap, label));
+    }
+    catch (const exception&) {
+        return 0;
+    }
+}
+
+// A plain jump, "jal x0, ." encoded.
+static const uint32_t JUMP_CYCLES = instruction_cycles(0x0000006F);
+
+// An instruction that leaves every register as it was: "mv a0, a0",
+// "addi a0, a0, 0" and the like. Writes to x0 are left alone; they are the
+// canonical nop and usually there on purpose.
+static bool isNoOp(const vector<string>& t) {
+    uint32_t rd, rs1, rs2;
+    const string& inst = t[0];
+    if (t.size() < 3 || !reg(t[1], rd) || rd == 0 || !reg(t[2], rs1))
+        return false;
+    if (inst == "mv")
+        return t.size() == 3 && rs1 == rd;
+    if (t.size() != 4)
+        return false;
+    if (inst == "addi" || inst == "ori" || inst == "xori" || inst == "slli" || inst == "srli" || inst == "srai")
+        return rs1 == rd && zero(t[3]);
+    if (!reg(t[3], rs2))
+        return false;
+    if (inst == "add" || inst == "or" || inst == "xor")
+        return (rs1 == rd && rs2 == 0) || (rs1 == 0 && rs2 == rd);
+    if (inst == "sub" || inst == "sll" || inst == "srl" || inst == "sra")
+        return rs1 == rd && rs2 == 0;
+    return false;
+}
+
+// A jump that only transfers control: jal without a link register.
+static bool isPlainJump(const vector<string>& t) {
+    uint32_t rd;
+    return t[0] == "jal" && t.size() == 3 && reg(t[1], rd) && rd == 0;
+}
+
+static bool isBranch(const vector<string>& t) {
+    return isPcRelative(t[0]) && t[0] != "jal";
+}
+
+void IncrementalAssembler::peephole() {
+    PeepholeReport& report = program.peephole;
+    retargets.clear();
+    layout();       // defines every label on its line and binds "1f"/"1b"
+
+    vector<vector<char>> live(lines.size());
+    vector<char> changed(lines.size(), 0);
+    vector<char> retargeted(lines.size(), 0);
+    for (size_t i = 0; i < lines.size(); i++)
+        live[i].assign(lines[i].expanded.size(), 1);
+
+    // First live instruction at or after the start of a line, or NONE when
+    // a directive (data, .org, .align) comes first.
+    auto first = [&](size_t line) -> pair<size_t, size_t> {
+        for (size_t l = line; l < lines.size(); l++) {
+            if (lines[l].directive != DirectiveKind::None)
+                return { NONE, NONE };
+            for (size_t i = 0; i < lines[l].expanded.size(); i++)
+                if (live[l][i])
+                    return { l, i };
+        }
+        return { NONE, NONE };
+    };
+    auto next = [&](size_t line, size_t index) -> pair<size_t, size_t> {
+        for (size_t i = index + 1; i < lines[line].expanded.size(); i++)
+            if (live[line][i])
+                return { line, i };
+        return first(line + 1);
+    };
+    // The label an instruction branches to, if it is defined.
+    auto target = [&](size_t line, size_t index) -> uint32_t {
+        for (const SourceLine::LabelRef& ref : lines[line].refs)
+            if (ref.instruction == index && ref.id != SymbolTable::NO_SYMBOL && program.symbols.defined(ref.id))
+                return ref.id;
+        return SymbolTable::NO_SYMBOL;
+    };
+    auto cost = [&](size_t line, size_t index) {
+        return cycleCost(lines[line].expanded[index], program.symbols, target(line, index));
+    };
+    auto remove = [&](size_t line, size_t index) {
+        live[line][index] = 0;
+        changed[line] = 1;
+        report.removed++;
+        report.cycles += cost(line, index);
+    };
+    auto labelLine = [&](uint32_t id) { return size_t(program.symbols.line(id) - 1); };
+
+    // ─────[ No-op moves and repeated loads, within a basic block ]─────
+    for (size_t l = 0; l < lines.size(); l++) {
+        for (size_t i = 0; i < lines[l].expanded.size(); i++) {
+            vector<string>& a = lines[l].expanded[i];
+            if (isNoOp(a)) {
+                remove(l, i);
+                continue;
+            }
+            uint32_t rd, base;
+            if (!isLoad(a[0]) || a.size() != 4 || !reg(a[1], rd) || !reg(a[2], base) || rd == 0 || rd == base)
+                continue;
+            pair<size_t, size_t> n = next(l, i);
+            if (n.first == NONE)
+                continue;
+            bool labelled = false;
+            for (size_t k = l + 1; k <= n.first && !labelled; k++)
+                labelled = !lines[k].label.empty();
+            vector<string>& b = lines[n.first].expanded[n.second];
+            uint32_t rdB, baseB;
+            if (labelled || b.size() != 4 || b[0] != a[0] || !reg(b[1], rdB) || !reg(b[2], baseB) || baseB != base || b[3] != a[3])
+                continue;
+            if (rdB == rd) {
+                remove(n.first, n.second);
+            }
+            else {
+                uint32_t load = cost(n.first, n.second);
+                b = { "mv", b[1], a[1] };
+                changed[n.first] = 1;
+                report.rewritten++;
+                report.cycles += load - cost(n.first, n.second);
+            }
+        }
+    }
+
+    // ─────[ Jump chains ]─────
+    // A branch or jump whose target is itself "j M" goes straight to M. Only
+    // named labels are followed; "1f"/"1b" have no name to put in the operand.
+    for (size_t l = 0; l < lines.size(); l++) {
+        for (size_t i = 0; i < lines[l].expanded.size(); i++) {
+            vector<string>& a = lines[l].expanded[i];
+            if (!live[l][i] || !isPcRelative(a[0]))
+                continue;
+            uint32_t id = target(l, i);
+            if (id == SymbolTable::NO_SYMBOL)
+                continue;
+            uint32_t final = id;
+            uint32_t hops = 0;
+            vector<uint32_t> seen = { id };
+            for (;;) {
+                pair<size_t, size_t> t = first(labelLine(final));
+                if (t.first == NONE || !isPlainJump(lines[t.first].expanded[t.second]))
+                    break;
+                uint32_t to = target(t.first, t.second);
+                if (to == SymbolTable::NO_SYMBOL || program.symbols.local(to) || find(seen.begin(), seen.end(), to) != seen.end())
+                    break;
+                seen.push_back(to);
+                final = to;
+                hops++;
+            }
+            if (hops == 0)
+                continue;
+            string name(program.symbols.name(final));
+            retargets.push_back({ l, a.back(), hops });
+            a.back() = name;
+            if (!lines[l].pseudo.empty())
+                lines[l].pseudo.back() = name;
+            changed[l] = 1;
+            retargeted[l] = 1;
+            report.retargeted++;
+            report.cycles += JUMP_CYCLES * hops;
+        }
+    }
+
+    // ─────[ Branches to the next instruction ]─────
+    // Retargeted ones are skipped: their refs still name the old label.
+    for (size_t l = 0; l < lines.size(); l++) {
+        for (size_t i = 0; i < lines[l].expanded.size(); i++) {
+            const vector<string>& a = lines[l].expanded[i];
+            if (!live[l][i] || retargeted[l] || !(isBranch(a) || isPlainJump(a)))
+                continue;
+            uint32_t id = target(l, i);
+            if (id == SymbolTable::NO_SYMBOL)
+                continue;
+            pair<size_t, size_t> t = first(labelLine(id));
+            if (t.first != NONE && t == next(l, i))
+                remove(l, i);
+        }
+    }
+
+    for (size_t l = 0; l < lines.size(); l++) {
+        if (!changed[l])
+            continue;
+        SourceLine& line = lines[l];
+        vector<vector<string>> kept;
+        for (size_t i = 0; i < line.expanded.size(); i++)
+            if (live[l][i])
+                kept.push_back(move(line.expanded[i]));
+        if (kept.empty())
+            line.pseudo.clear();      // a removed tail is no longer relaxed
+        setExpansion(line, move(kept));
+    }
+}
+
+// Sending a branch further along a chain can put it out of range; those
+// keep their original label. Their size does not change, so neither does
+// the layout.
+void IncrementalAssembler::checkRetargets() {
+    bool reverted = false;
+    for (const Retarget& retarget : retargets) {
+        SourceLine& line = lines[retarget.line];
+        if (!line.pseudo.empty() || line.expanded.size() != 1)
+            continue;                 // call/tail: relaxation picked a form that reaches
+        const vector<string>& tokens = line.expanded[0];
+        uint32_t id = program.symbols.find(tokens.back());
+        if (id == SymbolTable::NO_SYMBOL || !program.symbols.defined(id))
+            continue;
+        int32_t offset = int32_t(program.symbols.address(id) - line.address);
+        int32_t limit = (tokens[0] == "jal") ? (1 << 20) : 4096;
+        if (offset >= -limit && offset <= limit - 2)
+            continue;
+        vector<vector<string>> expanded = line.expanded;
+        expanded[0].back() = retarget.label;
+        setExpansion(line, move(expanded));
+        program.peephole.retargeted--;
+        program.peephole.cycles -= JUMP_CYCLES * retarget.hops;
+        reverted = true;
+    }
+    retargets.clear();
+    if (reverted)
+        layout();
+}
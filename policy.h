@@ -0,0 +1,61 @@
+#pragma once
+#ifndef POLICY_H
+#define POLICY_H
+
+// Compile-time policies for the execution core. Each handler is written once
+// against a policy bundle and every check below is an `if constexpr`, so an
+// instantiation without tracing, pacing, bounds checks or staging contains
+// none of that code rather than branching around it.
+
+// Display: print the machine state after every micro-cycle.
+struct Trace       { static constexpr bool enabled = true; };
+struct NoTrace     { static constexpr bool enabled = false; };
+
+// Pacing: after each micro-cycle, sleep for the chosen clock period or wait
+// for a key, according to the clock type picked at start-up.
+struct Paced       { static constexpr bool enabled = true; };
+struct Unpaced     { static constexpr bool enabled = false; };
+
+// Memory checking: guest addresses are bounds-checked (outside memory only
+// the CLINT responds; other reads return 0 and writes are dropped) and
+// watchpoints are honoured. Unchecked wraps addresses around guest memory
+// and ignores watchpoints; it is for programs known to stay in bounds and
+// away from the CLINT.
+struct CheckedMemory   { static constexpr bool enabled = true; };
+struct UncheckedMemory { static constexpr bool enabled = false; };
+
+// Staging: the MAR/MDR/IR/A/B/ALUOut micro-registers are written on their
+// cycles, as the interactive view and debugger show them. Unstaged keeps the
+// values in locals; architectural state is identical either way.
+struct Staged      { static constexpr bool enabled = true; };
+struct Unstaged    { static constexpr bool enabled = false; };
+
+// Observation: retire, memory, register, branch and trap events are recorded
+// for the attached SimObserver objects.
+struct Observed    { static constexpr bool enabled = true; };
+struct Unobserved  { static constexpr bool enabled = false; };
+
+template <class DisplayPolicy, class PacingPolicy, class MemoryPolicy, class StagingPolicy,
+          class ObservePolicy = Unobserved>
+struct ExecPolicy
+{
+    using Display = DisplayPolicy;
+    using Pacing = PacingPolicy;
+    using MemCheck = MemoryPolicy;
+    using Staging = StagingPolicy;
+    using Observe = ObservePolicy;
+};
+
+// The clock modes A and M of start().
+using InteractivePolicy = ExecPolicy<Trace, Paced, CheckedMemory, Staged>;
+// Run-until-break mode: headless, but the micro-registers are kept for the
+// state shown when a breakpoint or watchpoint stops the run.
+using DebugPolicy = ExecPolicy<NoTrace, Unpaced, CheckedMemory, Staged>;
+// run(), used by the GDB stub, the fuzzer and embedders.
+using HeadlessPolicy = ExecPolicy<NoTrace, Unpaced, CheckedMemory, Unstaged>;
+// run_unchecked().
+using FastPolicy = ExecPolicy<NoTrace, Unpaced, UncheckedMemory, Unstaged>;
+// run() and run_unchecked() while observers are attached.
+using ObservedPolicy = ExecPolicy<NoTrace, Unpaced, CheckedMemory, Unstaged, Observed>;
+
+#endif
@@ -0,0 +1,43 @@
+﻿#include "pool.h"
+
+SimulatorPool::SimulatorPool(const ProgramImage* image, bool hugePages)
+    : hasImage(image != nullptr), hugePages(hugePages), createdCount(0)
+{
+    if (image)
+        this->image = *image;
+}
+
+SimulatorPool::Lease SimulatorPool::acquire()
+{
+    {
+        lock_guard<mutex> guard(lock);
+        if (!available.empty())
+        {
+            Simulator* sim = available.back().release();
+            available.pop_back();
+            return Lease(sim, Release{ this });
+        }
+        createdCount++;
+    }
+    auto sim = make_unique<Simulator>(hugePages);
+    if (hasImage)
+    {
+        sim->load_image(image);
+        sim->snapshot();
+    }
+    return Lease(sim.release(), Release{ this });
+}
+
+// The reset happens here, outside the lock and on the releasing thread.
+void SimulatorPool::release(Simulator* sim)
+{
+    sim->reset();
+    lock_guard<mutex> guard(lock);
+    available.emplace_back(sim);
+}
+
+size_t SimulatorPool::idle() const
+{
+    lock_guard<mutex> guard(lock);
+    return available.size();
+}
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef POOL_H
+#define POOL_H
+#include "simulator.h"
+#include <memory>
+#include <mutex>
+
+// Reusable simulators for many short runs. A simulator handed back to the
+// pool is reset, which only touches the memory pages its run wrote, instead
+// of being destroyed and mapped again. Safe to share between threads.
+class SimulatorPool
+{
+public:
+    struct Release
+    {
+        SimulatorPool* pool;
+        void operator()(Simulator* sim) const { pool->release(sim); }
+    };
+    // Returns to the pool when it goes out of scope.
+    using Lease = unique_ptr<Simulator, Release>;
+
+    // With an image, every simulator is loaded with it once and snapshotted,
+    // so each lease starts at the program's entry point.
+    explicit SimulatorPool(const ProgramImage* image = nullptr, bool hugePages = false);
+
+    Lease acquire();
+    size_t idle() const;
+    size_t created() const { return createdCount; }
+
+private:
+    mutable mutex lock;
+    vector<unique_ptr<Simulator>> available;
+    ProgramImage image;
+    bool hasImage;
+    bool hugePages;
+    size_t createdCount;
+
+    void release(Simulator* sim);
+};
+
+#endif
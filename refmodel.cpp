@@ -0,0 +1,232 @@
+﻿#include "refmodel.h"
+#include <sstream>
+
+static uint32_t sext(uint32_t value, int bits)
+{
+    return uint32_t(int32_t(value << (32 - bits)) >> (32 - bits));
+}
+
+// ───────────── Operand semantics ─────────────
+static uint32_t op_add(uint32_t a, uint32_t b) { return a + b; }
+static uint32_t op_sub(uint32_t a, uint32_t b) { return a - b; }
+static uint32_t op_sll(uint32_t a, uint32_t b) { return a << (b & 31); }
+static uint32_t op_slt(uint32_t a, uint32_t b) { return int32_t(a) < int32_t(b); }
+static uint32_t op_sltu(uint32_t a, uint32_t b) { return a < b; }
+static uint32_t op_xor(uint32_t a, uint32_t b) { return a ^ b; }
+static uint32_t op_srl(uint32_t a, uint32_t b) { return a >> (b & 31); }
+static uint32_t op_sra(uint32_t a, uint32_t b) { return uint32_t(int32_t(a) >> (b & 31)); }
+static uint32_t op_or(uint32_t a, uint32_t b) { return a | b; }
+static uint32_t op_and(uint32_t a, uint32_t b) { return a & b; }
+
+static uint32_t op_mul(uint32_t a, uint32_t b) { return a * b; }
+static uint32_t op_mulh(uint32_t a, uint32_t b) { return uint32_t((int64_t(int32_t(a)) * int64_t(int32_t(b))) >> 32); }
+static uint32_t op_mulhsu(uint32_t a, uint32_t b) { return uint32_t((int64_t(int32_t(a)) * int64_t(uint64_t(b))) >> 32); }
+static uint32_t op_mulhu(uint32_t a, uint32_t b) { return uint32_t((uint64_t(a) * uint64_t(b)) >> 32); }
+// Division by zero and signed overflow do not trap (ISA manual, table 7.1).
+static uint32_t op_div(uint32_t a, uint32_t b)
+{
+    if (b == 0) return 0xFFFFFFFF;
+    if (a == 0x80000000 && b == 0xFFFFFFFF) return a;
+    return uint32_t(int32_t(a) / int32_t(b));
+}
+static uint32_t op_divu(uint32_t a, uint32_t b) { return b == 0 ? 0xFFFFFFFF : a / b; }
+static uint32_t op_rem(uint32_t a, uint32_t b)
+{
+    if (b == 0) return a;
+    if (a == 0x80000000 && b == 0xFFFFFFFF) return 0;
+    return uint32_t(int32_t(a) % int32_t(b));
+}
+static uint32_t op_remu(uint32_t a, uint32_t b) { return b == 0 ? a : a % b; }
+
+static uint32_t op_beq(uint32_t a, uint32_t b) { return a == b; }
+static uint32_t op_bne(uint32_t a, uint32_t b) { return a != b; }
+static uint32_t op_bge(uint32_t a, uint32_t b) { return int32_t(a) >= int32_t(b); }
+static uint32_t op_bgeu(uint32_t a, uint32_t b) { return a >= b; }
+
+static uint32_t op_lb(uint32_t a, uint32_t) { return sext(a, 8); }
+static uint32_t op_lh(uint32_t a, uint32_t) { return sext(a, 16); }
+static uint32_t op_lw(uint32_t a, uint32_t) { return a; }
+
+const vector<RefOp>& ref_ops()
+{
+    const uint32_t R = 0xFE00707F, I = 0x0000707F, U = 0x0000007F;
+    static const vector<RefOp> ops = {
+        { "lui",    U, 0x00000037, RefFormat::Lui,    0, op_add },
+        { "auipc",  U, 0x00000017, RefFormat::Auipc,  0, op_add },
+        { "jal",    U, 0x0000006F, RefFormat::Jal,    0, op_add },
+        { "jalr",   I, 0x00000067, RefFormat::Jalr,   0, op_add },
+
+        { "beq",    I, 0x00000063, RefFormat::Branch, 0, op_beq },
+        { "bne",    I, 0x00001063, RefFormat::Branch, 0, op_bne },
+        { "blt",    I, 0x00004063, RefFormat::Branch, 0, op_slt },
+        { "bge",    I, 0x00005063, RefFormat::Branch, 0, op_bge },
+        { "bltu",   I, 0x00006063, RefFormat::Branch, 0, op_sltu },
+        { "bgeu",   I, 0x00007063, RefFormat::Branch, 0, op_bgeu },
+
+        { "lb",     I, 0x00000003, RefFormat::Load,   1, op_lb },
+        { "lh",     I, 0x00001003, RefFormat::Load,   2, op_lh },
+        { "lw",     I, 0x00002003, RefFormat::Load,   4, op_lw },
+        { "lbu",    I, 0x00004003, RefFormat::Load,   1, op_lw },
+        { "lhu",    I, 0x00005003, RefFormat::Load,   2, op_lw },
+        { "sb",     I, 0x00000023, RefFormat::Store,  1, nullptr },
+        { "sh",     I, 0x00001023, RefFormat::Store,  2, nullptr },
+        { "sw",     I, 0x00002023, RefFormat::Store,  4, nullptr },
+
+        { "addi",   I, 0x00000013, RefFormat::I,      0, op_add },
+        { "slti",   I, 0x00002013, RefFormat::I,      0, op_slt },
+        { "sltiu",  I, 0x00003013, RefFormat::I,      0, op_sltu },
+        { "xori",   I, 0x00004013, RefFormat::I,      0, op_xor },
+        { "ori",    I, 0x00006013, RefFormat::I,      0, op_or },
+        { "andi",   I, 0x00007013, RefFormat::I,      0, op_and },
+        { "slli",   R, 0x00001013, RefFormat::Shift,  0, op_sll },
+        { "srli",   R, 0x00005013, RefFormat::Shift,  0, op_srl },
+        { "srai",   R, 0x40005013, RefFormat::Shift,  0, op_sra },
+
+        { "add",    R, 0x00000033, RefFormat::R,      0, op_add },
+        { "sub",    R, 0x40000033, RefFormat::R,      0, op_sub },
+        { "sll",    R, 0x00001033, RefFormat::R,      0, op_sll },
+        { "slt",    R, 0x00002033, RefFormat::R,      0, op_slt },
+        { "sltu",   R, 0x00003033, RefFormat::R,      0, op_sltu },
+        { "xor",    R, 0x00004033, RefFormat::R,      0, op_xor },
+        { "srl",    R, 0x00005033, RefFormat::R,      0, op_srl },
+        { "sra",    R, 0x40005033, RefFormat::R,      0, op_sra },
+        { "or",     R, 0x00006033, RefFormat::R,      0, op_or },
+        { "and",    R, 0x00007033, RefFormat::R,      0, op_and },
+
+        { "mul",    R, 0x02000033, RefFormat::R,      0, op_mul },
+        { "mulh",   R, 0x02001033, RefFormat::R,      0, op_mulh },
+        { "mulhsu", R, 0x02002033, RefFormat::R,      0, op_mulhsu },
+        { "mulhu",  R, 0x02003033, RefFormat::R,      0, op_mulhu },
+        { "div",    R, 0x02004033, RefFormat::R,      0, op_div },
+        { "divu",   R, 0x02005033, RefFormat::R,      0, op_divu },
+        { "rem",    R, 0x02006033, RefFormat::R,      0, op_rem },
+        { "remu",   R, 0x02007033, RefFormat::R,      0, op_remu },
+    };
+    return ops;
+}
+
+// ───────────── Immediates ─────────────
+static int32_t imm_i(uint32_t instr) { return int32_t(instr) >> 20; }
+static int32_t imm_s(uint32_t instr) { return int32_t(sext(((instr >> 25) << 5) | ((instr >> 7) & 0x1F), 12)); }
+static int32_t imm_b(uint32_t instr)
+{
+    uint32_t imm = ((instr >> 31) << 12) | (((instr >> 7) & 1) << 11)
+        | (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1);
+    return int32_t(sext(imm, 13));
+}
+static int32_t imm_j(uint32_t instr)
+{
+    uint32_t imm = ((instr >> 31) << 20) | (((instr >> 12) & 0xFF) << 12)
+        | (((instr >> 20) & 1) << 11) | (((instr >> 21) & 0x3FF) << 1);
+    return int32_t(sext(imm, 21));
+}
+
+RefModel::RefModel(uint32_t memBytes) : pc(0), mem(memBytes, 0), last_store_addr(~0u)
+{
+    for (auto& r : x)
+        r = 0;
+}
+
+const RefOp* RefModel::decode(uint32_t instr)
+{
+    for (const RefOp& op : ref_ops())
+        if ((instr & op.mask) == op.match)
+            return &op;
+    return nullptr;
+}
+
+// Little-endian access; bytes outside memory read as zero and ignore writes.
+uint32_t RefModel::load(uint32_t addr, uint32_t width) const
+{
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < width; i++)
+        if (addr + i < mem.size())
+            value |= uint32_t(mem[addr + i]) << (8 * i);
+    return value;
+}
+
+void RefModel::store(uint32_t addr, uint32_t width, uint32_t value)
+{
+    for (uint32_t i = 0; i < width; i++)
+        if (addr + i < mem.size())
+            mem[addr + i] = uint8_t(value >> (8 * i));
+}
+
+bool RefModel::step()
+{
+    uint32_t instr = load(pc, 4);
+    const RefOp* op = decode(instr);
+    if (!op)
+        return false;
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t a = x[(instr >> 15) & 0x1F];
+    uint32_t b = x[(instr >> 20) & 0x1F];
+    uint32_t next = pc + 4;
+    uint32_t result = 0;
+    bool writes = true;
+    last_store_addr = ~0u;
+
+    switch (op->format)
+    {
+    case RefFormat::R:      result = op->fn(a, b); break;
+    case RefFormat::I:      result = op->fn(a, uint32_t(imm_i(instr))); break;
+    case RefFormat::Shift:  result = op->fn(a, (instr >> 20) & 0x1F); break;
+    case RefFormat::Load:   result = op->fn(load(a + imm_i(instr), op->width), 0); break;
+    case RefFormat::Lui:    result = instr & 0xFFFFF000; break;
+    case RefFormat::Auipc:  result = pc + (instr & 0xFFFFF000); break;
+    case RefFormat::Store:
+    {
+        uint32_t addr = a + imm_s(instr);
+        store(addr, op->width, b);
+        last_store_addr = addr & ~3u;
+        writes = false;
+        break;
+    }
+    case RefFormat::Branch:
+        if (op->fn(a, b))
+            next = pc + imm_b(instr);
+        writes = false;
+        break;
+    case RefFormat::Jal:
+        result = pc + 4;
+        next = pc + imm_j(instr);
+        break;
+    case RefFormat::Jalr:
+        result = pc + 4;
+        next = (a + imm_i(instr)) & ~1u;
+        break;
+    }
+    if (writes && rd != 0)
+        x[rd] = result;
+    pc = next;
+    return true;
+}
+
+string RefModel::disassemble(uint32_t instr)
+{
+    const RefOp* op = decode(instr);
+    ostringstream out;
+    if (!op)
+    {
+        out << ".word 0x" << hex << instr;
+        return out.str();
+    }
+    uint32_t rd = (instr >> 7) & 0x1F;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    out << op->name << " ";
+    switch (op->format)
+    {
+    case RefFormat::R:      out << "x" << rd << ", x" << rs1 << ", x" << rs2; break;
+    case RefFormat::I:
+    case RefFormat::Jalr:   out << "x" << rd << ", x" << rs1 << ", " << imm_i(instr); break;
+    case RefFormat::Shift:  out << "x" << rd << ", x" << rs1 << ", " << rs2; break;
+    case RefFormat::Load:   out << "x" << rd << ", " << imm_i(instr) << "(x" << rs1 << ")"; break;
+    case RefFormat::Store:  out << "x" << rs2 << ", " << imm_s(instr) << "(x" << rs1 << ")"; break;
+    case RefFormat::Branch: out << "x" << rs1 << ", x" << rs2 << ", " << imm_b(instr); break;
+    case RefFormat::Lui:
+    case RefFormat::Auipc:  out << "x" << rd << ", 0x" << hex << (instr >> 12); break;
+    case RefFormat::Jal:    out << "x" << rd << ", " << imm_j(instr); break;
+    }
+    return out.str();
+}
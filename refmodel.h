@@ -0,0 +1,60 @@
+#pragma once
+#ifndef REFMODEL_H
+#define REFMODEL_H
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Table-driven RV32IM reference interpreter. It shares no code with the
+// Simulator so the fuzzer can check one against the other: every
+// instruction is described by a mask/match pair, an operand format and a
+// pure function over its operands, straight from the ISA manual.
+
+enum class RefFormat
+{
+    R,          // rd ← fn(x[rs1], x[rs2])
+    I,          // rd ← fn(x[rs1], imm)
+    Shift,      // rd ← fn(x[rs1], shamt)
+    Load,       // rd ← fn(mem[x[rs1] + imm], 0)
+    Store,      // mem[x[rs1] + imm] ← x[rs2]
+    Branch,     // if fn(x[rs1], x[rs2]) pc ← pc + imm
+    Lui,        // rd ← imm
+    Auipc,      // rd ← pc + imm
+    Jal,        // rd ← pc + 4; pc ← pc + imm
+    Jalr        // rd ← pc + 4; pc ← (x[rs1] + imm) & ~1
+};
+
+struct RefOp
+{
+    const char* name;
+    uint32_t mask;
+    uint32_t match;
+    RefFormat format;
+    uint32_t width;                         // bytes accessed by loads and stores
+    uint32_t (*fn)(uint32_t a, uint32_t b);
+};
+
+const vector<RefOp>& ref_ops();
+
+class RefModel
+{
+public:
+    uint32_t x[32];
+    uint32_t pc;
+    vector<uint8_t> mem;
+    uint32_t last_store_addr;               // word address of the last store, or ~0u
+
+    explicit RefModel(uint32_t memBytes);
+
+    static const RefOp* decode(uint32_t instr);
+    static string disassemble(uint32_t instr);
+
+    uint32_t load(uint32_t addr, uint32_t width) const;
+    void store(uint32_t addr, uint32_t width, uint32_t value);
+
+    // Executes the instruction at pc. Returns false if it is not RV32IM.
+    bool step();
+};
+
+#endif
@@ -0,0 +1,445 @@
+﻿#include "assembler.h"
+#include "pool.h"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+using namespace std;
+namespace fs = std::filesystem;
+
+// Regression runner: every .asm file under a directory is assembled and run
+// headless, and its final state is checked against expectations written in
+// the comment header at the top of the file:
+//
+//   # expect: a0 = 42                    register, by ABI or x name
+//   # expect: mem[0x2000] = 1, 2, -3     consecutive words from an address
+//   # expect: mem[table+8] = 0xff        or from a label plus an offset
+//   # expect: exit = 0                   status passed to exit(); 0 after ebreak
+//   # limit: 1000000                     instructions before the test fails
+//   # timeout: 2000                      wall-clock milliseconds
+//
+// A test passes when it halts within its limits and every expectation holds.
+// Tests run in parallel on simulators taken from a pool, so a worker reuses
+// one and only the memory a test wrote is cleared before the next.
+//
+//   regress <dir> [--jobs N] [--limit N] [--timeout MS] [--junit FILE] [--json FILE] [--no-rvc] [--fusion]
+
+const uint64_t SLICE = 1 << 16;         // instructions between timeout checks
+
+struct MemoryExpectation
+{
+    string base;                        // label, or empty for an absolute address
+    uint32_t offset;
+    vector<uint32_t> words;
+};
+
+struct TestCase
+{
+    fs::path path;
+    string name;                        // path relative to the test directory
+    vector<pair<uint32_t, uint32_t>> regs;
+    vector<MemoryExpectation> memory;
+    bool checkExit = false;
+    int exitCode = 0;
+    uint64_t limit;
+    uint32_t timeoutMs;
+};
+
+enum class Outcome { Pass, Fail, Error };
+
+struct TestResult
+{
+    Outcome outcome = Outcome::Pass;
+    vector<string> messages;
+    double seconds = 0;
+    uint64_t instructions = 0;
+    string output;                      // what the guest wrote to stdout and stderr
+};
+
+static uint32_t number(const string& text)
+{
+    string t = trim(text);
+    size_t used;
+    long long v = stoll(t, &used, 0);
+    if (used != t.size())
+        throw runtime_error("bad number '" + t + "'");
+    return uint32_t(v);
+}
+
+static string hex32(uint32_t v)
+{
+    stringstream ss;
+    ss << "0x" << hex << setw(8) << setfill('0') << v;
+    return ss.str();
+}
+
+// Reads the leading comment block; parsing stops at the first line that is
+// neither blank nor a comment.
+static void parse_header(const string& source, TestCase& test)
+{
+    stringstream in(source);
+    string line;
+    int lineNumber = 0;
+    while (getline(in, line))
+    {
+        lineNumber++;
+        line = trim(line);
+        if (line.empty())
+            continue;
+        if (line[0] != '#')
+            break;
+        line = trim(line.substr(1));
+        size_t colon = line.find(':');
+        if (colon == string::npos)
+            continue;
+        string key = line.substr(0, colon);
+        string value = trim(line.substr(colon + 1));
+        try
+        {
+            if (key == "limit")
+                test.limit = stoull(value);
+            else if (key == "timeout")
+                test.timeoutMs = number(value);
+            else if (key == "expect")
+            {
+                size_t eq = value.find('=');
+                if (eq == string::npos)
+                    throw runtime_error("expected '='");
+                string lhs = trim(value.substr(0, eq));
+                string rhs = value.substr(eq + 1);
+                if (lhs == "exit")
+                {
+                    test.checkExit = true;
+                    test.exitCode = int32_t(number(rhs));
+                }
+                else if (lhs.compare(0, 4, "mem[") == 0 && lhs.back() == ']')
+                {
+                    MemoryExpectation m;
+                    string where = trim(lhs.substr(4, lhs.size() - 5));
+                    size_t plus = where.find('+');
+                    if (!where.empty() && isdigit(static_cast<unsigned char>(where[0])))
+                    {
+                        m.offset = number(where);
+                    }
+                    else
+                    {
+                        m.base = trim(where.substr(0, plus));
+                        m.offset = (plus == string::npos) ? 0 : number(where.substr(plus + 1));
+                    }
+                    stringstream words(rhs);
+                    string word;
+                    while (getline(words, word, ','))
+                        m.words.push_back(number(word));
+                    test.memory.push_back(m);
+                }
+                else
+                {
+                    auto it = regMap.find(lhs);
+                    if (it == regMap.end())
+                        throw runtime_error("unknown register '" + lhs + "'");
+                    test.regs.push_back({ it->second, number(rhs) });
+                }
+            }
+        }
+        catch (const exception& e)
+        {
+            throw runtime_error("line " + to_string(lineNumber) + ": " + e.what());
+        }
+    }
+}
+
+static TestResult run_test(TestCase& test, SimulatorPool& pool, bool compress, bool fusion)
+{
+    TestResult result;
+    auto begin = chrono::steady_clock::now();
+    auto fail = [&](Outcome outcome, const string& message) {
+        if (result.outcome != Outcome::Error)
+            result.outcome = outcome;
+        result.messages.push_back(message);
+    };
+
+    ifstream file(test.path);
+    stringstream source;
+    source << file.rdbuf();
+    AssembledProgram program;
+    try
+    {
+        parse_header(source.str(), test);
+        AssemblerOptions options;
+        options.compress = compress;
+        program = assemble(source.str(), options);
+    }
+    catch (const exception& e)
+    {
+        fail(Outcome::Error, e.what());
+        result.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+        return result;
+    }
+
+    SimulatorPool::Lease sim = pool.acquire();
+    istringstream in;
+    ostringstream out;
+    sim->set_console(&in, &out, &out);
+    sim->set_sandbox(test.path.parent_path().string());
+    sim->set_fusion(fusion);
+    sim->load_image(program.image);
+
+    StopReason stop = StopReason::Limit;
+    auto deadline = begin + chrono::milliseconds(test.timeoutMs);
+    bool timedOut = false;
+    while (result.instructions < test.limit)
+    {
+        uint64_t slice = min(SLICE, test.limit - result.instructions);
+        stop = sim->run(slice, true);
+        result.instructions += sim->last_run_instructions();
+        if (stop != StopReason::Limit)
+            break;
+        if (chrono::steady_clock::now() > deadline)
+        {
+            timedOut = true;
+            break;
+        }
+    }
+    sim->flush_output();
+    result.output = out.str();
+
+    if (timedOut)
+        fail(Outcome::Error, "timed out after " + to_string(test.timeoutMs) + " ms");
+    else if (stop != StopReason::Halted)
+        fail(Outcome::Error, "did not halt within " + to_string(test.limit) + " instructions");
+
+    for (auto& r : test.regs)
+    {
+        uint32_t got = sim->get_reg(r.first);
+        if (got != r.second)
+            fail(Outcome::Fail, string(reg_names[r.first]) + ": expected " + hex32(r.second) + ", got " + hex32(got));
+    }
+    for (auto& m : test.memory)
+    {
+        uint32_t address = m.offset;
+        if (!m.base.empty())
+        {
+            if (!program.symbols.hasLabel(m.base))
+            {
+                fail(Outcome::Error, "unknown label '" + m.base + "'");
+                continue;
+            }
+            address += program.symbols.getAddress(m.base);
+        }
+        for (size_t i = 0; i < m.words.size(); i++)
+        {
+            uint32_t got = sim->read_word(address + uint32_t(i) * 4);
+            if (got != m.words[i])
+                fail(Outcome::Fail, "mem[" + hex32(address + uint32_t(i) * 4) + "]: expected "
+                     + hex32(m.words[i]) + ", got " + hex32(got));
+        }
+    }
+    if (test.checkExit && sim->exit_code() != test.exitCode)
+        fail(Outcome::Fail, "exit: expected " + to_string(test.exitCode) + ", got " + to_string(sim->exit_code()));
+
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    return result;
+}
+
+static string xml_escape(const string& s)
+{
+    string r;
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '<': r += "&lt;"; break;
+        case '>': r += "&gt;"; break;
+        case '&': r += "&amp;"; break;
+        case '"': r += "&quot;"; break;
+        default:
+            if (static_cast<unsigned char>(c) >= 0x20 || c == '\n' || c == '\t')
+                r += c;
+        }
+    }
+    return r;
+}
+
+static string json_escape(const string& s)
+{
+    string r;
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"': r += "\\\""; break;
+        case '\\': r += "\\\\"; break;
+        case '\n': r += "\\n"; break;
+        case '\t': r += "\\t"; break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char buf[8];
+                snprintf(buf, sizeof(buf), "\\u%04x", c);
+                r += buf;
+            }
+            else
+            {
+                r += c;
+            }
+        }
+    }
+    return r;
+}
+
+static string joined(const vector<string>& messages)
+{
+    string r;
+    for (size_t i = 0; i < messages.size(); i++)
+        r += (i ? "; " : "") + messages[i];
+    return r;
+}
+
+static void write_junit(ostream& out, const vector<TestCase>& tests, const vector<TestResult>& results, double seconds)
+{
+    size_t failures = 0, errors = 0;
+    for (auto& r : results)
+    {
+        failures += r.outcome == Outcome::Fail;
+        errors += r.outcome == Outcome::Error;
+    }
+    out << fixed << setprecision(3);
+    out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+    out << "<testsuite name=\"riscv-regress\" tests=\"" << tests.size() << "\" failures=\"" << failures
+        << "\" errors=\"" << errors << "\" time=\"" << seconds << "\">\n";
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        const TestResult& r = results[i];
+        out << "  <testcase classname=\"asm\" name=\"" << xml_escape(tests[i].name) << "\" time=\"" << r.seconds << "\">\n";
+        if (r.outcome != Outcome::Pass)
+        {
+            const char* tag = (r.outcome == Outcome::Fail) ? "failure" : "error";
+            out << "    <" << tag << " message=\"" << xml_escape(joined(r.messages)) << "\"/>\n";
+        }
+        if (!r.output.empty())
+            out << "    <system-out>" << xml_escape(r.output) << "</system-out>\n";
+        out << "  </testcase>\n";
+    }
+    out << "</testsuite>\n";
+}
+
+static void write_json(ostream& out, const vector<TestCase>& tests, const vector<TestResult>& results, double seconds)
+{
+    static const char* const names[] = { "pass", "fail", "error" };
+    out << fixed << setprecision(6);
+    out << "{\n  \"time\": " << seconds << ",\n  \"tests\": [\n";
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        const TestResult& r = results[i];
+        out << "    { \"name\": \"" << json_escape(tests[i].name) << "\", \"status\": \""
+            << names[int(r.outcome)] << "\", \"time\": " << r.seconds
+            << ", \"instructions\": " << r.instructions << ", \"messages\": [";
+        for (size_t m = 0; m < r.messages.size(); m++)
+            out << (m ? ", " : "") << "\"" << json_escape(r.messages[m]) << "\"";
+        out << "] }" << (i + 1 < tests.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    string directory;
+    unsigned jobs = max(1u, thread::hardware_concurrency());
+    uint64_t limit = 10'000'000;
+    uint32_t timeoutMs = 10'000;
+    string junitPath, jsonPath;
+    bool compress = true;
+    bool fusion = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc)
+            jobs = max(1ul, stoul(argv[++i]));
+        else if (arg == "--limit" && i + 1 < argc)
+            limit = stoull(argv[++i]);
+        else if (arg == "--timeout" && i + 1 < argc)
+            timeoutMs = stoul(argv[++i]);
+        else if (arg == "--junit" && i + 1 < argc)
+            junitPath = argv[++i];
+        else if (arg == "--json" && i + 1 < argc)
+            jsonPath = argv[++i];
+        else if (arg == "--no-rvc")
+            compress = false;
+        else if (arg == "--fusion")
+            fusion = true;
+        else
+            directory = arg;
+    }
+    if (directory.empty())
+    {
+        cerr << "usage: regress <dir> [--jobs N] [--limit N] [--timeout MS] [--junit FILE] [--json FILE] [--no-rvc] [--fusion]\n";
+        return 2;
+    }
+
+    vector<TestCase> tests;
+    try
+    {
+        for (auto& entry : fs::recursive_directory_iterator(directory))
+        {
+            if (!entry.is_regular_file() || entry.path().extension() != ".asm")
+                continue;
+            TestCase test;
+            test.path = entry.path();
+            test.name = fs::relative(entry.path(), directory).generic_string();
+            test.limit = limit;
+            test.timeoutMs = timeoutMs;
+            tests.push_back(test);
+        }
+    }
+    catch (const exception& e)
+    {
+        cerr << directory << ": " << e.what() << "\n";
+        return 2;
+    }
+    sort(tests.begin(), tests.end(), [](const TestCase& a, const TestCase& b) { return a.name < b.name; });
+
+    // Workers take the next test off a shared counter; results are stored by
+    // index so the reports come out in a stable order.
+    vector<TestResult> results(tests.size());
+    atomic<size_t> next(0);
+    mutex print_lock;
+    auto begin = chrono::steady_clock::now();
+    SimulatorPool pool;
+    auto worker = [&]() {
+        for (size_t i = next++; i < tests.size(); i = next++)
+        {
+            results[i] = run_test(tests[i], pool, compress, fusion);
+            const TestResult& r = results[i];
+            lock_guard<mutex> lock(print_lock);
+            static const char* const labels[] = { "PASS ", "FAIL ", "ERROR" };
+            cout << labels[int(r.outcome)] << " " << tests[i].name << " (" << fixed << setprecision(1)
+                 << r.seconds * 1000 << " ms)";
+            if (!r.messages.empty())
+                cout << ": " << joined(r.messages);
+            cout << "\n";
+        }
+    };
+    vector<thread> threads;
+    for (unsigned t = 1; t < min<size_t>(jobs, tests.size()); t++)
+        threads.emplace_back(worker);
+    worker();
+    for (auto& t : threads)
+        t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+    size_t passed = count_if(results.begin(), results.end(), [](const TestResult& r) { return r.outcome == Outcome::Pass; });
+    cout << passed << "/" << tests.size() << " passed in " << fixed << setprecision(2) << seconds << " s\n";
+    if (!junitPath.empty())
+    {
+        ofstream out(junitPath);
+        write_junit(out, tests, results, seconds);
+    }
+    if (!jsonPath.empty())
+    {
+        ofstream out(jsonPath);
+        write_json(out, tests, results, seconds);
+    }
+    return passed == tests.size() ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+﻿#include "simulator.h"
+
+// ───── 32-bit encoders for the expanded forms ─────
+static uint32_t enc_r(uint32_t funct7, uint32_t rs2, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode)
+{
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t enc_i(int32_t imm, uint32_t rs1, uint32_t funct3, uint32_t rd, uint32_t opcode)
+{
+    return ((uint32_t(imm) & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t enc_s(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3)
+{
+    uint32_t u = uint32_t(imm);
+    return (((u >> 5) & 0x7F) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((u & 0x1F) << 7) | 0x23;
+}
+
+static uint32_t enc_b(int32_t imm, uint32_t rs2, uint32_t rs1, uint32_t funct3)
+{
+    uint32_t u = uint32_t(imm);
+    return (((u >> 12) & 1) << 31) | (((u >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15)
+        | (funct3 << 12) | (((u >> 1) & 0xF) << 8) | (((u >> 11) & 1) << 7) | 0x63;
+}
+
+static uint32_t enc_j(int32_t imm, uint32_t rd)
+{
+    uint32_t u = uint32_t(imm);
+    return (((u >> 20) & 1) << 31) | (((u >> 1) & 0x3FF) << 21) | (((u >> 11) & 1) << 20)
+        | (((u >> 12) & 0xFF) << 12) | (rd << 7) | 0x6F;
+}
+
+static int32_t sext(uint32_t value, int bits)
+{
+    return int32_t(value << (32 - bits)) >> (32 - bits);
+}
+
+static uint32_t bit(uint32_t c, int pos)
+{
+    return (c >> pos) & 1;
+}
+
+// CJ-format offset[11|4|9:8|10|6|7|3:1|5] held in bits 12:2.
+static int32_t cj_offset(uint32_t c)
+{
+    uint32_t off = (bit(c, 12) << 11) | (bit(c, 11) << 4) | (((c >> 9) & 0x3) << 8) | (bit(c, 8) << 10)
+        | (bit(c, 7) << 6) | (bit(c, 6) << 7) | (((c >> 3) & 0x7) << 1) | (bit(c, 2) << 5);
+    return sext(off, 12);
+}
+
+// CB-format branch offset[8|4:3] in bits 12:10 and [7:6|2:1|5] in bits 6:2.
+static int32_t cb_offset(uint32_t c)
+{
+    uint32_t off = (bit(c, 12) << 8) | (((c >> 10) & 0x3) << 3) | (((c >> 5) & 0x3) << 6)
+        | (((c >> 3) & 0x3) << 1) | (bit(c, 2) << 5);
+    return sext(off, 9);
+}
+
+uint32_t expand_compressed(uint16_t c)
+{
+    uint32_t funct3 = (c >> 13) & 0x7;
+    uint32_t rd = (c >> 7) & 0x1F;          // rd/rs1 in CI/CR formats
+    uint32_t rs2 = (c >> 2) & 0x1F;         // rs2 in CR/CSS formats
+    uint32_t rdp = ((c >> 2) & 0x7) + 8;    // rd'/rs2' in bits 4:2
+    uint32_t rs1p = ((c >> 7) & 0x7) + 8;   // rs1'/rd' in bits 9:7
+    int32_t imm6 = sext((bit(c, 12) << 5) | ((c >> 2) & 0x1F), 6);
+
+    switch (c & 0x3)
+    {
+    case 0x0: // Quadrant 0
+        switch (funct3)
+        {
+        case 0x0: // c.addi4spn → addi rd', sp, nzuimm
+        {
+            uint32_t imm = (((c >> 11) & 0x3) << 4) | (((c >> 7) & 0xF) << 6)
+                | (bit(c, 6) << 2) | (bit(c, 5) << 3);
+            if (imm == 0)
+                return 0;
+            return enc_i(imm, 2, 0x0, rdp, 0x13);
+        }
+        case 0x2: // c.lw → lw rd', uimm(rs1')
+        {
+            uint32_t imm = (((c >> 10) & 0x7) << 3) | (bit(c, 6) << 2) | (bit(c, 5) << 6);
+            return enc_i(imm, rs1p, 0x2, rdp, 0x03);
+        }
+        case 0x6: // c.sw → sw rs2', uimm(rs1')
+        {
+            uint32_t imm = (((c >> 10) & 0x7) << 3) | (bit(c, 6) << 2) | (bit(c, 5) << 6);
+            return enc_s(imm, rdp, rs1p, 0x2);
+        }
+        }
+        return 0;
+
+    case 0x1: // Quadrant 1
+        switch (funct3)
+        {
+        case 0x0: // c.addi / c.nop → addi rd, rd, imm
+            return enc_i(imm6, rd, 0x0, rd, 0x13);
+        case 0x1: // c.jal → jal ra, offset
+            return enc_j(cj_offset(c), 1);
+        case 0x2: // c.li → addi rd, x0, imm
+            return enc_i(imm6, 0, 0x0, rd, 0x13);
+        case 0x3:
+            if (rd == 2) // c.addi16sp → addi sp, sp, nzimm
+            {
+                uint32_t imm = (bit(c, 12) << 9) | (bit(c, 6) << 4) | (bit(c, 5) << 6)
+                    | (((c >> 3) & 0x3) << 7) | (bit(c, 2) << 5);
+                if (imm == 0)
+                    return 0;
+                return enc_i(sext(imm, 10), 2, 0x0, 2, 0x13);
+            }
+            // c.lui → lui rd, nzimm
+            if (imm6 == 0)
+                return 0;
+            return (uint32_t(imm6) << 12) | (rd << 7) | 0x37;
+        case 0x4:
+        {
+            uint32_t shamt = (c >> 2) & 0x1F;
+            switch ((c >> 10) & 0x3)
+            {
+            case 0x0: // c.srli
+                if (bit(c, 12)) return 0;
+                return enc_r(0x00, shamt, rs1p, 0x5, rs1p, 0x13);
+            case 0x1: // c.srai
+                if (bit(c, 12)) return 0;
+                return enc_r(0x20, shamt, rs1p, 0x5, rs1p, 0x13);
+            case 0x2: // c.andi
+                return enc_i(imm6, rs1p, 0x7, rs1p, 0x13);
+            default:
+                if (bit(c, 12)) return 0;
+                switch ((c >> 5) & 0x3)
+                {
+                case 0x0: return enc_r(0x20, rdp, rs1p, 0x0, rs1p, 0x33); // c.sub
+                case 0x1: return enc_r(0x00, rdp, rs1p, 0x4, rs1p, 0x33); // c.xor
+                case 0x2: return enc_r(0x00, rdp, rs1p, 0x6, rs1p, 0x33); // c.or
+                default:  return enc_r(0x00, rdp, rs1p, 0x7, rs1p, 0x33); // c.and
+                }
+            }
+        }
+        case 0x5: // c.j → jal x0, offset
+            return enc_j(cj_offset(c), 0);
+        case 0x6: // c.beqz → beq rs1', x0, offset
+            return enc_b(cb_offset(c), 0, rs1p, 0x0);
+        case 0x7: // c.bnez → bne rs1', x0, offset
+            return enc_b(cb_offset(c), 0, rs1p, 0x1);
+        }
+        return 0;
+
+    case 0x2: // Quadrant 2
+        switch (funct3)
+        {
+        case 0x0: // c.slli → slli rd, rd, shamt
+            if (bit(c, 12)) return 0;
+            return enc_r(0x00, (c >> 2) & 0x1F, rd, 0x1, rd, 0x13);
+        case 0x2: // c.lwsp → lw rd, uimm(sp)
+        {
+            if (rd == 0) return 0;
+            uint32_t imm = (bit(c, 12) << 5) | (((c >> 4) & 0x7) << 2) | (((c >> 2) & 0x3) << 6);
+            return enc_i(imm, 2, 0x2, rd, 0x03);
+        }
+        case 0x4:
+            if (!bit(c, 12))
+            {
+                if (rs2 == 0) // c.jr → jalr x0, 0(rs1)
+                    return rd == 0 ? 0 : enc_i(0, rd, 0x0, 0, 0x67);
+                return enc_r(0x00, rs2, 0, 0x0, rd, 0x33);  // c.mv → add rd, x0, rs2
+            }
+            if (rs2 == 0)
+            {
+                if (rd == 0) // c.ebreak
+                    return 0x00100073;
+                return enc_i(0, rd, 0x0, 1, 0x67);  // c.jalr → jalr ra, 0(rs1)
+            }
+            return enc_r(0x00, rs2, rd, 0x0, rd, 0x33);  // c.add → add rd, rd, rs2
+        case 0x6: // c.swsp → sw rs2, uimm(sp)
+        {
+            uint32_t imm = (((c >> 9) & 0xF) << 2) | (((c >> 7) & 0x3) << 6);
+            return enc_s(imm, rs2, 2, 0x2);
+        }
+        }
+        return 0;
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 ﻿#include "simulator.h"
+#include "bitops.h"
 
 Register::Register() : value(0) {}
 void Register::write(uint32_t _v)
@@ -16,19 +17,85 @@ void Register::reset()
     value = 0;
 }
 
-Simulator::Simulator()
+Simulator::Simulator(bool hugePages)
+{
+    huge_pages = hugePages;
+    map_memory();
+    dirty_pages.assign((MEM_SIZE / PAGE_WORDS + 63) / 64, 0);
+    pristine_pc = PROGRAM_START;
+    pristine_image_end = PROGRAM_START;
+    break_map.assign(MEM_SIZE * 2 / 64, 0);
+    watch_map.assign(MEM_SIZE / 64, 0);
+    set_vlen(DEFAULT_VLEN);
+    sandbox_dir = ".";
+    console_in = &cin;
+    console_out = &cout;
+    console_err = &cerr;
+    fusion = false;
+    observer_batch = 4096;
+    clk_type = 'A';
+    clk_speed = 0;
+    delay = 0;
+    reset_state();
+}
+
+// Everything but guest memory and the host-side settings.
+void Simulator::reset_state()
 {
     for (auto& r : regfile)
         r.reset();
-    PC.write(PROGRAM_START);
+    PC.write(pristine_pc);
+    inst_pc = pristine_pc;
     MAR.write(0);
     MDR.write(0);
     IR.write(0);
     A.write(0);
     B.write(0);
     ALUOut.write(0);
-    for (auto& m : mem)
-        m = 0;
+    headless = false;
+    debugging = false;
+    stepping = false;
+    watch_hit = false;
+    watch_addr = 0;
+    watch_was_write = false;
+    for (auto& f : fregs)
+        f = 0xFFFFFFFF00000000ull;
+    fflags = 0;
+    frm = 0;
+    next_guest_fd = 3;
+    out_fd = 1;
+    image_end = pristine_image_end;
+    brk_addr = 0;
+    exit_status = 0;
+    fusion_leads.fill(0);
+    fusion_hits.fill(0);
+    event_seq = 0;
+    inst_word = 0;
+    retire_events.clear();
+    memory_events.clear();
+    register_events.clear();
+    branch_events.clear();
+    trap_events.clear();
+    mstatus = 0;
+    mie = 0;
+    mtvec = 0;
+    mscratch = 0;
+    mepc = 0;
+    mcause = 0;
+    mtval = 0;
+    in_trap = false;
+    trap_taken = false;
+    external_irq = false;
+    msip = 0;
+    mtimecmp = TimerWheel::NEVER;
+    mtimecmp_event = 0;
+    mtime = 0;
+    next_event = TimerWheel::NEVER;
+    timers.clear();
+    clk = 0;
+    cycle_count = 0;
+    clk_total = 0;
+    run_count = 0;
 }
 
 void Simulator::load_program(const string& path)
@@ -37,14 +104,22 @@ void Simulator::load_program(const string& path)
     if (!infile)
         throw runtime_error("Cannot open file: " + path);
     string line;
-    uint32_t addr = PROGRAM_START / 4;
+    uint32_t addr = PROGRAM_START;
     while (getline(infile, line))
     {
+        while (!line.empty() && isspace(static_cast<unsigned char>(line.back())))
+            line.pop_back();
         if (line.empty())
             continue;
-        if (addr >= MEM_SIZE)
+        // Four hex digits is a 16-bit compressed instruction, eight a full word.
+        uint32_t size = (line.size() <= 4) ? 2 : 4;
+        if ((addr + size - 1) / 4 >= MEM_SIZE)
             throw runtime_error("Program is too large for memory");
-        mem[addr++] = stoul(line, nullptr, 16);
+        uint32_t value = stoul(line, nullptr, 16);
+        writeHalf(uint16_t(value), addr);
+        if (size == 4)
+            writeHalf(uint16_t(value >> 16), addr + 2);
+        addr += size;
     }
 }
 
@@ -53,16 +128,16 @@ void Simulator::choose_clk_type()
     std::string input;
     while (true)
     {
-        cout << "\033[1;91mChoose clk type: A(Auto), M(Manual): \033[0m";
+        cout << "\033[1;91mChoose clk type: A(Auto), M(Manual), B(Run until break): \033[0m";
         getline(cin, input);
 
         if (input.size() == 1)
         {
             clk_type = toupper(static_cast<unsigned char>(input[0]));
-            if (clk_type == 'A' || clk_type == 'M')
+            if (clk_type == 'A' || clk_type == 'M' || clk_type == 'B')
                 break;
         }
-        cout << "\033[1;91mInvalid input. Please enter 'A' or 'M'.\033[0m";
+        cout << "\033[1;91mInvalid input. Please enter 'A', 'M' or 'B'.\033[0m";
     }
 
     if (clk_type == 'A')
@@ -94,6 +169,19 @@ void Simulator::wait_for_user()
 }
 
 void Simulator::print_state()
+{
+    if (headless)
+        return;
+
+    display_state();
+
+    if (clk_type == 'A')
+        pause();
+    else
+        wait_for_user();
+}
+
+void Simulator::display_state()
 {
     cout << "\033[1;36m================ CLOCK CYCLE: " << clk << " =================\033[0m\n";
 
@@ -119,91 +207,308 @@ void Simulator::print_state()
     cout << "\033[1;35m ALUOut :\033[0m \033[0;36m" << setw(8) << ALUOut.read() << "\033[0m\n";
 
     cout << "\033[1;36m================================================\033[0m\n\n";
-
-
-    if (clk_type == 'A')
-        pause();
-    else
-        wait_for_user();
-
 }
 
 void Simulator::start()
 {
     choose_clk_type();
     clk = 0;
+    HostRounding rounding;
+
+    // In run-until-break mode the program runs headless and only drops
+    // into the interactive view when a breakpoint or watchpoint fires.
+    debugging = (clk_type == 'B');
+    headless = debugging;
+    if (debugging && !debug_prompt("Run-until-break mode"))
+        return;
+
+    bool resuming = true;
     bool halted = false;
     while (!halted)
     {
-        // Cycle 1: MAR ← PC
-        clk++;
-        MAR.write(PC.read());
-        print_state();
+        if (mtime >= next_event)
+            service_events<Unobserved>();
+        if (debugging)
+        {
+            if (!resuming && is_breakpoint(PC.read()))
+            {
+                stringstream ss;
+                ss << "Breakpoint at 0x" << hex << PC.read();
+                if (!debug_prompt(ss.str()))
+                    break;
+            }
+            resuming = false;
+            if (fusion && !stepping && fused_step())
+            {
+                mtime += 2;
+                continue;
+            }
+        }
 
-        // Cycle 2: MDR ← Mem[MAR]; PC ← PC + 4
-        clk++;
-        MDR.write(mem[MAR.read() / 4]);
-        PC.write(PC.read() + 4);
-        print_state();
+        halted = debugging ? step<DebugPolicy>() : step<InteractivePolicy>();
+        mtime++;
 
-        // Cycle 3: IR ← MDR
-        clk++;
-        IR.write(MDR.read());
-        print_state();
+        if (debugging && (watch_hit || stepping))
+        {
+            string reason = watch_hit ? watch_reason : "Step";
+            watch_hit = false;
+            if (halted || !debug_prompt(reason))
+                break;
+            resuming = true;
+        }
+    }
+
+    flush_output();
+    if (debugging)
+    {
+        cout << "\033[1;91mProgram halted.\033[0m\n";
+        display_state();
+    }
+    reset_clk();
+}
 
-        // Decode
-        uint32_t instr = IR.read();
-        uint32_t opcode = instr & 0x7F;
+// Runs headless until the program halts, a breakpoint or watchpoint fires, or
+// maxInstructions have been executed. When resuming, a breakpoint on the
+// current PC does not stop the first instruction.
+template <class P>
+StopReason Simulator::run_loop(uint64_t maxInstructions, bool resuming)
+{
+    HostRounding rounding;
+    headless = true;
+    stepping = false;
+    watch_hit = false;
+    for (uint64_t n = 0; n < maxInstructions; n++)
+    {
+        if (mtime >= next_event)
+            service_events<typename P::Observe>();
+        if ((n != 0 || !resuming) && is_breakpoint(PC.read()))
+        {
+            run_count = n;
+            return StopReason::Breakpoint;
+        }
+        if (!P::Observe::enabled && fusion && n + 1 < maxInstructions && fused_step())
+        {
+            n++;
+            mtime += 2;
+            continue;
+        }
+        bool halted = step<P>();
+        mtime++;
+        if constexpr (P::Observe::enabled)
+            note_step(halted);
+        if (halted)
+        {
+            run_count = n + 1;
+            reset_clk();        // ebreak and illegal instructions halt mid-instruction
+            flush_output();
+            return StopReason::Halted;
+        }
+        if (watch_hit)
+        {
+            run_count = n + 1;
+            watch_hit = false;
+            return StopReason::Watchpoint;
+        }
+    }
+    run_count = maxInstructions;
+    return StopReason::Limit;
+}
 
-        // Halt if EBREAK encountered
-        if (instr == 0x00100073) break;
+StopReason Simulator::run(uint64_t maxInstructions, bool resuming)
+{
+    if (!observers.empty())
+        return run_observed(maxInstructions, resuming);
+    return run_loop<HeadlessPolicy>(maxInstructions, resuming);
+}
 
-        switch (opcode)
+StopReason Simulator::run_unchecked(uint64_t maxInstructions, bool resuming)
+{
+    if (!observers.empty())
+        return run_observed(maxInstructions, resuming);
+    if (!watchpoints.empty())
+        return run_loop<HeadlessPolicy>(maxInstructions, resuming);
+    return run_loop<FastPolicy>(maxInstructions, resuming);
+}
+
+StopReason Simulator::run_observed(uint64_t maxInstructions, bool resuming)
+{
+    StopReason reason = run_loop<ObservedPolicy>(maxInstructions, resuming);
+    flush_events();
+    return reason;
+}
+
+CycleCheck Simulator::check_cycles(uint64_t maxInstructions)
+{
+    HostRounding rounding;
+    CycleCheck check{};
+    check.reason = StopReason::Limit;
+    check.match = true;
+    headless = true;
+    stepping = false;
+    while (check.instructions < maxInstructions)
+    {
+        // An interrupt taken before the instruction is charged to it.
+        uint64_t table = cycle_count;
+        uint64_t stepped = clk_total;
+        if (mtime >= next_event)
+            service_events<Unobserved>();
+        uint32_t pc = PC.read();
+        bool halted = step<DebugPolicy>();
+        mtime++;
+        if (halted)
+            reset_clk();
+        watch_hit = false;
+        check.instructions++;
+        table = cycle_count - table;
+        stepped = clk_total - stepped;
+        if (table != stepped)
         {
-        case 0x33: // R-type
-            R_type(instr);
+            check.match = false;
+            check.pc = pc;
+            check.instr = IR.read();
+            check.table = table;
+            check.stepped = stepped;
             break;
-
-        case 0x13: // I-type Arithmetic/Logical/Shift Imm (e.g., addi, slli)
-        case 0x03: // I-type Loads (lb, lh, lw, lbu, lhu)
-        case 0x67: // I-type Jump (jalr)
-            I_type(instr, opcode);
+        }
+        if (halted)
+        {
+            check.reason = StopReason::Halted;
             break;
+        }
+    }
+    flush_output();
+    return check;
+}
 
-        case 0x23: // S-type Store Instructions (sh, sw)
-            S_type(instr);
-            break;
+// Executes a single instruction through its micro-cycles. Returns true when
+// the program halts.
+template <class P>
+bool Simulator::step()
+{
+    // Cycle 1: MAR ← PC
+    clk++;
+    inst_pc = stage<P>(MAR, PC.read());
+    show<P>();
 
-        case 0x37:  // U-type: LUI
-        case 0x17:  // U-type: AUIPC
-            U_type(instr, opcode);
-            break;
+    // Cycle 2: MDR ← Mem[MAR]; PC ← PC + 4
+    // A 16-bit RVC parcel is expanded to its 32-bit equivalent on the way
+    // into MDR and advances PC by 2, so it executes exactly like the full
+    // instruction from here on.
+    clk++;
+    uint32_t parcel = fetch_half<P>(inst_pc);
+    uint32_t instr;
+    if ((parcel & 0x3) != 0x3)
+    {
+        instr = stage<P>(MDR, expand_compressed(uint16_t(parcel)));
+        PC.write(inst_pc + 2);
+    }
+    else
+    {
+        instr = stage<P>(MDR, parcel | (fetch_half<P>(inst_pc + 2) << 16));
+        PC.write(inst_pc + 4);
+    }
+    show<P>();
 
-        case 0x63:  // B-type branch instructions
-            B_type(instr);
-            break;
+    // Cycle 3: IR ← MDR
+    clk++;
+    stage<P>(IR, instr);
+    show<P>();
 
-        case 0x6F:  // JAL
-            J_type(instr);
-            break;
+    // Decode
+    uint32_t opcode = instr & 0x7F;
+    if constexpr (P::Observe::enabled)
+        inst_word = instr;
+    cycle_count += instruction_cycles(instr);
+
+    // Halt if EBREAK encountered
+    if (instr == 0x00100073) return true;
+
+    using Observe = typename P::Observe;
+    switch (opcode)
+    {
+    case 0x33: // R-type
+        R_type<P>(instr);
+        break;
+
+    case 0x13: // I-type Arithmetic/Logical/Shift Imm (e.g., addi, slli)
+    case 0x03: // I-type Loads (lb, lh, lw, lbu, lhu)
+    case 0x67: // I-type Jump (jalr)
+        I_type<P>(instr, opcode);
+        break;
+
+    case 0x23: // S-type Store Instructions (sh, sw)
+        S_type<P>(instr);
+        break;
 
-        case 0x73:
-            // For system instructions, only EBREAK is implemented.
-            halted = true;
+    case 0x37:  // U-type: LUI
+    case 0x17:  // U-type: AUIPC
+        U_type<P>(instr, opcode);
+        break;
+
+    case 0x63:  // B-type branch instructions
+        B_type<P>(instr);
+        break;
+
+    case 0x6F:  // JAL
+        J_type<P>(instr);
+        break;
+
+    // The extension handlers return true for encodings they do not
+    // support, which are illegal instructions.
+    case 0x57:  // OP-V vector arithmetic and vsetvli
+        return V_type<Observe>(instr) && illegal_instruction<Observe>(instr);
+
+    case 0x07:  // LOAD-FP: flw (width 010) or vector loads
+        if (((instr >> 12) & 0x7) == 0x2)
+        {
+            F_load<Observe>(instr);
             break;
+        }
+        return V_mem<Observe>(instr, false) && illegal_instruction<Observe>(instr);
 
-        default:
-            halted = true;
+    case 0x27:  // STORE-FP: fsw (width 010) or vector stores
+        if (((instr >> 12) & 0x7) == 0x2)
+        {
+            F_store<Observe>(instr);
             break;
         }
+        return V_mem<Observe>(instr, true) && illegal_instruction<Observe>(instr);
+
+    case 0x53:  // OP-FP single-precision arithmetic
+        return F_type<Observe>(instr) && illegal_instruction<Observe>(instr);
+
+    case 0x43:  // fmadd.s
+    case 0x47:  // fmsub.s
+    case 0x4B:  // fnmsub.s
+    case 0x4F:  // fnmadd.s
+        return F_fma(instr, opcode) && illegal_instruction<Observe>(instr);
+
+    case 0x73:
+        // ECALL goes to the guest's trap handler or the host, CSR accesses
+        // to CSR_type; any other system instruction is illegal.
+        if (instr == 0x00000073)
+            return environment_call<Observe>();
+        if (((instr >> 12) & 0x7) != 0)
+            return CSR_type<Observe>(instr) && illegal_instruction<Observe>(instr);
+        if (instr == 0x30200073)    // MRET
+            return mret();
+        if (instr == 0x10500073)    // WFI
+            return wfi();
+        return illegal_instruction<Observe>(instr);
+
+    default:
+        return illegal_instruction<Observe>(instr);
     }
+    return false;
 }
 
 void Simulator::reset_clk()
 {
+    clk_total += clk;
     clk = 0;
 }
 
+template <class P>
 void Simulator::R_type(uint32_t instr)
 {
     int rd     = (instr >> 7)  & 0x1F;
@@ -214,14 +519,12 @@ void Simulator::R_type(uint32_t instr)
 
     // Cycle 4: Read registers into A and B
     clk++;
-    A.write(regfile[rs1].read());
-    B.write(regfile[rs2].read());
-    print_state();
+    int32_t   opA = stage<P>(A, regfile[rs1].read());
+    int32_t   opB = stage<P>(B, regfile[rs2].read());
+    show<P>();
 
     // Cycle 5: Compute ALU result
     clk++;
-    int32_t   opA = A.read();
-    int32_t   opB = B.read();
     int32_t   val = 0;
 
     switch (funct3)
@@ -237,7 +540,7 @@ void Simulator::R_type(uint32_t instr)
         }
         break;
 
-      // sll, mulh (signed×signed → upper 32 bits)
+      // sll, mulh (signed×signed → upper 32 bits), rol, bclr, binv, bset
       case 0x1:
         if      (funct7 == 0x00)
           val = opA << (opB & 0x1F);
@@ -246,9 +549,13 @@ void Simulator::R_type(uint32_t instr)
           int64_t prod = int64_t(opA) * int64_t(opB);
           val = int32_t(prod >> 32);
         }
+        else if (funct7 == 0x30) val = int32_t(host_rotl(uint32_t(opA), opB));
+        else if (funct7 == 0x24) val = opA & ~(1u << (opB & 0x1F));
+        else if (funct7 == 0x34) val = opA ^ (1u << (opB & 0x1F));
+        else if (funct7 == 0x14) val = opA | (1u << (opB & 0x1F));
         break;
 
-      // slt, mulhsu (signed×unsigned → upper 32 bits)
+      // slt, mulhsu (signed×unsigned → upper 32 bits), sh1add
       case 0x2:
         if      (funct7 == 0x00)
           val = (opA < opB);
@@ -260,6 +567,7 @@ void Simulator::R_type(uint32_t instr)
           uint64_t prod = a64 * b64;
           val = int32_t(prod >> 32);
         }
+        else if (funct7 == 0x10) val = int32_t((uint32_t(opA) << 1) + uint32_t(opB));
         break;
 
       // sltu, mulhu (unsigned×unsigned → upper 32 bits)
@@ -273,7 +581,7 @@ void Simulator::R_type(uint32_t instr)
         }
         break;
 
-      // xor, div
+      // xor, div, sh2add, xnor, min, zext.h
       case 0x4:
         if      (funct7 == 0x00)
           val = opA ^ opB;
@@ -283,9 +591,13 @@ void Simulator::R_type(uint32_t instr)
           else if (opA == INT32_MIN && opB == -1)  val = opA;  // overflow case
           else                                     val = opA / opB;
         }
+        else if (funct7 == 0x10) val = int32_t((uint32_t(opA) << 2) + uint32_t(opB));
+        else if (funct7 == 0x20) val = ~(opA ^ opB);
+        else if (funct7 == 0x05) val = min(opA, opB);
+        else if (funct7 == 0x04) val = opA & 0xFFFF;
         break;
 
-      // srl, sra, divu
+      // srl, sra, divu, minu, ror, bext
       case 0x5:
         if      (funct7 == 0x00)
           val = int32_t(uint32_t(opA) >> (opB & 0x1F));
@@ -297,9 +609,12 @@ void Simulator::R_type(uint32_t instr)
           uint32_t uB = uint32_t(opB);
           val = int32_t(uB == 0 ? UINT32_MAX : uA / uB);
         }
+        else if (funct7 == 0x05) val = int32_t(min(uint32_t(opA), uint32_t(opB)));
+        else if (funct7 == 0x30) val = int32_t(host_rotr(uint32_t(opA), opB));
+        else if (funct7 == 0x24) val = (uint32_t(opA) >> (opB & 0x1F)) & 1;
         break;
 
-      // or, rem
+      // or, rem, sh3add, orn, max
       case 0x6:
         if      (funct7 == 0x00)
           val = opA | opB;
@@ -309,9 +624,12 @@ void Simulator::R_type(uint32_t instr)
           else if (opA == INT32_MIN && opB == -1) val = 0;
           else                                    val = opA % opB;
         }
+        else if (funct7 == 0x10) val = int32_t((uint32_t(opA) << 3) + uint32_t(opB));
+        else if (funct7 == 0x20) val = opA | ~opB;
+        else if (funct7 == 0x05) val = max(opA, opB);
         break;
 
-      // and, remu
+      // and, remu, andn, maxu
       case 0x7:
         if      (funct7 == 0x00)
           val = opA & opB;
@@ -321,21 +639,24 @@ void Simulator::R_type(uint32_t instr)
           uint32_t uB = uint32_t(opB);
           val = int32_t(uB == 0 ? uA : (uA % uB));
         }
+        else if (funct7 == 0x20) val = opA & ~opB;
+        else if (funct7 == 0x05) val = int32_t(max(uint32_t(opA), uint32_t(opB)));
         break;
     }
 
-    ALUOut.write(val);
-    print_state();
+    stage<P>(ALUOut, val);
+    show<P>();
 
     // Cycle 6: Write-back
     clk++;
     if (rd != 0)
-        regfile[rd].write(ALUOut.read());
-    print_state();
+        write_reg<P>(rd, val);
+    show<P>();
 
     reset_clk();
 }
 
+template <class P>
 void Simulator::I_type(uint32_t instr, uint32_t opcode)
 {
     int rd     = (instr >> 7)  & 0x1F;
@@ -348,23 +669,21 @@ void Simulator::I_type(uint32_t instr, uint32_t opcode)
     {
       // --------------------------------------------------
       // I-type arithmetic & shifts (0x13)
-      // funct3: 0=addi,1=slli,4=xori,6=ori,7=andi,5=srli/srai…
+      // funct3: 0=addi,1=slli,2=slti,3=sltiu,4=xori,5=srli/srai,6=ori,7=andi
       // --------------------------------------------------
       case 0x13:
       {
         // 1) fetch A and immediate
         clk++;
-        A.write(regfile[rs1].read());
-        B.write(imm);
-        print_state();
+        int32_t a = stage<P>(A, regfile[rs1].read());
+        int32_t b = stage<P>(B, imm);
+        show<P>();
 
         // 2) ALU operation depends on funct3
         clk++;
+        int32_t result;
         {
-          int32_t a = A.read();
-          int32_t b = B.read();
           uint32_t ua = uint32_t(a);
-          int32_t result;
 
           switch (funct3)
           {
@@ -372,20 +691,59 @@ void Simulator::I_type(uint32_t instr, uint32_t opcode)
               result = a + b;
               break;
 
-            case 0x1: // slli (only low 5 bits of imm)
+            case 0x1: // slli, Zbb unary ops, bclri/binvi/bseti (imm[11:5] selects)
             {
               int sh = b & 0x1F;
-              result = a << sh;
+              switch ((b >> 5) & 0x7F)
+              {
+                case 0x00: result = a << sh; break;                             // slli
+                case 0x24: result = a & ~(1u << sh); break;                     // bclri
+                case 0x34: result = a ^ (1u << sh); break;                      // binvi
+                case 0x14: result = a | (1u << sh); break;                      // bseti
+                case 0x30:
+                  switch (sh)
+                  {
+                    case 0x0: result = int32_t(host_clz(ua)); break;           // clz
+                    case 0x1: result = int32_t(host_ctz(ua)); break;           // ctz
+                    case 0x2: result = int32_t(host_popcount(ua)); break;      // cpop
+                    case 0x4: result = int32_t(int8_t(ua)); break;             // sext.b
+                    case 0x5: result = int32_t(int16_t(ua)); break;            // sext.h
+                    default:  result = 0; break;
+                  }
+                  break;
+                default: result = 0; break;
+              }
               break;
             }
 
-            case 0x5: // srli (imm[10]==0) – logical
+            case 0x5: // srli, srai, rori, bexti, orc.b, rev8 (imm[11:5] selects)
             {
               int sh = b & 0x1F;
-              result = int32_t(ua >> sh);
+              switch ((b >> 5) & 0x7F)
+              {
+                case 0x00: result = int32_t(ua >> sh); break;                   // srli
+                case 0x20: result = a >> sh; break;                             // srai
+                case 0x30: result = int32_t(host_rotr(ua, sh)); break;          // rori
+                case 0x24: result = (ua >> sh) & 1; break;                      // bexti
+                case 0x14: result = int32_t(host_orc_b(ua)); break;             // orc.b
+                case 0x34: result = int32_t(host_bswap(ua)); break;             // rev8
+                default:   result = 0; break;
+              }
               break;
             }
 
+            case 0x2: // slti
+              result = (a < b) ? 1 : 0;
+              break;
+
+            case 0x3: // sltiu: the sign-extended immediate compares unsigned
+              result = (ua < uint32_t(b)) ? 1 : 0;
+              break;
+
+            case 0x4: // xori
+              result = a ^ b;
+              break;
+
             case 0x6: // ori
               result = a | b;
               break;
@@ -399,15 +757,15 @@ void Simulator::I_type(uint32_t instr, uint32_t opcode)
               break;
           }
 
-          ALUOut.write(result);
+          stage<P>(ALUOut, result);
         }
-        print_state();
+        show<P>();
 
         // 3) write-back
         clk++;
         if (rd != 0)
-          regfile[rd].write(ALUOut.read());
-        print_state();
+          write_reg<P>(rd, result);
+        show<P>();
         break;
       }
 
@@ -419,86 +777,94 @@ void Simulator::I_type(uint32_t instr, uint32_t opcode)
       {
         // 1) compute address
         clk++;
-        A.write(regfile[rs1].read());
-        B.write(imm);
-        print_state();
+        uint32_t base = stage<P>(A, regfile[rs1].read());
+        stage<P>(B, imm);
+        show<P>();
 
         clk++;
-        ALUOut.write(A.read() + B.read());
-        print_state();
+        uint32_t addr = stage<P>(ALUOut, base + imm);
+        show<P>();
 
         // 2) memory fetch
         clk++;
-        MAR.write(ALUOut.read());
-        print_state();
+        stage<P>(MAR, addr);
+        show<P>();
 
         clk++;
-        {
-          uint32_t addr = MAR.read();
-          // word-aligned index
-          uint32_t idxW = (addr & ~0x3) / 4;
-          uint32_t dataW = (idxW < MEM_SIZE) ? mem[idxW] : 0;
-          // half-word index
-          uint32_t idxH = (addr & ~0x1) / 4;
-          uint32_t dataH = (idxH < MEM_SIZE) ? mem[idxH] : 0;
-          int     offH  = (addr & 0x2) ? 16 : 0;
-          int16_t valH  = (dataH >> offH) & 0xFFFF;
-          int8_t  valB  = (dataW >> ((addr & 0x3) * 8)) & 0xFF;
-
-          int32_t loaded;
-          switch (funct3)
-          {
-            case 0x0: // lb
-              loaded = int32_t(valB);      // sign-extend byte
-              break;
-            case 0x1: // lh
-              loaded = int32_t(valH);      // sign-extend half
-              break;
-            case 0x2: // lw
-              loaded = int32_t(dataW);
-              break;
-            case 0x4: // lbu
-              loaded = uint32_t(valB) & 0xFF;    // zero-extend byte
-              break;
-            case 0x5: // lhu
-              loaded = uint32_t(valH) & 0xFFFF;  // zero-extend half
-              break;
-            default:
-              loaded = 0;
-          }
-          MDR.write(loaded);
-        }
-        print_state();
+        int32_t loaded = stage<P>(MDR, load<P>(addr, funct3));
+        if (P::MemCheck::enabled && is_watched((addr & ~0x3) / 4))
+          check_watch(addr, 1u << (funct3 & 0x3), false, uint32_t(loaded));
+        if constexpr (P::Observe::enabled)
+          note_memory(addr, uint32_t(loaded), uint8_t(1 << (funct3 & 0x3)), false);
+        show<P>();
 
         // 3) write-back
         clk++;
         if (rd != 0)
-          regfile[rd].write(MDR.read());
-        print_state();
+          write_reg<P>(rd, loaded);
+        show<P>();
         break;
       }
 
       case 0x67:
+      {
         clk++;
-        A.write(regfile[rs1].read());
-        B.write(imm);
-        print_state();
+        uint32_t base = stage<P>(A, regfile[rs1].read());
+        stage<P>(B, imm);
+        show<P>();
 
         clk++;
-        ALUOut.write(A.read() + B.read());
-        print_state();
+        uint32_t target = stage<P>(ALUOut, base + imm);
+        show<P>();
 
         clk++;
         if (rd != 0)
-          regfile[rd].write(PC.read());
-        PC.write(ALUOut.read() & ~1u);
-        print_state();
+          write_reg<P>(rd, PC.read());
+        PC.write(target & ~1u);
+        if constexpr (P::Observe::enabled)
+          note_branch(target & ~1u, true, false);
+        show<P>();
         break;
+      }
     }
 
     reset_clk();
 }
 
+// Value of a load (funct3: 0=lb,1=lh,2=lw,4=lbu,5=lhu) from addr; a
+// misaligned access reads the enclosing word or halfword. Past the end of
+// memory only the CLINT registers read as anything but 0.
+template <class P>
+int32_t Simulator::load(uint32_t addr, int funct3) const
+{
+    // word-aligned index
+    uint32_t idxW = (addr & ~0x3) / 4;
+    uint32_t dataW = in_memory<P>(idxW) ? mem[idxW] : clint_read(addr);
+    // half-word index
+    uint32_t idxH = (addr & ~0x1) / 4;
+    uint32_t dataH = in_memory<P>(idxH) ? mem[idxH] : clint_read(addr);
+    int     offH  = (addr & 0x2) ? 16 : 0;
+    int16_t valH  = (dataH >> offH) & 0xFFFF;
+    int8_t  valB  = (dataW >> ((addr & 0x3) * 8)) & 0xFF;
+
+    switch (funct3)
+    {
+    case 0x0: // lb
+        return int32_t(valB);      // sign-extend byte
+    case 0x1: // lh
+        return int32_t(valH);      // sign-extend half
+    case 0x2: // lw
+        return int32_t(dataW);
+    case 0x4: // lbu
+        return uint32_t(valB) & 0xFF;    // zero-extend byte
+    case 0x5: // lhu
+        return uint32_t(valH) & 0xFFFF;  // zero-extend half
+    default:
+        return 0;
+    }
+}
+
+template <class P>
 void Simulator::S_type(uint32_t instr)
 {
     int funct3 = (instr >> 12) & 0x7;
@@ -509,38 +875,38 @@ void Simulator::S_type(uint32_t instr)
 
     // Cycle 4: Read base register into A
     clk++;
-    A.write(regfile[rs1].read());
-    B.write(imm);
-    print_state();
+    uint32_t base = stage<P>(A, regfile[rs1].read());
+    stage<P>(B, imm);
+    show<P>();
 
     // Cycle 5: Compute effective address ALUOut ← A + imm
     clk++;
-    ALUOut.write(A.read() + B.read());
-    print_state();
+    uint32_t addr = stage<P>(ALUOut, base + imm);
+    show<P>();
 
     // Cycle 6: Set MAR to the effective address
     clk++;
-    MAR.write(ALUOut.read());
-    print_state();
+    stage<P>(MAR, addr);
+    show<P>();
 
     // Cycle 7: Get the data to store from rs2 into MDR
     clk++;
-    MDR.write(regfile[rs2].read());
-    print_state();
+    uint32_t data = stage<P>(MDR, regfile[rs2].read());
+    show<P>();
 
     // Cycle 8: Write data from MDR into memory (sb, sh, sw)
     clk++;
     {
-        uint32_t addr = MAR.read();
         uint32_t addrWord = (addr & ~0x3u) / 4;
-        if (addrWord < MEM_SIZE)
+        if (in_memory<P>(addrWord))
         {
             uint32_t curr = mem[addrWord];
+            mark_dirty(addrWord);
             switch (funct3)
             {
             case 0x0:  // sb: store byte
             {
-                uint8_t byte = uint8_t(MDR.read() & 0xFF);
+                uint8_t byte = uint8_t(data & 0xFF);
                 int shift = (addr & 0x3) * 8;
                 curr = (curr & ~(0xFFu << shift)) | (uint32_t(byte) << shift);
                 mem[addrWord] = curr;
@@ -548,7 +914,7 @@ void Simulator::S_type(uint32_t instr)
             }
             case 0x1:  // sh: store halfword
             {
-                uint16_t half = uint16_t(MDR.read() & 0xFFFF);
+                uint16_t half = uint16_t(data & 0xFFFF);
                 if (addr & 0x2)
                 { // upper half
                     curr = (curr & 0x0000FFFF) | (uint32_t(half) << 16);
@@ -561,15 +927,27 @@ void Simulator::S_type(uint32_t instr)
                 break;
             }
             case 0x2:  // sw: store word
-                mem[addrWord] = MDR.read();
+                mem[addrWord] = data;
                 break;
             }
+            if (P::MemCheck::enabled && is_watched(addrWord))
+                check_watch(addr, 1u << (funct3 & 0x3), true, data);
+        }
+        else
+        {
+            clint_write(addr, data, funct3);
+        }
+        if constexpr (P::Observe::enabled)
+        {
+            uint8_t size = uint8_t(1 << (funct3 & 0x3));
+            note_memory(addr, size == 4 ? data : data & ((1u << (size * 8)) - 1), size, true);
         }
     }
-    print_state();
+    show<P>();
     reset_clk();
 }
 
+template <class P>
 void Simulator::U_type(uint32_t instr, uint32_t opcode)
 {
     int rd = (instr >> 7) & 0x1F;
@@ -580,41 +958,42 @@ void Simulator::U_type(uint32_t instr, uint32_t opcode)
     {
         //Cycle 4: B <- imm
         clk++;
-        B.write(imm);
-        print_state();
+        stage<P>(B, imm);
+        show<P>();
 
         // Cycle 5: ALUOut ← imm << 0   (already shifted in mask)
         clk++;
-        ALUOut.write(B.read());
-        print_state();
+        stage<P>(ALUOut, imm);
+        show<P>();
 
         // Cycle 6: RegFile[rd] ← ALUOut
         clk++;
-        if (rd != 0) regfile[rd].write(ALUOut.read());
-        print_state();
+        if (rd != 0) write_reg<P>(rd, imm);
+        show<P>();
     }
     else  // AUIPC (0x17)
     {
         // Cycle 4: A ← PC
         clk++;
-        A.write(PC.read());
-        B.write(imm);
-        print_state();
+        stage<P>(A, inst_pc);
+        stage<P>(B, imm);
+        show<P>();
 
         // Cycle 5: ALUOut ← A + imm
         clk++;
-        ALUOut.write(A.read() + B.read());
-        print_state();
+        uint32_t value = stage<P>(ALUOut, inst_pc + imm);
+        show<P>();
 
         // Cycle 6: RegFile[rd] ← ALUOut
         clk++;
-        if (rd != 0) regfile[rd].write(ALUOut.read());
-        print_state();
+        if (rd != 0) write_reg<P>(rd, value);
+        show<P>();
     }
 
     reset_clk();
 }
 
+template <class P>
 void Simulator::B_type(uint32_t instr)
 {
 
@@ -634,9 +1013,9 @@ void Simulator::B_type(uint32_t instr)
 
     // Cycle 4: Read registers
     clk++;
-    A.write(regfile[rs1].read());
-    B.write(regfile[rs2].read());
-    print_state();
+    uint32_t a = stage<P>(A, regfile[rs1].read());
+    uint32_t b = stage<P>(B, regfile[rs2].read());
+    show<P>();
 
     // Cycle 5: Evaluate branch condition and compute branch target.
     clk++;
@@ -644,31 +1023,31 @@ void Simulator::B_type(uint32_t instr)
     switch (funct3)
     {
     case 0x0: // BEQ: branch if equal
-        takeBranch = (A.read() == B.read());
+        takeBranch = (a == b);
         break;
     case 0x1: // BNE: branch if not equal
-        takeBranch = (A.read() != B.read());
+        takeBranch = (a != b);
         break;
     case 0x4: // BLT: branch if less than (signed)
-        takeBranch = (int32_t(A.read()) < int32_t(B.read()));
+        takeBranch = (int32_t(a) < int32_t(b));
         break;
     case 0x5: // BGE: branch if greater than or equal (signed)
-        takeBranch = (int32_t(A.read()) >= int32_t(B.read()));
+        takeBranch = (int32_t(a) >= int32_t(b));
         break;
     case 0x6: // BLTU: branch if less than (unsigned)
-        takeBranch = (A.read() < B.read());
+        takeBranch = (a < b);
         break;
     case 0x7: // BGEU: branch if greater than or equal (unsigned)
-        takeBranch = (A.read() >= B.read());
+        takeBranch = (a >= b);
         break;
     default:
         // Undefined branch condition: default is no branch.
         break;
     }
     // Compute branch target address.
-    // Note: PC currently points to next instruction (PC = old PC + 4 from fetch).
-    // Therefore, branch target = (PC - 4) + immediate.
-    int32_t branchTarget = (PC.read() - 4) + imm;
+    // Note: PC already points to the next instruction (+4, or +2 for RVC),
+    // so the target is taken relative to the address the branch was fetched from.
+    int32_t branchTarget = inst_pc + imm;
 
 
     // Cycle 5: If branch condition met, update PC with branch target.
@@ -676,12 +1055,15 @@ void Simulator::B_type(uint32_t instr)
     {
         PC.write(branchTarget);
     }
-    print_state();
+    if constexpr (P::Observe::enabled)
+        note_branch(branchTarget, takeBranch, true);
+    show<P>();
 
     // Reset the clock counter for the next instruction's cycles.
     reset_clk();
 }
 
+template <class P>
 void Simulator::J_type(uint32_t instr)
 {
     int rd = (instr >> 7) & 0x1F;
@@ -698,23 +1080,70 @@ void Simulator::J_type(uint32_t instr)
     // Cycle 4: A ← PC  (PC is already PC_old + 4 after fetch)
     clk++;
     if (rd != 0)
-        regfile[rd].write(PC.read());
-    print_state();
+        write_reg<P>(rd, PC.read());
+    show<P>();
 
-    // Cycle 5: ALUOut ← A + imm  (compute jump target)
+    // Cycle 5: ALUOut ← A + imm  (compute jump target relative to the jal itself)
     clk++;
-    PC.write(PC.read() + imm);
-    print_state();
+    PC.write(inst_pc + imm);
+    if constexpr (P::Observe::enabled)
+        note_branch(inst_pc + imm, true, false);
+    show<P>();
 
     reset_clk();
 }
 
+// The fused lw pairs share the load path of run().
+template int32_t Simulator::load<HeadlessPolicy>(uint32_t, int) const;
+
+uint32_t Simulator::read_half(uint32_t address) const
+{
+    if (address / 4 >= MEM_SIZE)
+        return 0;
+    return (mem[address / 4] >> ((address & 0x2) * 8)) & 0xFFFF;
+}
+
+bool Simulator::readByte(uint32_t address, uint8_t& out) const
+{
+    if (address / 4 >= MEM_SIZE)
+        return false;
+    out = uint8_t(mem[address / 4] >> ((address % 4) * 8));
+    return true;
+}
+
+void Simulator::load_image(const ProgramImage& image)
+{
+    for (const ImageChunk& chunk : image.chunks)
+    {
+        if (chunk.address + uint64_t(chunk.bytes.size()) > uint64_t(MEM_SIZE) * 4)
+            throw runtime_error("Program is too large for memory");
+        write_memory(chunk.address, chunk.bytes.data(), chunk.bytes.size());
+    }
+    PC.write(image.entry);
+}
+
+void Simulator::write_memory(uint32_t address, const uint8_t* data, size_t size)
+{
+    for (size_t i = 0; i < size && address + i < MEM_SIZE * 4; i++)
+        writeByte(data[i], uint32_t(address + i));
+}
+
+bool Simulator::read_memory(uint32_t address, uint8_t* data, size_t size) const
+{
+    for (size_t i = 0; i < size; i++)
+        if (!readByte(uint32_t(address + i), data[i]))
+            return false;
+    return true;
+}
+
 void Simulator::writeWord(uint32_t input, uint32_t address) {
     //if (address % 4 != 0) {
     //    cerr << "Error: Unaligned word write to address 0x" << hex << address << endl;
     //    return;
     //}
     mem[address / 4] = input;
+    mark_dirty(address / 4);
+    note_image_end(address + 4);
 }
 
 void Simulator::writeHalf(uint16_t input, uint32_t address) {
@@ -735,6 +1164,8 @@ void Simulator::writeHalf(uint16_t input, uint32_t address) {
     else {
         cerr << "Error: .half must be aligned to 2 bytes (offset 0 or 2)" << endl;
     }
+    mark_dirty(wordAddress);
+    note_image_end(address + 2);
 }
 void Simulator::writeByte(uint8_t input, uint32_t address) {
     uint32_t wordAddress = address / 4;
@@ -743,4 +1174,6 @@ void Simulator::writeByte(uint8_t input, uint32_t address) {
     oldWord &= ~(0xFF << (byteOffset * 8));        // clear that byte
     oldWord |= (input << (byteOffset * 8));        // set byte to new value
     mem[wordAddress] = oldWord;
+    mark_dirty(wordAddress);
+    note_image_end(address + 1);
 }
\ No newline at end of file
@@ -11,11 +11,45 @@
 #include <conio.h>
 #include <chrono>
 #include <thread>
+#include <unordered_map>
+#include <sstream>
+#include <cfenv>
+#include "image.h"
+#include "policy.h"
+#include "observer.h"
+#include "timerwheel.h"
+#include "cycles.h"
 using namespace std;
 
-const uint32_t MEM_SIZE = 1024 * 64;
+const uint32_t MEM_SIZE = 1024 * 64;     // words; a power of two
 const uint32_t REG_COUNT = 32;
 const uint32_t PROGRAM_START = 0x1000;
+// Default vector register length in bits (RVV VLEN).
+const uint32_t DEFAULT_VLEN = 128;
+// Guest output is collected and handed to the host in writes of this size.
+const size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+// Guest memory is tracked for reset() in pages of this many words (4 KiB).
+const uint32_t PAGE_WORDS = 1024;
+
+// Core-local interruptor (CLINT), memory-mapped outside guest RAM with the
+// usual SiFive layout.
+const uint32_t CLINT_BASE = 0x02000000;
+const uint32_t CLINT_MSIP = CLINT_BASE;                 // bit 0: software interrupt
+const uint32_t CLINT_MTIMECMP = CLINT_BASE + 0x4000;    // 64-bit, low word first
+const uint32_t CLINT_MTIME = CLINT_BASE + 0xBFF8;       // 64-bit, read-only here
+
+// mstatus and mip/mie bits of the machine-mode trap support.
+const uint32_t MSTATUS_MIE = 1u << 3;
+const uint32_t MSTATUS_MPIE = 1u << 7;
+const uint32_t MIP_MSIP = 1u << 3;      // software, from the CLINT's msip
+const uint32_t MIP_MTIP = 1u << 7;      // timer: mtime >= mtimecmp
+const uint32_t MIP_MEIP = 1u << 11;     // external, set_external_interrupt()
+// mcause exception codes. An interrupt sets MCAUSE_INTERRUPT on its mip
+// bit number.
+const uint32_t CAUSE_ILLEGAL_INSTRUCTION = 2;
+const uint32_t CAUSE_BREAKPOINT = 3;
+const uint32_t CAUSE_ECALL_M = 11;
+const uint32_t MCAUSE_INTERRUPT = 0x80000000;
 
 static const char* reg_names[32] = {
        "zero","ra","sp","gp","tp","t0","t1","t2",
@@ -24,6 +58,10 @@ static const char* reg_names[32] = {
        "s8","s9","s10","s11","t3","t4","t5","t6"
 };
 
+// Expands a 16-bit RV32C instruction into the equivalent 32-bit encoding.
+// Returns 0 (an illegal instruction) for reserved or unsupported encodings.
+uint32_t expand_compressed(uint16_t c);
+
 class Register
 {
     uint32_t value;
@@ -33,11 +71,77 @@ public:
     void write(uint32_t v);
     void reset();
 };
+// A data watchpoint over the byte range [start, end]. When has_value is set
+// the watchpoint only fires if the accessed value equals value.
+struct Watchpoint
+{
+    uint32_t start;
+    uint32_t end;
+    bool on_read;
+    bool on_write;
+    bool has_value;
+    uint32_t value;
+};
+
+enum class StopReason
+{
+    Halted,
+    Breakpoint,
+    Watchpoint,
+    Limit
+};
+
+// Instruction pairs the simulator can fuse, by their leading instruction.
+enum FusedIdiom
+{
+    FUSE_LUI_ADDI,      // lui rd, hi; addi rd, rd, lo
+    FUSE_AUIPC_JALR,    // auipc rd, hi; jalr ra, lo(rd)
+    FUSE_SLLI_ADD,      // slli t, i, k; add t, t, base
+    FUSE_ADDI_BNE,      // addi i, i, step; bne i, n, loop
+    FUSE_LW_LW,         // lw a, x(base); lw b, y(base)
+    FUSE_COUNT,
+    FUSE_NONE = FUSE_COUNT
+};
+
+// Outcome of Simulator::check_cycles().
+struct CycleCheck
+{
+    StopReason reason;          // Halted or Limit; Limit also when a mismatch stopped the run
+    uint64_t instructions;      // executed, including the mismatched one
+    bool match;
+    // The first instruction whose handler stepped a different number of
+    // cycles than the cost table charged, when match is false.
+    uint32_t pc;
+    uint32_t instr;             // as executed: RVC parcels are expanded
+    uint64_t table;
+    uint64_t stepped;
+};
+
 class Simulator
 {
-    uint32_t mem[MEM_SIZE] = { 0 };
+    // ───── Guest memory ─────
+    // mem is an anonymous mapping of MEM_SIZE words, so it starts out zeroed
+    // without a pass over it. Every store marks its page dirty; reset() puts
+    // back only those pages, from the snapshot if one was taken and as zeros
+    // otherwise.
+    uint32_t* mem;
+    size_t mapped_bytes;
+    bool huge_pages;
+    vector<uint64_t> dirty_pages;       // one bit per page
+    vector<uint32_t> pristine;          // the snapshot, or empty
+    vector<uint64_t> pristine_pages;    // pages that are non-zero in the snapshot
+    uint32_t pristine_pc;
+    uint32_t pristine_image_end;
+
+    void mark_dirty(uint32_t wordIndex) { dirty_pages[wordIndex / PAGE_WORDS / 64] |= 1ull << (wordIndex / PAGE_WORDS % 64); }
+    void map_memory();
+    void clear_pages(uint32_t first, uint32_t count);
+    void reset_state();
     array<Register, REG_COUNT> regfile;
     Register PC, MAR, MDR, IR, A, B, ALUOut;
+    // Address the current instruction was fetched from; PC has already
+    // advanced past it by the time branches and jumps execute.
+    uint32_t inst_pc;
 
     int clk;
     char clk_type;
@@ -45,22 +149,380 @@ class Simulator
     double delay;
     void reset_clk();
 
-    void R_type(uint32_t instr);
-    void S_type(uint32_t instr);
-    void B_type(uint32_t instr);
-    void J_type(uint32_t instr);
-    void I_type(uint32_t instr, uint32_t opcode);
-    void U_type(uint32_t instr, uint32_t opcode);
+    // Cycle totals since reset. cycle_count is charged from the cost table
+    // of cycles.h, one lookup per instruction, by every engine including
+    // fused pairs; clk_total adds up clk as the handlers step it, so fused
+    // pairs are missing from it. check_cycles() compares the two.
+    uint64_t cycle_count;
+    uint64_t clk_total;
+    uint64_t run_count;         // instructions the last run executed
+    // The table charged instr as if it completed; an instruction that is
+    // rejected or traps costs only the cycles its handler stepped before
+    // that (for an illegal encoding they can depend on frm and vtype).
+    void abandon_cycles(uint32_t instr) { cycle_count += uint64_t(clk) - instruction_cycles(instr); }
+
+    // ───── Debugger ─────
+    // One bit per halfword of guest memory for PC breakpoints and one bit
+    // per word for watchpoints, so the hot path costs a single bit test.
+    vector<uint64_t> break_map;
+    vector<uint64_t> watch_map;
+    vector<Watchpoint> watchpoints;
+    unordered_map<string, uint32_t> symbols;
+    bool headless;
+    bool debugging;
+    bool stepping;
+    bool watch_hit;
+    uint32_t watch_addr;
+    bool watch_was_write;
+    string watch_reason;
+
+    bool is_breakpoint(uint32_t addr) const
+    {
+        uint32_t bit = addr >> 1;
+        return bit < MEM_SIZE * 2 && ((break_map[bit >> 6] >> (bit & 63)) & 1);
+    }
+    bool is_watched(uint32_t wordIndex) const
+    {
+        return wordIndex < MEM_SIZE && ((watch_map[wordIndex >> 6] >> (wordIndex & 63)) & 1);
+    }
+    void check_watch(uint32_t addr, uint32_t size, bool isWrite, uint32_t value);
+    void rebuild_watch_map();
+    uint32_t resolve_location(const string& loc) const;
+    bool debug_prompt(const string& reason);
+
+    // ───── System calls ─────
+    string sandbox_dir;
+    unordered_map<uint32_t, int> guest_fds;
+    uint32_t next_guest_fd;
+    vector<char> out_buf;
+    int out_fd;
+    istream* console_in;        // guest fds 0, 1 and 2
+    ostream* console_out;
+    ostream* console_err;
+    uint32_t image_end;
+    uint32_t brk_addr;
+    int exit_status;
+
+    template <class Observe> bool ecall();
+    int32_t sys_write(uint32_t fd, uint32_t buf, uint32_t count);
+    int32_t sys_read(uint32_t fd, uint32_t buf, uint32_t count);
+    int32_t sys_openat(uint32_t path, uint32_t flags, uint32_t mode);
+    int32_t sys_close(uint32_t fd);
+    int32_t sys_brk(uint32_t addr);
+    int32_t sys_clock_gettime(uint32_t clockId, uint32_t tp, bool time64);
+    bool read_guest_string(uint32_t addr, string& out) const;
+    void note_image_end(uint32_t address);
+    void put_byte(uint32_t addr, uint8_t value)
+    {
+        int shift = (addr & 0x3) * 8;
+        mem[addr / 4] = (mem[addr / 4] & ~(0xFFu << shift)) | (uint32_t(value) << shift);
+        mark_dirty(addr / 4);
+    }
+
+    // ───── Vector (RVV subset, SEW=32) ─────
+    uint32_t vlen;
+    vector<uint32_t> vregs;     // 32 registers of vlen/32 elements, stored back to back
+    vector<uint32_t> vtmp;
+    uint32_t vl;
+    uint32_t vtype;
+    uint32_t vlmul;             // register group size: 1, 2, 4 or 8
+
+    uint32_t vlmax() const { return vlen / 32 * vlmul; }
+    uint32_t* vreg(uint32_t index) { return &vregs[index * (vlen / 32)]; }
+    template <class Observe> bool V_type(uint32_t instr);
+    template <class Observe> bool V_mem(uint32_t instr, bool isStore);
+    template <class Observe> void vsetvl(uint32_t rd, uint32_t avl, uint32_t newVtype, bool keepVl);
+    template <class Observe> uint32_t vmem_read(uint32_t addr);
+    template <class Observe> void vmem_write(uint32_t addr, uint32_t value);
+
+    // ───── Floating point (F extension) ─────
+    // FP registers are 64 bits wide and hold single-precision values
+    // NaN-boxed; a value that is not properly boxed reads as the canonical NaN.
+    array<uint64_t, 32> fregs;
+    uint32_t fflags;
+    uint32_t frm;
+
+    uint32_t read_freg(uint32_t index) const
+    {
+        uint64_t v = fregs[index];
+        return (v >> 32) == 0xFFFFFFFFu ? uint32_t(v) : 0x7FC00000u;
+    }
+    void write_freg(uint32_t index, uint32_t bits) { fregs[index] = 0xFFFFFFFF00000000ull | bits; }
+    bool set_host_rounding(uint32_t rm);
+    // Puts the host thread's rounding mode back when a run ends, so neither
+    // the host's own code nor another simulator on the thread inherits the
+    // guest's frm.
+    struct HostRounding
+    {
+        int saved = fegetround();
+        ~HostRounding() { fesetround(saved); }
+    };
+    template <class Observe> bool F_type(uint32_t instr);
+    bool F_fma(uint32_t instr, uint32_t opcode);
+    template <class Observe> void F_load(uint32_t instr);
+    template <class Observe> void F_store(uint32_t instr);
+
+    // ───── Macro-op fusion ─────
+    // Common two-instruction idioms run as one superinstruction in headless
+    // execution. Pairs are decoded once per fetch address and cached with the
+    // raw parcels they were decoded from; a store that changes either parcel
+    // is caught when the entry is next used and the pair is decoded again.
+    struct FusedPair
+    {
+        uint32_t raw1, raw2;    // memory at the two addresses, masked to the parcel size
+        uint8_t lead;           // idiom whose first instruction this is, or FUSE_NONE
+        bool fuses;             // the following instruction completes the idiom
+        uint8_t size1, size2;
+        uint8_t cycles;         // of the two instructions, from the cost table
+        uint8_t rd1, rs1;       // first instruction
+        uint8_t rd2, rs2a, rs2b;    // second instruction
+        int32_t imm1, imm2;
+    };
+    bool fusion;
+    vector<FusedPair> fusion_cache;     // one entry per halfword, allocated on first use
+    array<uint64_t, FUSE_COUNT> fusion_leads;
+    array<uint64_t, FUSE_COUNT> fusion_hits;
+
+    uint32_t fetch_expanded(uint32_t addr, uint8_t& size) const;
+    void decode_pair(uint32_t pc, FusedPair& entry) const;
+    bool fused_step();
+
+    // ───── Observers ─────
+    // Events are appended to per-kind buffers and handed over every
+    // observer_batch instructions. The core records them only in the
+    // ObservedPolicy instantiation. The extension handlers and traps are
+    // instantiated on the Observe policy alone (Observed or Unobserved).
+    vector<SimObserver*> observers;
+    size_t observer_batch;
+    uint64_t event_seq;
+    uint32_t inst_word;         // instruction being executed, for its retire event
+    vector<RetireEvent> retire_events;
+    vector<MemoryEvent> memory_events;
+    vector<RegisterEvent> register_events;
+    vector<BranchEvent> branch_events;
+    vector<TrapEvent> trap_events;
+
+    void note_memory(uint32_t addr, uint32_t value, uint8_t size, bool write)
+    {
+        memory_events.push_back({ event_seq, inst_pc, addr, value, size, write });
+    }
+    void note_branch(uint32_t target, bool taken, bool conditional)
+    {
+        branch_events.push_back({ event_seq, inst_pc, target, taken, conditional });
+    }
+    void note_step(bool halted);
+    void flush_events();
+    StopReason run_observed(uint64_t maxInstructions, bool resuming);
+    // Register write-back, reported to observers. Callers skip x0.
+    template <class Observe> void write_back(uint32_t rd, uint32_t value)
+    {
+        regfile[rd].write(value);
+        if constexpr (Observe::enabled)
+            register_events.push_back({ event_seq, inst_pc, rd, value });
+    }
+    template <class P> void write_reg(uint32_t rd, uint32_t value)
+    {
+        write_back<typename P::Observe>(rd, value);
+    }
+
+    // ───── Machine-mode traps and the CLINT ─────
+    // Traps go to the guest only once it has put a handler in mtvec; until
+    // then ecall is serviced by the host and illegal instructions halt. An
+    // ecall made by the handler itself (between trap entry and mret) is
+    // still serviced by the host, so a handler can forward system calls.
+    // mtime advances once per retired instruction. Device deadlines live in
+    // a timer wheel and the run loops compare mtime with next_event, the
+    // earliest of them, so nothing is polled between events.
+    uint32_t mstatus;           // MIE and MPIE; MPP always reads as M
+    uint32_t mie;
+    uint32_t mtvec;
+    uint32_t mscratch;
+    uint32_t mepc;
+    uint32_t mcause;
+    uint32_t mtval;
+    bool in_trap;
+    bool trap_taken;            // the current instruction trapped instead of retiring
+    bool external_irq;
+    uint32_t msip;
+    uint64_t mtimecmp;
+    uint64_t mtimecmp_event;    // wheel id of the mtimecmp deadline, or 0
+    uint64_t mtime;
+    uint64_t next_event;
+    TimerWheel timers;
+
+    uint32_t pending_interrupts() const;   // mip
+    template <class Observe> void take_trap(uint32_t cause, uint32_t tval, uint32_t epc);
+    template <class Observe> bool illegal_instruction(uint32_t instr);
+    template <class Observe> bool environment_call();
+    bool mret();
+    bool wfi();
+    // Has the run loop call service_events() before the next instruction,
+    // e.g. after a write that may enable or raise an interrupt.
+    void poll_interrupts() { next_event = mtime; }
+    template <class Observe> void service_events();
+    uint32_t clint_read(uint32_t addr) const;
+    void clint_write(uint32_t addr, uint32_t data, int funct3);
+    void set_mtimecmp(uint64_t value);
+
+    // ───── CSRs ─────
+    template <class Observe> bool CSR_type(uint32_t instr);
+    bool csr_read(uint32_t csr, uint32_t& value);
+    bool csr_write(uint32_t csr, uint32_t value);
+
+    // ───── Execution core, specialised on an ExecPolicy ─────
+    template <class P> void show()
+    {
+        if constexpr (P::Display::enabled)
+            display_state();
+        if constexpr (P::Pacing::enabled)
+        {
+            if (clk_type == 'A')
+                pause();
+            else
+                wait_for_user();
+        }
+    }
+    // Latches value into a micro-register when the policy keeps them.
+    template <class P> uint32_t stage(Register& reg, uint32_t value)
+    {
+        if constexpr (P::Staging::enabled)
+            reg.write(value);
+        return value;
+    }
+    // Whether wordIndex may be accessed; unchecked wraps it into memory.
+    template <class P> bool in_memory(uint32_t& wordIndex) const
+    {
+        if constexpr (P::MemCheck::enabled)
+            return wordIndex < MEM_SIZE;
+        else
+        {
+            wordIndex &= MEM_SIZE - 1;
+            return true;
+        }
+    }
+    template <class P> uint32_t fetch_half(uint32_t address) const
+    {
+        uint32_t index = address / 4;
+        return in_memory<P>(index) ? (mem[index] >> ((address & 0x2) * 8)) & 0xFFFF : 0;
+    }
+    template <class P> bool step();
+    template <class P> StopReason run_loop(uint64_t maxInstructions, bool resuming);
+    template <class P> void R_type(uint32_t instr);
+    template <class P> void S_type(uint32_t instr);
+    template <class P> void B_type(uint32_t instr);
+    template <class P> void J_type(uint32_t instr);
+    template <class P> void I_type(uint32_t instr, uint32_t opcode);
+    template <class P> int32_t load(uint32_t addr, int funct3) const;
+    template <class P> void U_type(uint32_t instr, uint32_t opcode);
 
     void choose_clk_type();
     void pause();
     void wait_for_user();
+    void display_state();
 public:
-    Simulator();
+    // With hugePages the guest memory is first requested as huge pages;
+    // ordinary pages are used if that fails.
+    explicit Simulator(bool hugePages = false);
+    ~Simulator();
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
     void load_program(const string& path);
+    // Copies every chunk into memory and sets PC to the entry point.
+    void load_image(const ProgramImage& image);
     void print_state();
     void start();
     void writeWord(uint32_t input, uint32_t address);
     void writeHalf(uint16_t input, uint32_t address);
     void writeByte(uint8_t input, uint32_t address);
+
+    void set_symbols(const unordered_map<string, uint32_t>& table);
+    void add_breakpoint(uint32_t addr);
+    void remove_breakpoint(uint32_t addr);
+    void add_watchpoint(const Watchpoint& wp);
+    void remove_watchpoint(uint32_t start, uint32_t end, bool onRead, bool onWrite);
+    void clear_watchpoints();
+
+    // Headless execution and state access used by external debuggers.
+    StopReason run(uint64_t maxInstructions, bool resuming = true);
+    // Like run() for programs that stay inside guest memory: addresses are
+    // not bounds-checked, so the CLINT cannot be reached either. With
+    // watchpoints set it behaves exactly as run().
+    StopReason run_unchecked(uint64_t maxInstructions, bool resuming = true);
+    // The multi-cycle model's clock cycles since reset: what the CLOCK CYCLE
+    // counter of the interactive view would have added up to, counting
+    // fused pairs as their two instructions and each trap entry as one.
+    uint64_t cycles() const { return cycle_count; }
+    // Instructions the last run() or run_unchecked() executed, including the
+    // one that halted it; a fused pair counts as two.
+    uint64_t last_run_instructions() const { return run_count; }
+    // The cycle check: runs like run() on the staged engine, without fusion
+    // or breakpoints, and after every instruction compares the cycles the
+    // cost table charged with the ones the handlers stepped. Stops at the
+    // first disagreement.
+    CycleCheck check_cycles(uint64_t maxInstructions);
+    uint32_t last_watch_addr() const { return watch_addr; }
+    bool last_watch_was_write() const { return watch_was_write; }
+    uint32_t get_reg(int index) const { return regfile[index].read(); }
+    void set_reg(int index, uint32_t value) { if (index != 0) regfile[index].write(value); }
+    uint32_t get_pc() const { return PC.read(); }
+    void set_pc(uint32_t value) { PC.write(value); }
+    bool readByte(uint32_t address, uint8_t& out) const;
+    uint32_t read_half(uint32_t address) const;
+
+    uint32_t read_word(uint32_t address) const { return read_half(address) | (read_half(address + 2) << 16); }
+    void write_memory(uint32_t address, const uint8_t* data, size_t size);
+    bool read_memory(uint32_t address, uint8_t* data, size_t size) const;
+
+    void set_sandbox(const string& dir) { sandbox_dir = dir; }
+    // Redirects the guest's stdin/stdout/stderr, e.g. to string streams when
+    // the simulator is embedded.
+    void set_console(istream* in, ostream* out, ostream* err) { console_in = in; console_out = out; console_err = err; }
+    void flush_output();
+    int exit_code() const { return exit_status; }
+
+    // VLEN in bits: a power of two from 32 to 4096. Clears the vector state.
+    void set_vlen(uint32_t bits);
+    uint32_t get_vreg_element(uint32_t reg, uint32_t index) const { return vregs[reg * (vlen / 32) + index]; }
+    uint32_t get_freg(int index) const { return read_freg(index); }
+    void set_freg(int index, uint32_t bits) { write_freg(index, bits); }
+    uint32_t get_fcsr() const { return (frm << 5) | fflags; }
+
+    // The CLINT's mtime: one tick per retired instruction.
+    uint64_t get_mtime() const { return mtime; }
+    // Runs callback once mtime has advanced by ticks, between instructions.
+    // Returns an id for cancel_event(). For devices of an embedding program,
+    // which can raise the external interrupt from the callback.
+    uint64_t schedule_event(uint64_t ticks, function<void()> callback);
+    void cancel_event(uint64_t id) { timers.cancel(id); }
+    // Level of the machine external interrupt line (mip.MEIP).
+    void set_external_interrupt(bool raised);
+
+    // Fusion only changes headless runs: run() and run-until-break mode.
+    void set_fusion(bool enabled);
+
+    // Observers are not owned and stay attached across reset(). Only run()
+    // and run_unchecked() report events; an observed run uses the checked
+    // engine and does not fuse instructions. Without observers neither run
+    // pays anything for the feature.
+    void add_observer(SimObserver* observer);
+    void remove_observer(SimObserver* observer);
+    // Instructions per delivery to the observers; at least 1.
+    void set_observer_batch(size_t instructions) { observer_batch = instructions ? instructions : 1; }
+
+    // Takes the current memory and PC as the state reset() returns to, e.g.
+    // right after load_image().
+    void snapshot();
+    // Returns registers, CSRs, trap and CLINT state, cycle counts, vector
+    // state, open files, exit status and the dirty memory pages to the
+    // snapshot, or to a newly constructed simulator without one. Scheduled
+    // events are dropped. The cost is proportional to the pages written since
+    // the last reset. Breakpoints, watchpoints, the console, sandbox, VLEN and
+    // fusion setting are kept.
+    void reset();
+    size_t dirty_page_count() const;
+    // Per idiom, how often its leading instruction executed and how often the
+    // pair was fused.
+    uint64_t fusion_candidates(FusedIdiom idiom) const { return fusion_leads[idiom]; }
+    uint64_t fusion_fused(FusedIdiom idiom) const { return fusion_hits[idiom]; }
+    void print_fusion_report(ostream& out) const;
 };
@@ -0,0 +1,103 @@
+﻿#include "symboltable.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+SymbolTable::SymbolTable(const SymbolTable& other)
+{
+    *this = other;
+}
+
+// Copies re-intern every name so the views point into this table's arena.
+SymbolTable& SymbolTable::operator=(const SymbolTable& other)
+{
+    if (this == &other)
+        return *this;
+    blocks.clear();
+    blockUsed = BLOCK_SIZE;
+    index.clear();
+    names.clear();
+    addresses = other.addresses;
+    lines = other.lines;
+    locals = other.locals;
+    for (string_view name : other.names)
+    {
+        names.push_back(store(name));
+        index[names.back()] = uint32_t(names.size() - 1);
+    }
+    return *this;
+}
+
+string_view SymbolTable::store(string_view name)
+{
+    if (name.size() > BLOCK_SIZE - blockUsed)
+    {
+        blocks.emplace_back(new char[max(BLOCK_SIZE, name.size())]);
+        blockUsed = 0;
+    }
+    char* dst = blocks.back().get() + blockUsed;
+    memcpy(dst, name.data(), name.size());
+    blockUsed += name.size();
+    return string_view(dst, name.size());
+}
+
+uint32_t SymbolTable::intern(string_view name, bool local)
+{
+    auto it = index.find(name);
+    if (it != index.end())
+        return it->second;
+    uint32_t id = uint32_t(names.size());
+    names.push_back(store(name));
+    addresses.push_back(0);
+    lines.push_back(UNDEFINED);
+    locals.push_back(local);
+    index.emplace(names.back(), id);
+    return id;
+}
+
+uint32_t SymbolTable::find(string_view name) const
+{
+    auto it = index.find(name);
+    return (it != index.end()) ? it->second : NO_SYMBOL;
+}
+
+void SymbolTable::define(uint32_t id, uint32_t address, int line)
+{
+    if (defined(id))
+    {
+        string message = "duplicate label '" + string(names[id]) + "'";
+        if (lines[id] > 0)
+            message += " (first defined on line " + to_string(lines[id]) + ")";
+        throw runtime_error(message);
+    }
+    addresses[id] = address;
+    lines[id] = line;
+}
+
+void SymbolTable::reset_definitions()
+{
+    fill(lines.begin(), lines.end(), UNDEFINED);
+}
+
+bool SymbolTable::hasLabel(const string& label) const
+{
+    uint32_t id = find(label);
+    return id != NO_SYMBOL && defined(id);
+}
+
+uint32_t SymbolTable::getAddress(const string& label) const
+{
+    uint32_t id = find(label);
+    if (id == NO_SYMBOL || !defined(id))
+        throw runtime_error("undefined label '" + label + "'");
+    return addresses[id];
+}
+
+unordered_map<string, uint32_t> SymbolTable::to_map() const
+{
+    unordered_map<string, uint32_t> map;
+    for (uint32_t id = 0; id < size(); id++)
+        if (defined(id) && !locals[id])
+            map.emplace(string(names[id]), addresses[id]);
+    return map;
+}
@@ -1,11 +1,70 @@
 #pragma once
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Label names are interned once into an arena and identified by a dense id;
+// addresses live in a flat vector indexed by that id, so resolving a label
+// the assembler has already seen is an array access rather than a string
+// hash. Ids stay valid across reset_definitions(), which is what lets the
+// incremental assembler keep them in its per-line records.
 class SymbolTable {
-    unordered_map<string, uint32_t> table;
 public:
-    void addLabel(const string& label, uint32_t address) { table[label] = address; }
-    bool hasLabel(const string& label) const { return table.find(label) != table.end(); }
-    uint32_t getAddress(const string& label) const {
-        auto it = table.find(label);
-        return (it != table.end()) ? it->second : 0;
-    }
-};
\ No newline at end of file
+    static constexpr uint32_t NO_SYMBOL = 0xFFFFFFFF;
+
+    SymbolTable() = default;
+    SymbolTable(const SymbolTable& other);
+    SymbolTable& operator=(const SymbolTable& other);
+    SymbolTable(SymbolTable&&) = default;
+    SymbolTable& operator=(SymbolTable&&) = default;
+
+    // Returns the id for name, creating an undefined symbol if needed.
+    uint32_t intern(string_view name, bool local = false);
+    // Returns the id for name, or NO_SYMBOL.
+    uint32_t find(string_view name) const;
+
+    // Throws runtime_error if the symbol is already defined.
+    void define(uint32_t id, uint32_t address, int line = 0);
+    // Defines or moves a symbol that may be defined repeatedly, such as a
+    // numeric local label in the streaming assembler.
+    void rebind(uint32_t id, uint32_t address, int line = 0) { addresses[id] = address; lines[id] = line; }
+    // Forgets every address but keeps the names and ids.
+    void reset_definitions();
+
+    bool defined(uint32_t id) const { return lines[id] != UNDEFINED; }
+    uint32_t address(uint32_t id) const { return addresses[id]; }
+    int line(uint32_t id) const { return lines[id]; }
+    bool local(uint32_t id) const { return locals[id]; }
+    string_view name(uint32_t id) const { return names[id]; }
+    uint32_t size() const { return uint32_t(names.size()); }
+
+    // Name-based helpers. getAddress throws for an undefined label.
+    void addLabel(const string& label, uint32_t address) { define(intern(label), address); }
+    bool hasLabel(const string& label) const;
+    uint32_t getAddress(const string& label) const;
+
+    // Defined global labels, for the debugger's symbolic addresses.
+    unordered_map<string, uint32_t> to_map() const;
+
+private:
+    static constexpr int UNDEFINED = -1;
+    static constexpr size_t BLOCK_SIZE = 64 * 1024;
+
+    vector<unique_ptr<char[]>> blocks;  // the arena; names never move
+    size_t blockUsed = BLOCK_SIZE;
+    unordered_map<string_view, uint32_t> index;
+    vector<string_view> names;
+    vector<uint32_t> addresses;
+    vector<int> lines;                  // definition line, or UNDEFINED
+    vector<bool> locals;
+
+    string_view store(string_view name);
+};
+
+#endif
@@ -0,0 +1,311 @@
+﻿#include "simulator.h"
+#include <fcntl.h>
+#include <cerrno>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#define host_open _open
+#define host_read _read
+#define host_write _write
+#define host_close _close
+#else
+#include <unistd.h>
+#define host_open open
+#define host_read read
+#define host_write write
+#define host_close close
+#endif
+
+// Linux/newlib RISC-V system call numbers, passed in a7.
+const uint32_t SYS_OPENAT = 56;
+const uint32_t SYS_CLOSE = 57;
+const uint32_t SYS_READ = 63;
+const uint32_t SYS_WRITE = 64;
+const uint32_t SYS_EXIT = 93;
+const uint32_t SYS_EXIT_GROUP = 94;
+const uint32_t SYS_CLOCK_GETTIME = 113;
+const uint32_t SYS_BRK = 214;
+const uint32_t SYS_CLOCK_GETTIME64 = 403;
+
+// Linux open flags as seen by the guest.
+const uint32_t GUEST_O_ACCMODE = 0x3;
+const uint32_t GUEST_O_CREAT = 0x40;
+const uint32_t GUEST_O_TRUNC = 0x200;
+const uint32_t GUEST_O_APPEND = 0x400;
+
+// The guest stack grows down from the top of memory; brk may not come
+// closer to it than this.
+const uint32_t STACK_RESERVE = 16 * 1024;
+
+void Simulator::note_image_end(uint32_t address)
+{
+    if (address > image_end)
+        image_end = address;
+}
+
+// Cycle 4 of ECALL: dispatch on a7 with arguments in a0-a3 (only openat
+// uses a3) and the result written back to a0. Returns true if the guest
+// exited.
+template <class Observe>
+bool Simulator::ecall()
+{
+    clk++;
+    uint32_t num = regfile[17].read();
+    uint32_t a0 = regfile[10].read();
+    uint32_t a1 = regfile[11].read();
+    uint32_t a2 = regfile[12].read();
+    int32_t ret;
+
+    switch (num)
+    {
+    case SYS_WRITE:
+        ret = sys_write(a0, a1, a2);
+        break;
+    case SYS_READ:
+        ret = sys_read(a0, a1, a2);
+        break;
+    case SYS_OPENAT:
+        // dirfd (a0) is ignored: paths are always relative to the sandbox.
+        ret = sys_openat(a1, a2, regfile[13].read());
+        break;
+    case SYS_CLOSE:
+        ret = sys_close(a0);
+        break;
+    case SYS_BRK:
+        ret = sys_brk(a0);
+        break;
+    case SYS_CLOCK_GETTIME:
+        ret = sys_clock_gettime(a0, a1, false);
+        break;
+    case SYS_CLOCK_GETTIME64:
+        ret = sys_clock_gettime(a0, a1, true);
+        break;
+    case SYS_EXIT:
+    case SYS_EXIT_GROUP:
+        exit_status = int32_t(a0);
+        flush_output();
+        print_state();
+        reset_clk();
+        return true;
+    default:
+        ret = -ENOSYS;
+        break;
+    }
+
+    write_back<Observe>(10, uint32_t(ret));
+    print_state();
+    reset_clk();
+    return false;
+}
+
+template bool Simulator::ecall<Observed>();
+template bool Simulator::ecall<Unobserved>();
+
+void Simulator::flush_output()
+{
+    if (out_buf.empty())
+        return;
+    if (out_fd == 1)
+    {
+        console_out->write(out_buf.data(), out_buf.size());
+        console_out->flush();
+    }
+    else if (out_fd == 2)
+    {
+        console_err->write(out_buf.data(), out_buf.size());
+    }
+    else
+    {
+        size_t done = 0;
+        while (done < out_buf.size())
+        {
+            int n = host_write(out_fd, out_buf.data() + done, unsigned(out_buf.size() - done));
+            if (n <= 0)
+                break;
+            done += n;
+        }
+    }
+    out_buf.clear();
+}
+
+// Output for every descriptor goes through one buffer. It is flushed when it
+// fills, when the guest switches descriptors, reads, closes or exits.
+int32_t Simulator::sys_write(uint32_t fd, uint32_t buf, uint32_t count)
+{
+    int hostFd;
+    if (fd == 1 || fd == 2)
+        hostFd = int(fd);
+    else
+    {
+        auto it = guest_fds.find(fd);
+        if (it == guest_fds.end())
+            return -EBADF;
+        hostFd = it->second;
+    }
+    if (buf / 4 >= MEM_SIZE || count > MEM_SIZE * 4 - buf)
+        return -EFAULT;
+
+    if (hostFd != out_fd)
+    {
+        flush_output();
+        out_fd = hostFd;
+    }
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t addr = buf + i;
+        out_buf.push_back(char(mem[addr / 4] >> ((addr % 4) * 8)));
+    }
+    if (out_buf.size() >= OUTPUT_BUFFER_SIZE)
+        flush_output();
+    return int32_t(count);
+}
+
+int32_t Simulator::sys_read(uint32_t fd, uint32_t buf, uint32_t count)
+{
+    int hostFd;
+    if (fd == 0)
+        hostFd = 0;
+    else
+    {
+        auto it = guest_fds.find(fd);
+        if (it == guest_fds.end())
+            return -EBADF;
+        hostFd = it->second;
+    }
+    if (buf / 4 >= MEM_SIZE || count > MEM_SIZE * 4 - buf)
+        return -EFAULT;
+
+    // Make any pending prompt visible before blocking on input.
+    flush_output();
+
+    vector<char> tmp(count);
+    int n = 0;
+    if (hostFd == 0)
+    {
+        // Like a terminal, stdin reads return at most one line.
+        char c;
+        while (uint32_t(n) < count && console_in->get(c))
+        {
+            tmp[n++] = c;
+            if (c == '\n')
+                break;
+        }
+    }
+    else
+    {
+        n = host_read(hostFd, tmp.data(), count);
+        if (n < 0)
+            return -errno;
+    }
+    for (int i = 0; i < n; i++)
+        put_byte(buf + i, uint8_t(tmp[i]));
+    return n;
+}
+
+bool Simulator::read_guest_string(uint32_t addr, string& out) const
+{
+    out.clear();
+    uint8_t c;
+    while (readByte(addr++, c))
+    {
+        if (c == 0)
+            return true;
+        out += char(c);
+        if (out.size() > 4096)
+            return false;
+    }
+    return false;
+}
+
+// Guest paths must be relative and may not contain "..", so every file the
+// guest can open lives under sandbox_dir.
+int32_t Simulator::sys_openat(uint32_t path, uint32_t flags, uint32_t mode)
+{
+    string name;
+    if (!read_guest_string(path, name))
+        return -EFAULT;
+    if (name.empty() || name[0] == '/' || name[0] == '\\' || name.find(':') != string::npos)
+        return -EACCES;
+    size_t begin = 0;
+    while (begin <= name.size())
+    {
+        size_t end = name.find_first_of("/\\", begin);
+        if (end == string::npos)
+            end = name.size();
+        if (name.compare(begin, end - begin, "..") == 0)
+            return -EACCES;
+        begin = end + 1;
+    }
+
+    int hostFlags = 0;
+    switch (flags & GUEST_O_ACCMODE)
+    {
+    case 0: hostFlags = O_RDONLY; break;
+    case 1: hostFlags = O_WRONLY; break;
+    default: hostFlags = O_RDWR; break;
+    }
+    if (flags & GUEST_O_CREAT) hostFlags |= O_CREAT;
+    if (flags & GUEST_O_TRUNC) hostFlags |= O_TRUNC;
+    if (flags & GUEST_O_APPEND) hostFlags |= O_APPEND;
+#ifdef _WIN32
+    hostFlags |= O_BINARY;
+#endif
+
+    int hostFd = host_open((sandbox_dir + "/" + name).c_str(), hostFlags, mode & 0777);
+    if (hostFd < 0)
+        return -errno;
+    uint32_t fd = next_guest_fd++;
+    guest_fds[fd] = hostFd;
+    return int32_t(fd);
+}
+
+int32_t Simulator::sys_close(uint32_t fd)
+{
+    if (fd <= 2)
+        return 0;
+    auto it = guest_fds.find(fd);
+    if (it == guest_fds.end())
+        return -EBADF;
+    if (it->second == out_fd)
+        flush_output();
+    host_close(it->second);
+    guest_fds.erase(it);
+    return 0;
+}
+
+// The heap starts at the first 16-byte boundary after the loaded image.
+// brk(0) queries the break; a request outside the heap leaves it unchanged.
+int32_t Simulator::sys_brk(uint32_t addr)
+{
+    if (brk_addr == 0)
+        brk_addr = (image_end + 15) & ~15u;
+    uint32_t heapStart = (image_end + 15) & ~15u;
+    if (addr >= heapStart && addr <= MEM_SIZE * 4 - STACK_RESERVE)
+        brk_addr = addr;
+    return int32_t(brk_addr);
+}
+
+// Clock 0 is wall time and every other id is treated as monotonic. The
+// 32-bit call stores a newlib timespec (64-bit seconds, 32-bit nanoseconds),
+// the time64 call a kernel timespec with 64-bit nanoseconds.
+int32_t Simulator::sys_clock_gettime(uint32_t clockId, uint32_t tp, bool time64)
+{
+    if (tp / 4 >= MEM_SIZE || tp + (time64 ? 16 : 12) > MEM_SIZE * 4)
+        return -EFAULT;
+
+    int64_t ns;
+    if (clockId == 0)
+        ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::system_clock::now().time_since_epoch()).count();
+    else
+        ns = chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+
+    uint64_t sec = uint64_t(ns / 1000000000);
+    uint64_t nsec = uint64_t(ns % 1000000000);
+    for (int i = 0; i < 8; i++)
+        put_byte(tp + i, uint8_t(sec >> (i * 8)));
+    for (int i = 0; i < (time64 ? 8 : 4); i++)
+        put_byte(tp + 8 + i, uint8_t(nsec >> (i * 8)));
+    return 0;
+}
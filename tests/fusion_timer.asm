@@ -0,0 +1,38 @@
+# A timer interrupt that falls due between the two instructions of a fusable
+# lui+addi pair is taken between them, with or without --fusion: the handler
+# sees the lui done and the addi not, and mret resumes at the addi.
+# expect: a0 = 0x12345678
+# expect: s2 = 0x12345000
+# expect: s1 = 0
+# expect: exit = 0
+main:
+    # instructions 0-2: mtvec
+    la t0, handler
+    csrw mtvec, t0
+    # 3-6: mtimecmp (0x02004000) = 12, due before instruction 12
+    lui t1, 0x2004
+    addi t2, x0, 12
+    sw t2, 0(t1)
+    sw x0, 4(t1)
+    # 7-9: MTIE and MIE
+    addi t3, x0, 128
+    csrw mie, t3
+    csrsi mstatus, 8
+    # 10-12: the pair
+    nop
+    lui a0, 0x12345
+second:
+    addi a0, a0, 0x678
+    ebreak
+
+    # mtvec ignores its low two bits
+    .align 2
+handler:
+    csrr s1, mepc
+    la t4, second
+    sub s1, s1, t4
+    mv s2, a0
+    # disarm the timer
+    addi t2, x0, -1
+    sw t2, 4(t1)
+    mret
@@ -0,0 +1,113 @@
+﻿#include "timerwheel.h"
+#include "bitops.h"
+
+// Lowest set bit of a non-zero slot mask.
+static int lowest_slot(uint64_t mask)
+{
+    uint32_t low = uint32_t(mask);
+    return low ? int(host_ctz(low)) : 32 + int(host_ctz(uint32_t(mask >> 32)));
+}
+
+void TimerWheel::clear()
+{
+    current = 0;
+    next_id = 1;
+    for (int level = 0; level < LEVELS; level++)
+    {
+        for (vector<Event>& slot : slots[level])
+            slot.clear();
+        occupied[level] = 0;
+    }
+    overflow.clear();
+    live.clear();
+}
+
+uint64_t TimerWheel::schedule(uint64_t deadline, Callback callback)
+{
+    uint64_t id = next_id++;
+    live.insert(id);
+    place({ deadline, id, move(callback) });
+    return id;
+}
+
+// Cancelled events stay in their slot until it comes up and are dropped then.
+void TimerWheel::cancel(uint64_t id)
+{
+    live.erase(id);
+}
+
+// An event that is already due goes into the level 0 slot of the current
+// tick.
+void TimerWheel::place(Event&& event)
+{
+    uint64_t key = event.deadline > current ? event.deadline : current;
+    uint64_t diff = key ^ current;
+    for (int level = 0; level < LEVELS; level++)
+    {
+        if ((diff >> (SLOT_BITS * (level + 1))) != 0)
+            continue;
+        int slot = int(key >> (SLOT_BITS * level)) & (SLOTS - 1);
+        slots[level][slot].push_back(move(event));
+        occupied[level] |= 1ull << slot;
+        return;
+    }
+    overflow.push_back(move(event));
+}
+
+// Every occupied slot lies after the current one on its level, and a level
+// only starts where the level below ends, so the first occupied slot of the
+// lowest non-empty level is the earliest.
+uint64_t TimerWheel::next_deadline() const
+{
+    for (int level = 0; level < LEVELS; level++)
+    {
+        if (occupied[level] == 0)
+            continue;
+        int span = SLOT_BITS * (level + 1);
+        uint64_t base = (current >> span) << span;
+        return base | (uint64_t(lowest_slot(occupied[level])) << (SLOT_BITS * level));
+    }
+    if (!overflow.empty())
+    {
+        int span = SLOT_BITS * LEVELS;
+        return ((current >> span) + 1) << span;
+    }
+    return NEVER;
+}
+
+void TimerWheel::advance(uint64_t now)
+{
+    for (;;)
+    {
+        uint64_t next = next_deadline();
+        if (next == NEVER || next > now)
+            break;
+        current = next;
+
+        int level = 0;
+        while (level < LEVELS && occupied[level] == 0)
+            level++;
+        vector<Event> events;
+        if (level == LEVELS)
+        {
+            events.swap(overflow);
+        }
+        else
+        {
+            int slot = lowest_slot(occupied[level]);
+            events.swap(slots[level][slot]);
+            occupied[level] &= ~(1ull << slot);
+        }
+
+        // Level 0 is exact: the slot is due. Anything higher moves down.
+        for (Event& event : events)
+        {
+            if (level != 0)
+                place(move(event));
+            else if (live.erase(event.id))
+                event.callback();
+        }
+    }
+    if (now > current)
+        current = now;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#include <cstdint>
+#include <functional>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+// Device events keyed on a 64-bit tick count (the simulator's mtime). A
+// hierarchical wheel of LEVELS levels of 64 slots: level L holds the events
+// whose deadline agrees with the current time in every bit above 6 * (L + 1),
+// so level 0 is exact to the tick and each higher level covers 64 times the
+// span of the one below. Events further out than the whole wheel wait in an
+// overflow list. Scheduling and firing are O(1) per level an event moves
+// through, and next_deadline() is a bit scan, which is what lets the run loop
+// compare one counter against it instead of polling every device.
+class TimerWheel
+{
+public:
+    using Callback = function<void()>;
+    static const uint64_t NEVER = ~uint64_t(0);
+
+    TimerWheel() { clear(); }
+
+    // Drops every event and sets the current time to 0.
+    void clear();
+    // Runs callback once the time reaches deadline; a deadline that has
+    // already passed fires at the next advance(). Returns an id for cancel().
+    uint64_t schedule(uint64_t deadline, Callback callback);
+    void cancel(uint64_t id);
+    // Fires, in deadline order, every event due at or before now. Callbacks
+    // may schedule further events.
+    void advance(uint64_t now);
+    // No event fires before this tick. Exact when the earliest event is
+    // within 64 ticks; otherwise the start of its slot, where advance()
+    // moves it down a level.
+    uint64_t next_deadline() const;
+    bool empty() const { return live.empty(); }
+
+private:
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 4;
+
+    struct Event
+    {
+        uint64_t deadline;
+        uint64_t id;
+        Callback callback;
+    };
+
+    uint64_t current;
+    uint64_t next_id;
+    vector<Event> slots[LEVELS][SLOTS];
+    uint64_t occupied[LEVELS];          // one bit per non-empty slot
+    vector<Event> overflow;
+    unordered_set<uint64_t> live;       // scheduled and not yet fired or cancelled
+
+    void place(Event&& event);
+};
+
+#endif
@@ -0,0 +1,189 @@
+﻿#include "simulator.h"
+
+uint32_t Simulator::pending_interrupts() const
+{
+    uint32_t mip = 0;
+    if (msip & 1)
+        mip |= MIP_MSIP;
+    if (mtime >= mtimecmp)
+        mip |= MIP_MTIP;
+    if (external_irq)
+        mip |= MIP_MEIP;
+    return mip;
+}
+
+// Enters the handler at mtvec. epc is the instruction that trapped or, for
+// an interrupt, the one to resume at after mret.
+template <class Observe>
+void Simulator::take_trap(uint32_t cause, uint32_t tval, uint32_t epc)
+{
+    // One cycle: mepc ← epc, mcause ← cause, MPIE ← MIE, MIE ← 0, PC ← mtvec
+    clk++;
+    cycle_count += TRAP_ENTRY_CYCLES;
+    mepc = epc;
+    mcause = cause;
+    mtval = tval;
+    mstatus = (mstatus & MSTATUS_MIE) ? MSTATUS_MPIE : 0;
+    uint32_t base = mtvec & ~0x3u;
+    bool vectored = (mtvec & 0x1) && (cause & MCAUSE_INTERRUPT);
+    PC.write(vectored ? base + 4 * (cause & ~MCAUSE_INTERRUPT) : base);
+    in_trap = true;
+    if constexpr (Observe::enabled)
+    {
+        trap_events.push_back({ event_seq, epc, cause });
+        trap_taken = !(cause & MCAUSE_INTERRUPT);
+    }
+    print_state();
+    reset_clk();
+}
+
+// An instruction the simulator cannot execute. Returns true (halt) when the
+// guest has no trap handler.
+template <class Observe>
+bool Simulator::illegal_instruction(uint32_t instr)
+{
+    abandon_cycles(instr);
+    if (mtvec == 0)
+        return true;
+    take_trap<Observe>(CAUSE_ILLEGAL_INSTRUCTION, instr, inst_pc);
+    return false;
+}
+
+template bool Simulator::illegal_instruction<Observed>(uint32_t);
+template bool Simulator::illegal_instruction<Unobserved>(uint32_t);
+
+template <class Observe>
+bool Simulator::environment_call()
+{
+    if (mtvec == 0 || in_trap)
+        return ecall<Observe>();
+    abandon_cycles(0x00000073);     // the host's cycle is not spent
+    take_trap<Observe>(CAUSE_ECALL_M, 0, inst_pc);
+    return false;
+}
+
+template bool Simulator::environment_call<Observed>();
+template bool Simulator::environment_call<Unobserved>();
+
+bool Simulator::mret()
+{
+    // Cycle 4: PC ← mepc, MIE ← MPIE, MPIE ← 1
+    clk++;
+    PC.write(mepc);
+    mstatus = MSTATUS_MPIE | ((mstatus & MSTATUS_MPIE) ? MSTATUS_MIE : 0);
+    in_trap = false;
+    poll_interrupts();
+    print_state();
+    reset_clk();
+    return false;
+}
+
+// Until an enabled interrupt is pending nothing can happen before the next
+// device event, so rather than the guest spinning on wfi the clock jumps to
+// it. The wfi itself takes the last tick.
+bool Simulator::wfi()
+{
+    if (!(pending_interrupts() & mie))
+    {
+        uint64_t next = timers.next_deadline();
+        if (next != TimerWheel::NEVER && next > mtime + 1)
+            mtime = next - 1;
+    }
+    reset_clk();
+    return false;
+}
+
+// Fires the device events that are due, then takes the highest-priority
+// enabled interrupt: external, software, timer.
+template <class Observe>
+void Simulator::service_events()
+{
+    timers.advance(mtime);
+    uint32_t enabled = pending_interrupts() & mie;
+    if (enabled && (mstatus & MSTATUS_MIE) && mtvec != 0)
+    {
+        uint32_t code = (enabled & MIP_MEIP) ? 11 : (enabled & MIP_MSIP) ? 3 : 7;
+        take_trap<Observe>(MCAUSE_INTERRUPT | code, 0, PC.read());
+    }
+    next_event = timers.next_deadline();
+}
+
+template void Simulator::service_events<Observed>();
+template void Simulator::service_events<Unobserved>();
+
+uint64_t Simulator::schedule_event(uint64_t ticks, function<void()> callback)
+{
+    uint64_t id = timers.schedule(mtime + ticks, move(callback));
+    poll_interrupts();          // picks up the new deadline
+    return id;
+}
+
+void Simulator::set_external_interrupt(bool raised)
+{
+    external_irq = raised;
+    poll_interrupts();
+}
+
+// ───── CLINT ─────
+
+// The register containing addr; 0 for unmapped addresses.
+uint32_t Simulator::clint_read(uint32_t addr) const
+{
+    switch (addr & ~0x3u)
+    {
+    case CLINT_MSIP:         return msip;
+    case CLINT_MTIMECMP:     return uint32_t(mtimecmp);
+    case CLINT_MTIMECMP + 4: return uint32_t(mtimecmp >> 32);
+    case CLINT_MTIME:        return uint32_t(mtime);
+    case CLINT_MTIME + 4:    return uint32_t(mtime >> 32);
+    default:                 return 0;
+    }
+}
+
+// sb and sh merge into the register as they would into memory. Writes to
+// mtime are ignored: the wheel's deadlines are counted in its ticks.
+void Simulator::clint_write(uint32_t addr, uint32_t data, int funct3)
+{
+    uint32_t value = clint_read(addr);
+    if (funct3 == 0x0)
+    {
+        int shift = (addr & 0x3) * 8;
+        value = (value & ~(0xFFu << shift)) | ((data & 0xFF) << shift);
+    }
+    else if (funct3 == 0x1)
+    {
+        int shift = (addr & 0x2) * 8;
+        value = (value & ~(0xFFFFu << shift)) | ((data & 0xFFFF) << shift);
+    }
+    else
+    {
+        value = data;
+    }
+
+    switch (addr & ~0x3u)
+    {
+    case CLINT_MSIP:
+        msip = value & 0x1;
+        poll_interrupts();
+        break;
+    case CLINT_MTIMECMP:
+        set_mtimecmp((mtimecmp & 0xFFFFFFFF00000000ull) | value);
+        break;
+    case CLINT_MTIMECMP + 4:
+        set_mtimecmp((mtimecmp & 0xFFFFFFFFull) | (uint64_t(value) << 32));
+        break;
+    }
+}
+
+// The wheel event only wakes the run loop when mtime reaches mtimecmp;
+// service_events() then sees MTIP.
+void Simulator::set_mtimecmp(uint64_t value)
+{
+    mtimecmp = value;
+    if (mtimecmp_event != 0)
+        timers.cancel(mtimecmp_event);
+    mtimecmp_event = 0;
+    if (value > mtime && value != TimerWheel::NEVER)
+        mtimecmp_event = timers.schedule(value, [] {});
+    poll_interrupts();          // MTIP may have been raised or cleared
+}
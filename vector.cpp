@@ -0,0 +1,384 @@
+﻿#include "simulator.h"
+#include "vector_kernels.h"
+
+// OP-V funct3 categories
+const uint32_t OPIVV = 0x0;
+const uint32_t OPMVV = 0x2;
+const uint32_t OPIVI = 0x3;
+const uint32_t OPIVX = 0x4;
+const uint32_t OPMVX = 0x6;
+const uint32_t OPCFG = 0x7;
+
+// vtype.vill: set when the requested configuration is not supported.
+const uint32_t VTYPE_VILL = 0x80000000;
+
+void Simulator::set_vlen(uint32_t bits)
+{
+    if (bits < 32 || bits > 4096 || (bits & (bits - 1)) != 0)
+        throw runtime_error("VLEN must be a power of two between 32 and 4096");
+    vlen = bits;
+    vregs.assign(32 * (vlen / 32), 0);
+    vtmp.assign(16 * (vlen / 32), 0);
+    vl = 0;
+    vtype = VTYPE_VILL;
+    vlmul = 1;
+}
+
+// Only SEW=32 with integer LMUL (m1, m2, m4, m8) is supported; anything else
+// sets vill and makes every following vector instruction illegal.
+template <class Observe>
+void Simulator::vsetvl(uint32_t rd, uint32_t avl, uint32_t newVtype, bool keepVl)
+{
+    uint32_t vsew = (newVtype >> 3) & 0x7;
+    uint32_t lmulField = newVtype & 0x7;
+    if (vsew != 0x2 || lmulField > 3 || (newVtype >> 8) != 0)
+    {
+        vtype = VTYPE_VILL;
+        vlmul = 1;
+        vl = 0;
+    }
+    else
+    {
+        vtype = newVtype;
+        vlmul = 1u << lmulField;
+        if (!keepVl)
+            vl = min(avl, vlmax());
+        else
+            vl = min(vl, vlmax());
+    }
+    ALUOut.write(vl);
+    print_state();
+
+    clk++;
+    if (rd != 0)
+        write_back<Observe>(rd, ALUOut.read());
+    print_state();
+}
+
+// Returns true if the instruction is illegal (the simulator halts).
+template <class Observe>
+bool Simulator::V_type(uint32_t instr)
+{
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t vd = (instr >> 7) & 0x1F;
+    uint32_t rs1 = (instr >> 15) & 0x1F;    // also vs1 / simm5
+    uint32_t vs2 = (instr >> 20) & 0x1F;
+    bool masked = ((instr >> 25) & 1) == 0;
+    uint32_t funct6 = instr >> 26;
+
+    // Cycle 4: A ← rs1 (scalar operand or AVL)
+    clk++;
+    A.write(regfile[rs1].read());
+    print_state();
+
+    if (funct3 == OPCFG)
+    {
+        // Cycle 5: compute vl from AVL and vtype, cycle 6: rd ← vl
+        clk++;
+        if ((instr >> 31) == 0)                         // vsetvli
+        {
+            uint32_t zimm = (instr >> 20) & 0x7FF;
+            bool keep = (rs1 == 0 && vd == 0);
+            uint32_t avl = (rs1 == 0) ? UINT32_MAX : A.read();
+            vsetvl<Observe>(vd, avl, zimm, keep);
+        }
+        else if ((instr >> 30) == 0x3)                  // vsetivli
+        {
+            vsetvl<Observe>(vd, rs1, (instr >> 20) & 0x3FF, false);
+        }
+        else
+        {
+            return true;
+        }
+        reset_clk();
+        return false;
+    }
+
+    if (vtype & VTYPE_VILL)
+        return true;
+
+    // Register groups must be aligned to LMUL, except for operands that are
+    // a single register: mask results, reduction scalars and vmv.s.x/vmv.x.s.
+    uint32_t n = vl;
+    uint32_t group = vlmul;
+    bool singleDest = (funct3 == OPMVV && (funct6 <= 0x07 || funct6 == 0x10))
+        || (funct3 == OPMVX && funct6 == 0x10)
+        || (funct3 != OPMVV && funct3 != OPMVX && funct6 >= 0x18 && funct6 <= 0x1F);
+    bool singleSource = (funct3 == OPMVV && funct6 == 0x10);
+    if ((!singleDest && vd % group != 0) || (!singleSource && vs2 % group != 0))
+        return true;
+    uint32_t* mask = vreg(0);
+
+    // Cycle 5: run the element loop
+    clk++;
+    bool isMaskResult = false;
+    bool writesScalar = false;     // result goes to x[vd]
+    bool writesElement0 = false;   // result goes to vd[0] only
+    uint32_t scalarResult = 0;
+
+    // Second operand: a vector register, or a scalar/immediate broadcast
+    // into the upper half of vtmp so every form shares the same kernels.
+    const uint32_t* opB;
+    uint32_t* result = vtmp.data();
+    uint32_t* broadcast = vtmp.data() + 8 * (vlen / 32);
+    if (funct3 == OPIVV || funct3 == OPMVV)
+    {
+        if (rs1 % group != 0 && funct3 == OPIVV)
+            return true;
+        opB = vreg(rs1);
+    }
+    else
+    {
+        uint32_t scalar;
+        if (funct3 == OPIVI)
+        {
+            // Shifts take an unsigned 5-bit immediate, everything else signed.
+            bool isShift = (funct6 == 0x25 || funct6 == 0x28 || funct6 == 0x29);
+            scalar = isShift ? rs1 : uint32_t(int32_t(rs1 << 27) >> 27);
+        }
+        else
+            scalar = A.read();
+        B.write(scalar);
+        fill(broadcast, broadcast + n, scalar);
+        opB = broadcast;
+    }
+
+    const uint32_t* opA = vreg(vs2);
+    if (funct3 == OPIVV || funct3 == OPIVX || funct3 == OPIVI)
+    {
+        switch (funct6)
+        {
+        case 0x00: vec_binop(VecOp::Add, result, opA, opB, n); break;
+        case 0x02:
+            if (funct3 == OPIVI) return true;
+            vec_binop(VecOp::Sub, result, opA, opB, n);
+            break;
+        case 0x03:
+            if (funct3 == OPIVV) return true;
+            vec_binop(VecOp::Rsub, result, opA, opB, n);
+            break;
+        case 0x04: vec_binop(VecOp::Minu, result, opA, opB, n); break;
+        case 0x05: vec_binop(VecOp::Min, result, opA, opB, n); break;
+        case 0x06: vec_binop(VecOp::Maxu, result, opA, opB, n); break;
+        case 0x07: vec_binop(VecOp::Max, result, opA, opB, n); break;
+        case 0x09: vec_binop(VecOp::And, result, opA, opB, n); break;
+        case 0x0A: vec_binop(VecOp::Or, result, opA, opB, n); break;
+        case 0x0B: vec_binop(VecOp::Xor, result, opA, opB, n); break;
+        case 0x25: vec_binop(VecOp::Sll, result, opA, opB, n); break;
+        case 0x28: vec_binop(VecOp::Srl, result, opA, opB, n); break;
+        case 0x29: vec_binop(VecOp::Sra, result, opA, opB, n); break;
+        case 0x17: // vmv.v.v / vmv.v.x / vmv.v.i (unmasked vmerge with vs2 = v0)
+            if (masked || vs2 != 0) return true;
+            copy(opB, opB + n, result);
+            break;
+        case 0x18: case 0x19: case 0x1A: case 0x1B:
+        case 0x1C: case 0x1D: case 0x1E: case 0x1F:
+        {
+            static const VecCmp cmps[8] = { VecCmp::Eq, VecCmp::Ne, VecCmp::Ltu, VecCmp::Lt,
+                                            VecCmp::Leu, VecCmp::Le, VecCmp::Gtu, VecCmp::Gt };
+            if (funct6 >= 0x1E && funct3 == OPIVV) return true;
+            if (funct6 == 0x1A && funct3 == OPIVI) return true;
+            if (funct6 == 0x1B && funct3 == OPIVI) return true;
+            VecCmp cmp = cmps[funct6 - 0x18];
+            fill(result, result + (n + 31) / 32, 0);
+            for (uint32_t i = 0; i < n; i++)
+                if (vec_compare(cmp, opA[i], opB[i]))
+                    result[i / 32] |= 1u << (i % 32);
+            isMaskResult = true;
+            break;
+        }
+        default:
+            return true;
+        }
+    }
+    else if (funct3 == OPMVV && funct6 <= 0x07)    // reductions: vd[0] = fold(vs1[0], vs2[*])
+    {
+        static const VecOp folds[8] = { VecOp::Add, VecOp::And, VecOp::Or, VecOp::Xor,
+                                        VecOp::Minu, VecOp::Min, VecOp::Maxu, VecOp::Max };
+        VecOp op = folds[funct6];
+        uint32_t acc = opB[0];
+        if (!masked)
+            acc = vec_reduce(op, acc, opA, n);
+        else
+            for (uint32_t i = 0; i < n; i++)
+                if ((mask[i / 32] >> (i % 32)) & 1)
+                    acc = vec_scalar_op(op, acc, opA[i]);
+        writesElement0 = true;
+        scalarResult = acc;
+    }
+    else if (funct3 == OPMVV && funct6 == 0x10 && rs1 == 0)     // vmv.x.s
+    {
+        writesScalar = true;
+        scalarResult = opA[0];
+    }
+    else if (funct3 == OPMVX && funct6 == 0x10 && vs2 == 0)     // vmv.s.x
+    {
+        writesElement0 = true;
+        scalarResult = A.read();
+    }
+    else if ((funct3 == OPMVV || funct3 == OPMVX) && funct6 == 0x25)    // vmul
+    {
+        vec_binop(VecOp::Mul, result, opA, opB, n);
+    }
+    else
+    {
+        return true;
+    }
+    print_state();
+
+    // Cycle 6: write-back (masked-off and tail elements are left undisturbed)
+    clk++;
+    if (writesScalar)
+    {
+        ALUOut.write(scalarResult);
+        if (vd != 0)
+            write_back<Observe>(vd, ALUOut.read());
+    }
+    else if (writesElement0)
+    {
+        ALUOut.write(scalarResult);
+        if (n != 0)
+            vreg(vd)[0] = ALUOut.read();
+    }
+    else if (isMaskResult)
+    {
+        uint32_t* dst = vreg(vd);
+        for (uint32_t i = 0; i < n; i++)
+        {
+            bool active = !masked || ((mask[i / 32] >> (i % 32)) & 1);
+            if (active)
+                dst[i / 32] = (dst[i / 32] & ~(1u << (i % 32))) | (result[i / 32] & (1u << (i % 32)));
+        }
+    }
+    else if (n != 0)
+    {
+        if (masked)
+            vec_merge_masked(vreg(vd), result, mask, n);
+        else
+            copy(result, result + n, vreg(vd));
+    }
+    print_state();
+    reset_clk();
+    return false;
+}
+
+template bool Simulator::V_type<Observed>(uint32_t);
+template bool Simulator::V_type<Unobserved>(uint32_t);
+
+template <class Observe>
+uint32_t Simulator::vmem_read(uint32_t addr)
+{
+    uint32_t value = 0;
+    if ((addr & 0x3) == 0)
+        value = (addr / 4 < MEM_SIZE) ? mem[addr / 4] : 0;
+    else
+    {
+        uint8_t b;
+        for (int i = 0; i < 4; i++)
+            if (readByte(addr + i, b))
+                value |= uint32_t(b) << (i * 8);
+    }
+    if (is_watched(addr / 4) || is_watched((addr + 3) / 4))
+        check_watch(addr, 4, false, value);
+    if constexpr (Observe::enabled)
+        note_memory(addr, value, 4, false);
+    return value;
+}
+
+template <class Observe>
+void Simulator::vmem_write(uint32_t addr, uint32_t value)
+{
+    if ((addr & 0x3) == 0)
+    {
+        if (addr / 4 < MEM_SIZE)
+        {
+            mem[addr / 4] = value;
+            mark_dirty(addr / 4);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < 4; i++)
+            if ((addr + i) / 4 < MEM_SIZE)
+                put_byte(addr + i, uint8_t(value >> (i * 8)));
+    }
+    if (is_watched(addr / 4) || is_watched((addr + 3) / 4))
+        check_watch(addr, 4, true, value);
+    if constexpr (Observe::enabled)
+        note_memory(addr, value, 4, true);
+}
+
+// vle32.v / vlse32.v / vse32.v / vsse32.v. Other widths and addressing modes
+// (including the scalar FP loads that share these opcodes) are illegal here.
+template <class Observe>
+bool Simulator::V_mem(uint32_t instr, bool isStore)
+{
+    uint32_t width = (instr >> 12) & 0x7;
+    uint32_t vd = (instr >> 7) & 0x1F;
+    uint32_t rs1 = (instr >> 15) & 0x1F;
+    uint32_t rs2 = (instr >> 20) & 0x1F;
+    bool masked = ((instr >> 25) & 1) == 0;
+    uint32_t mop = (instr >> 26) & 0x3;
+    uint32_t nf = instr >> 29;
+    bool mew = (instr >> 28) & 1;
+
+    if (width != 0x6 || nf != 0 || mew || (mop != 0 && mop != 2) || (mop == 0 && rs2 != 0))
+        return true;
+    if ((vtype & VTYPE_VILL) || vd % vlmul != 0)
+        return true;
+
+    // Cycle 4: A ← base, B ← stride
+    clk++;
+    A.write(regfile[rs1].read());
+    B.write(mop == 2 ? regfile[rs2].read() : 4);
+    print_state();
+
+    // Cycle 5: ALUOut ← base address
+    clk++;
+    ALUOut.write(A.read());
+    print_state();
+
+    // Cycle 6: MAR ← ALUOut
+    clk++;
+    MAR.write(ALUOut.read());
+    print_state();
+
+    // Cycle 7: transfer the elements (MDR holds the last one)
+    clk++;
+    uint32_t* v = vreg(vd);
+    uint32_t* mask = vreg(0);
+    uint32_t base = MAR.read();
+    uint32_t stride = B.read();
+    for (uint32_t i = 0; i < vl; i++)
+    {
+        if (masked && !((mask[i / 32] >> (i % 32)) & 1))
+            continue;
+        uint32_t addr = base + i * stride;
+        if (isStore)
+        {
+            MDR.write(v[i]);
+            vmem_write<Observe>(addr, v[i]);
+        }
+        else
+        {
+            MDR.write(vmem_read<Observe>(addr));
+            vtmp[i] = MDR.read();
+        }
+    }
+    print_state();
+
+    // Cycle 8: write the loaded elements into vd
+    if (!isStore)
+    {
+        clk++;
+        for (uint32_t i = 0; i < vl; i++)
+            if (!masked || ((mask[i / 32] >> (i % 32)) & 1))
+                v[i] = vtmp[i];
+        print_state();
+    }
+    reset_clk();
+    return false;
+}
+
+template bool Simulator::V_mem<Observed>(uint32_t, bool);
+template bool Simulator::V_mem<Unobserved>(uint32_t, bool);
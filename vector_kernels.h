@@ -0,0 +1,163 @@
+#pragma once
+#ifndef VECTOR_KERNELS_H
+#define VECTOR_KERNELS_H
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define VK_SSE2 1
+#endif
+
+// Element loops behind the RVV integer instructions. Every kernel works on
+// SEW=32 elements and has an AVX2 path, an SSE2 path for the operations SSE2
+// can express, and a scalar fallback for everything else.
+
+enum class VecOp
+{
+    Add, Sub, Rsub, And, Or, Xor,
+    Sll, Srl, Sra,
+    Mul,
+    Min, Minu, Max, Maxu
+};
+
+inline uint32_t vec_scalar_op(VecOp op, uint32_t a, uint32_t b)
+{
+    switch (op)
+    {
+    case VecOp::Add:  return a + b;
+    case VecOp::Sub:  return a - b;
+    case VecOp::Rsub: return b - a;
+    case VecOp::And:  return a & b;
+    case VecOp::Or:   return a | b;
+    case VecOp::Xor:  return a ^ b;
+    case VecOp::Sll:  return a << (b & 31);
+    case VecOp::Srl:  return a >> (b & 31);
+    case VecOp::Sra:  return uint32_t(int32_t(a) >> (b & 31));
+    case VecOp::Mul:  return a * b;
+    case VecOp::Min:  return uint32_t(std::min(int32_t(a), int32_t(b)));
+    case VecOp::Minu: return std::min(a, b);
+    case VecOp::Max:  return uint32_t(std::max(int32_t(a), int32_t(b)));
+    case VecOp::Maxu: return std::max(a, b);
+    }
+    return 0;
+}
+
+// d[i] = a[i] op b[i] for i < n. d may alias a or b.
+inline void vec_binop(VecOp op, uint32_t* d, const uint32_t* a, const uint32_t* b, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i shiftMask = _mm256_set1_epi32(31);
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+        __m256i r;
+        switch (op)
+        {
+        case VecOp::Add:  r = _mm256_add_epi32(va, vb); break;
+        case VecOp::Sub:  r = _mm256_sub_epi32(va, vb); break;
+        case VecOp::Rsub: r = _mm256_sub_epi32(vb, va); break;
+        case VecOp::And:  r = _mm256_and_si256(va, vb); break;
+        case VecOp::Or:   r = _mm256_or_si256(va, vb); break;
+        case VecOp::Xor:  r = _mm256_xor_si256(va, vb); break;
+        case VecOp::Sll:  r = _mm256_sllv_epi32(va, _mm256_and_si256(vb, shiftMask)); break;
+        case VecOp::Srl:  r = _mm256_srlv_epi32(va, _mm256_and_si256(vb, shiftMask)); break;
+        case VecOp::Sra:  r = _mm256_srav_epi32(va, _mm256_and_si256(vb, shiftMask)); break;
+        case VecOp::Mul:  r = _mm256_mullo_epi32(va, vb); break;
+        case VecOp::Min:  r = _mm256_min_epi32(va, vb); break;
+        case VecOp::Minu: r = _mm256_min_epu32(va, vb); break;
+        case VecOp::Max:  r = _mm256_max_epi32(va, vb); break;
+        default:          r = _mm256_max_epu32(va, vb); break;
+        }
+        _mm256_storeu_si256((__m256i*)(d + i), r);
+    }
+#elif defined(VK_SSE2)
+    if (op == VecOp::Add || op == VecOp::Sub || op == VecOp::Rsub ||
+        op == VecOp::And || op == VecOp::Or || op == VecOp::Xor)
+    {
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+            __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+            __m128i r;
+            switch (op)
+            {
+            case VecOp::Add:  r = _mm_add_epi32(va, vb); break;
+            case VecOp::Sub:  r = _mm_sub_epi32(va, vb); break;
+            case VecOp::Rsub: r = _mm_sub_epi32(vb, va); break;
+            case VecOp::And:  r = _mm_and_si128(va, vb); break;
+            case VecOp::Or:   r = _mm_or_si128(va, vb); break;
+            default:          r = _mm_xor_si128(va, vb); break;
+            }
+            _mm_storeu_si128((__m128i*)(d + i), r);
+        }
+    }
+#endif
+    for (; i < n; i++)
+        d[i] = vec_scalar_op(op, a[i], b[i]);
+}
+
+// Folds a[0..n) into acc with op (Add, And, Or, Xor, Min, Minu, Max, Maxu).
+inline uint32_t vec_reduce(VecOp op, uint32_t acc, const uint32_t* a, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    if (n >= 8 && (op == VecOp::Add || op == VecOp::And || op == VecOp::Or || op == VecOp::Xor))
+    {
+        __m256i r = _mm256_loadu_si256((const __m256i*)a);
+        for (i = 8; i + 8 <= n; i += 8)
+        {
+            __m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+            switch (op)
+            {
+            case VecOp::Add: r = _mm256_add_epi32(r, va); break;
+            case VecOp::And: r = _mm256_and_si256(r, va); break;
+            case VecOp::Or:  r = _mm256_or_si256(r, va); break;
+            default:         r = _mm256_xor_si256(r, va); break;
+            }
+        }
+        alignas(32) uint32_t lanes[8];
+        _mm256_store_si256((__m256i*)lanes, r);
+        for (uint32_t lane : lanes)
+            acc = vec_scalar_op(op, acc, lane);
+    }
+#endif
+    for (; i < n; i++)
+        acc = vec_scalar_op(op, acc, a[i]);
+    return acc;
+}
+
+// Element-wise compare producing one mask bit per element into mask[].
+enum class VecCmp
+{
+    Eq, Ne, Ltu, Lt, Leu, Le, Gtu, Gt
+};
+
+inline bool vec_compare(VecCmp cmp, uint32_t a, uint32_t b)
+{
+    switch (cmp)
+    {
+    case VecCmp::Eq:  return a == b;
+    case VecCmp::Ne:  return a != b;
+    case VecCmp::Ltu: return a < b;
+    case VecCmp::Lt:  return int32_t(a) < int32_t(b);
+    case VecCmp::Leu: return a <= b;
+    case VecCmp::Le:  return int32_t(a) <= int32_t(b);
+    case VecCmp::Gtu: return a > b;
+    default:          return int32_t(a) > int32_t(b);
+    }
+}
+
+// Copies src into dst only for elements whose mask bit is set.
+inline void vec_merge_masked(uint32_t* dst, const uint32_t* src, const uint32_t* mask, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        if ((mask[i / 32] >> (i % 32)) & 1)
+            dst[i] = src[i];
+}
+
+#endif